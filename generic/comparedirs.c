@@ -0,0 +1,552 @@
+/***********************************************************************
+ *
+ * This file implements comparison of two directory trees
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "diffutil.h"
+
+/* Visual C++ does not define S_ISDIR */
+#ifndef S_ISDIR
+#define S_ISDIR(mode_) (((mode_) & _S_IFMT) == _S_IFDIR)
+#endif
+
+/* Status of a file pair */
+#define DIR_PENDING 0
+#define DIR_EQUAL   1
+#define DIR_DIFFER  2
+
+/* A pair of files existing in both trees */
+typedef struct {
+    Tcl_Obj *relPtr;              /* Relative path */
+    Tcl_Obj *file1Ptr, *file2Ptr; /* Only touched by the calling thread */
+    char *path1, *path2;          /* For use in workers, may be NULL */
+    int status;
+} DirItem_T;
+
+typedef struct {
+    Tcl_Interp *interp;
+    CmpOptions_T cmpOptions;
+    DirItem_T *items;
+    int nItems, allocedItems;
+    int *pending;                 /* Indexes of items to compare */
+    int nPending;
+    int needInterp;               /* Some file can only be read here */
+    Tcl_Obj *onlyLeftPtr, *onlyRightPtr;
+} DirCompare_T;
+
+static int
+CompareTails(const void *a, const void *b)
+{
+    return strcmp(Tcl_GetString(*(Tcl_Obj **) a),
+                  Tcl_GetString(*(Tcl_Obj **) b));
+}
+
+/*
+ * Get a sorted list of the names in a directory.
+ */
+static int
+ListDirectory(
+    Tcl_Interp *interp,
+    Tcl_Obj *dirPtr,
+    int *countPtr,
+    Tcl_Obj ***namesPtr)
+{
+    Tcl_Obj *listPtr, **elemv, *splitPtr, *tailPtr;
+    Tcl_Obj **names;
+    int elemc, splitc, i, n;
+    const char *tail;
+
+    listPtr = Tcl_NewObj();
+    Tcl_IncrRefCount(listPtr);
+    /* The second pattern is to get hidden files too. */
+    if (Tcl_FSMatchInDirectory(interp, listPtr, dirPtr, "*", NULL) != TCL_OK
+            || Tcl_FSMatchInDirectory(interp, listPtr, dirPtr, ".*", NULL)
+            != TCL_OK) {
+        Tcl_DecrRefCount(listPtr);
+        return TCL_ERROR;
+    }
+    Tcl_ListObjGetElements(NULL, listPtr, &elemc, &elemv);
+    names = (Tcl_Obj **) ckalloc((elemc + 1) * sizeof(Tcl_Obj *));
+    n = 0;
+    for (i = 0; i < elemc; i++) {
+        splitPtr = Tcl_FSSplitPath(elemv[i], &splitc);
+        Tcl_IncrRefCount(splitPtr);
+        Tcl_ListObjIndex(NULL, splitPtr, splitc - 1, &tailPtr);
+        tail = Tcl_GetString(tailPtr);
+        if (strcmp(tail, ".") != 0 && strcmp(tail, "..") != 0) {
+            names[n] = tailPtr;
+            Tcl_IncrRefCount(tailPtr);
+            n++;
+        }
+        Tcl_DecrRefCount(splitPtr);
+    }
+    Tcl_DecrRefCount(listPtr);
+
+    qsort(names, (size_t) n, sizeof(Tcl_Obj *), CompareTails);
+    *countPtr = n;
+    *namesPtr = names;
+    return TCL_OK;
+}
+
+static void
+FreeNames(int count, Tcl_Obj **names)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        Tcl_DecrRefCount(names[i]);
+    }
+    ckfree((char *) names);
+}
+
+/*
+ * Add a file pair to the list.
+ */
+static DirItem_T *
+AddDirItem(
+    DirCompare_T *dcPtr,
+    Tcl_Obj *relPtr,
+    Tcl_Obj *file1Ptr,
+    Tcl_Obj *file2Ptr,
+    int status)
+{
+    DirItem_T *itemPtr;
+
+    if (dcPtr->nItems >= dcPtr->allocedItems) {
+        dcPtr->allocedItems = dcPtr->allocedItems * 2 + 100;
+        if (dcPtr->items == NULL) {
+            dcPtr->items = (DirItem_T *)
+                    ckalloc(dcPtr->allocedItems * sizeof(DirItem_T));
+        } else {
+            dcPtr->items = (DirItem_T *) ckrealloc((char *) dcPtr->items,
+                    dcPtr->allocedItems * sizeof(DirItem_T));
+        }
+    }
+    itemPtr = &dcPtr->items[dcPtr->nItems++];
+    memset(itemPtr, 0, sizeof(DirItem_T));
+    itemPtr->relPtr = relPtr;
+    Tcl_IncrRefCount(relPtr);
+    itemPtr->status = status;
+    if (status == DIR_PENDING) {
+        itemPtr->file1Ptr = file1Ptr;
+        itemPtr->file2Ptr = file2Ptr;
+        Tcl_IncrRefCount(file1Ptr);
+        Tcl_IncrRefCount(file2Ptr);
+        itemPtr->path1 = LineStorePath(file1Ptr);
+        itemPtr->path2 = LineStorePath(file2Ptr);
+        if (itemPtr->path1 == NULL || itemPtr->path2 == NULL) {
+            dcPtr->needInterp = 1;
+        }
+    }
+    return itemPtr;
+}
+
+/*
+ * Check two files that exist in both trees, and decide if they can be
+ * judged without looking at the contents.
+ */
+static int
+QuickCompare(
+    DirCompare_T *dcPtr,
+    Tcl_Obj *file1Ptr,
+    Tcl_Obj *file2Ptr)
+{
+    Tcl_StatBuf *stat1, *stat2;
+    int status = DIR_PENDING;
+    Tcl_WideUInt size1, size2;
+
+    stat1 = Tcl_AllocStatBuf();
+    stat2 = Tcl_AllocStatBuf();
+    if (Tcl_FSStat(file1Ptr, stat1) != 0 ||
+            Tcl_FSStat(file2Ptr, stat2) != 0) {
+        /* E.g. a broken link */
+        status = DIR_DIFFER;
+        goto done;
+    }
+    /* The same file seen through different paths */
+    if (Tcl_GetFSInodeFromStat(stat1) != 0 &&
+            Tcl_GetFSDeviceFromStat(stat1) == Tcl_GetFSDeviceFromStat(stat2) &&
+            Tcl_GetFSInodeFromStat(stat1) == Tcl_GetFSInodeFromStat(stat2)) {
+        status = DIR_EQUAL;
+        goto done;
+    }
+    if (S_ISDIR(Tcl_GetModeFromStat(stat1)) ||
+            S_ISDIR(Tcl_GetModeFromStat(stat2))) {
+        status = DIR_DIFFER;
+        goto done;
+    }
+    size1 = Tcl_GetSizeFromStat(stat1);
+    size2 = Tcl_GetSizeFromStat(stat2);
+    /* An empty file only equals an empty file */
+    if (size1 == 0 || size2 == 0) {
+        status = (size1 == size2) ? DIR_EQUAL : DIR_DIFFER;
+        goto done;
+    }
+    /* On binary comparison, different size means different */
+    if (dcPtr->cmpOptions.binary && !dcPtr->cmpOptions.ignoreKey &&
+            size1 != size2) {
+        status = DIR_DIFFER;
+    }
+    done:
+    ckfree((char *) stat1);
+    ckfree((char *) stat2);
+    return status;
+}
+
+/* Check if a path is a directory, not following links */
+static int
+IsRealDir(Tcl_Obj *pathPtr)
+{
+    Tcl_StatBuf *statBuf = Tcl_AllocStatBuf();
+    int isDir = 0;
+
+    if (Tcl_FSLstat(pathPtr, statBuf) == 0) {
+        isDir = S_ISDIR(Tcl_GetModeFromStat(statBuf));
+    }
+    ckfree((char *) statBuf);
+    return isDir;
+}
+
+/* Get the relative path of an entry */
+static Tcl_Obj *
+RelativePath(Tcl_Obj *relPtr, Tcl_Obj *namePtr)
+{
+    Tcl_Obj *resPtr;
+
+    if (relPtr == NULL) {
+        return namePtr;
+    }
+    resPtr = Tcl_DuplicateObj(relPtr);
+    Tcl_AppendToObj(resPtr, "/", 1);
+    Tcl_AppendObjToObj(resPtr, namePtr);
+    return resPtr;
+}
+
+/*
+ * Walk two directories in parallel.
+ * Entries found in only one tree are added to the result directly,
+ * files in both trees are added to the item list.
+ */
+static int
+WalkDirs(
+    DirCompare_T *dcPtr,
+    Tcl_Obj *dir1Ptr,
+    Tcl_Obj *dir2Ptr,
+    Tcl_Obj *relPtr)
+{
+    Tcl_Interp *interp = dcPtr->interp;
+    Tcl_Obj **names1 = NULL, **names2 = NULL;
+    Tcl_Obj *child1Ptr, *child2Ptr, *childRelPtr;
+    int count1 = 0, count2 = 0, i1, i2, cmp, isDir1, isDir2;
+    int result = TCL_OK;
+
+    if (ListDirectory(interp, dir1Ptr, &count1, &names1) != TCL_OK ||
+            ListDirectory(interp, dir2Ptr, &count2, &names2) != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+
+    i1 = i2 = 0;
+    while (i1 < count1 || i2 < count2) {
+        if (i1 >= count1) {
+            cmp = 1;
+        } else if (i2 >= count2) {
+            cmp = -1;
+        } else {
+            cmp = strcmp(Tcl_GetString(names1[i1]),
+                         Tcl_GetString(names2[i2]));
+        }
+        if (cmp < 0) {
+            Tcl_ListObjAppendElement(NULL, dcPtr->onlyLeftPtr,
+                                     RelativePath(relPtr, names1[i1]));
+            i1++;
+            continue;
+        }
+        if (cmp > 0) {
+            Tcl_ListObjAppendElement(NULL, dcPtr->onlyRightPtr,
+                                     RelativePath(relPtr, names2[i2]));
+            i2++;
+            continue;
+        }
+        childRelPtr = RelativePath(relPtr, names1[i1]);
+        Tcl_IncrRefCount(childRelPtr);
+        child1Ptr = Tcl_FSJoinToPath(dir1Ptr, 1, &names1[i1]);
+        Tcl_IncrRefCount(child1Ptr);
+        child2Ptr = Tcl_FSJoinToPath(dir2Ptr, 1, &names2[i2]);
+        Tcl_IncrRefCount(child2Ptr);
+
+        isDir1 = IsRealDir(child1Ptr);
+        isDir2 = IsRealDir(child2Ptr);
+        if (isDir1 && isDir2) {
+            result = WalkDirs(dcPtr, child1Ptr, child2Ptr, childRelPtr);
+        } else if (isDir1 || isDir2) {
+            AddDirItem(dcPtr, childRelPtr, NULL, NULL, DIR_DIFFER);
+        } else {
+            AddDirItem(dcPtr, childRelPtr, child1Ptr, child2Ptr,
+                       QuickCompare(dcPtr, child1Ptr, child2Ptr));
+        }
+        Tcl_DecrRefCount(childRelPtr);
+        Tcl_DecrRefCount(child1Ptr);
+        Tcl_DecrRefCount(child2Ptr);
+        if (result != TCL_OK) {
+            goto cleanup;
+        }
+        i1++;
+        i2++;
+    }
+
+    cleanup:
+    if (names1 != NULL) FreeNames(count1, names1);
+    if (names2 != NULL) FreeNames(count2, names2);
+    return result;
+}
+
+/*
+ * Compare the contents of one file pair. This is called from a worker
+ * thread, or from the calling thread when running without workers.
+ */
+static void
+CompareDirItem(ClientData clientData, int index, ClientData *workerDataPtr)
+{
+    DirCompare_T *dcPtr = (DirCompare_T *) clientData;
+    DirItem_T *itemPtr = &dcPtr->items[dcPtr->pending[index]];
+    Tcl_Obj *file1Ptr, *file2Ptr;
+    CmpOptions_T cmpOptions = dcPtr->cmpOptions;
+    int equal = 0;
+
+    if (itemPtr->path1 != NULL && itemPtr->path2 != NULL) {
+        file1Ptr = Tcl_NewStringObj(itemPtr->path1, -1);
+        file2Ptr = Tcl_NewStringObj(itemPtr->path2, -1);
+    } else {
+        file1Ptr = itemPtr->file1Ptr;
+        file2Ptr = itemPtr->file2Ptr;
+    }
+    Tcl_IncrRefCount(file1Ptr);
+    Tcl_IncrRefCount(file2Ptr);
+    /* A file that cannot be read is counted as differing */
+    if (CompareFileNames(NULL, file1Ptr, file2Ptr, &cmpOptions, NULL, &equal)
+            != TCL_OK) {
+        equal = 0;
+    }
+    itemPtr->status = equal ? DIR_EQUAL : DIR_DIFFER;
+    Tcl_DecrRefCount(file1Ptr);
+    Tcl_DecrRefCount(file2Ptr);
+}
+
+int
+CompareDirsObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int index, t, i, nThreads, result = TCL_OK;
+    Tcl_Obj *dir1Ptr, *dir2Ptr, *differPtr, *equalPtr, *resPtr;
+    Tcl_Obj *encodingPtr = NULL;
+    Tcl_Obj *translationPtr = NULL;
+    Tcl_StatBuf *statBuf;
+    DirCompare_T dc;
+    Parallel_T par;
+
+    static CONST char *options[] = {
+	"-nocase", "-ignorekey", "-encoding",
+        "-translation", "-binary", "-threads", (char *) NULL
+    };
+    enum options {
+	OPT_NOCASE, OPT_IGNOREKEY, OPT_ENCODING,
+        OPT_TRANSLATION, OPT_BINARY, OPT_THREADS
+    };
+
+    if (objc < 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?opts? dir1 dir2");
+	return TCL_ERROR;
+    }
+    memset(&dc, 0, sizeof(dc));
+    dc.interp = interp;
+    InitCmpOptions_T(dc.cmpOptions);
+    nThreads = ParallelDefaultThreads();
+
+    for (t = 1; t < objc - 2; t++) {
+	if (Tcl_GetIndexFromObj(interp, objv[t], options, "option", 0,
+		&index) != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+	}
+	switch (index) {
+	  case OPT_NOCASE:
+	      dc.cmpOptions.noCase = 1;
+	      break;
+	  case OPT_IGNOREKEY:
+	      dc.cmpOptions.ignoreKey = 1;
+	      break;
+	  case OPT_BINARY:
+	      dc.cmpOptions.binary = 1;
+	      dc.cmpOptions.translation = "binary";
+	      break;
+	  case OPT_ENCODING:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? dir1 dir2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      encodingPtr = objv[t];
+	      Tcl_IncrRefCount(objv[t]);
+	      break;
+	  case OPT_TRANSLATION:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? dir1 dir2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      translationPtr = objv[t];
+	      Tcl_IncrRefCount(objv[t]);
+	      break;
+	  case OPT_THREADS:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? dir1 dir2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (Tcl_GetIntFromObj(interp, objv[t], &nThreads) != TCL_OK) {
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (nThreads < 1) {
+		  Tcl_SetResult(interp, "Threads must be at least 1",
+				TCL_STATIC);
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      break;
+	}
+    }
+    dir1Ptr = objv[objc-2];
+    dir2Ptr = objv[objc-1];
+
+    if (encodingPtr != NULL) {
+	/* Catch a bad encoding here, where it can be reported. */
+	Tcl_Encoding enc = Tcl_GetEncoding(interp,
+					   Tcl_GetString(encodingPtr));
+	if (enc == NULL) {
+	    result = TCL_ERROR;
+	    goto cleanup;
+	}
+	Tcl_FreeEncoding(enc);
+	dc.cmpOptions.encoding = Tcl_GetString(encodingPtr);
+    }
+    if (translationPtr != NULL) {
+	char *valueName = Tcl_GetString(translationPtr);
+	dc.cmpOptions.translation = valueName;
+	if (strcmp(valueName, "binary") == 0) {
+	    dc.cmpOptions.binary = 1;
+	}
+    }
+
+    statBuf = Tcl_AllocStatBuf();
+    for (i = 0; i < 2; i++) {
+	Tcl_Obj *dirPtr = i == 0 ? dir1Ptr : dir2Ptr;
+	if (Tcl_FSStat(dirPtr, statBuf) != 0 ||
+		!S_ISDIR(Tcl_GetModeFromStat(statBuf))) {
+	    Tcl_SetObjResult(interp, Tcl_ObjPrintf("bad directory \"%s\"",
+						   Tcl_GetString(dirPtr)));
+	    result = TCL_ERROR;
+	    break;
+	}
+    }
+    ckfree((char *) statBuf);
+    if (result != TCL_OK) {
+	goto cleanup;
+    }
+
+    dc.onlyLeftPtr = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(dc.onlyLeftPtr);
+    dc.onlyRightPtr = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(dc.onlyRightPtr);
+
+    if (WalkDirs(&dc, dir1Ptr, dir2Ptr, NULL) != TCL_OK) {
+	result = TCL_ERROR;
+	goto cleanup;
+    }
+
+    /* Compare contents for those that could not be decided directly */
+    dc.pending = (int *) ckalloc((dc.nItems + 1) * sizeof(int));
+    for (i = 0; i < dc.nItems; i++) {
+	if (dc.items[i].status == DIR_PENDING) {
+	    dc.pending[dc.nPending++] = i;
+	}
+    }
+    if (dc.needInterp) {
+	/* Some file can only be read by this thread, so no workers. */
+	nThreads = 1;
+    }
+    ParallelStart(&par, nThreads, dc.nPending, CompareDirItem, NULL,
+		  (ClientData) &dc);
+    for (i = 0; i < dc.nPending; i++) {
+	ParallelWait(&par, i);
+    }
+    ParallelFinish(&par);
+
+    differPtr = Tcl_NewListObj(0, NULL);
+    equalPtr = Tcl_NewListObj(0, NULL);
+    for (i = 0; i < dc.nItems; i++) {
+	Tcl_ListObjAppendElement(NULL,
+		dc.items[i].status == DIR_EQUAL ? equalPtr : differPtr,
+		dc.items[i].relPtr);
+    }
+    resPtr = Tcl_NewDictObj();
+    Tcl_DictObjPut(NULL, resPtr, Tcl_NewStringObj("only-left", -1),
+		   dc.onlyLeftPtr);
+    Tcl_DictObjPut(NULL, resPtr, Tcl_NewStringObj("only-right", -1),
+		   dc.onlyRightPtr);
+    Tcl_DictObjPut(NULL, resPtr, Tcl_NewStringObj("differ", -1), differPtr);
+    Tcl_DictObjPut(NULL, resPtr, Tcl_NewStringObj("equal", -1), equalPtr);
+    Tcl_SetObjResult(interp, resPtr);
+
+    cleanup:
+    if (dc.onlyLeftPtr != NULL) {
+	Tcl_DecrRefCount(dc.onlyLeftPtr);
+    }
+    if (dc.onlyRightPtr != NULL) {
+	Tcl_DecrRefCount(dc.onlyRightPtr);
+    }
+    for (i = 0; i < dc.nItems; i++) {
+	DirItem_T *itemPtr = &dc.items[i];
+	Tcl_DecrRefCount(itemPtr->relPtr);
+	if (itemPtr->file1Ptr != NULL) Tcl_DecrRefCount(itemPtr->file1Ptr);
+	if (itemPtr->file2Ptr != NULL) Tcl_DecrRefCount(itemPtr->file2Ptr);
+	if (itemPtr->path1 != NULL) ckfree(itemPtr->path1);
+	if (itemPtr->path2 != NULL) ckfree(itemPtr->path2);
+    }
+    if (dc.items != NULL) {
+	ckfree((char *) dc.items);
+    }
+    if (dc.pending != NULL) {
+	ckfree((char *) dc.pending);
+    }
+    if (encodingPtr != NULL) {
+	Tcl_DecrRefCount(encodingPtr);
+    }
+    if (translationPtr != NULL) {
+	Tcl_DecrRefCount(translationPtr);
+    }
+
+    return result;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
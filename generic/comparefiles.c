@@ -12,6 +12,11 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "diffutil.h"
 
 /* Visual C++ does not define S_ISDIR */
@@ -20,15 +25,14 @@
 #endif
 
 const int BlockRead_C = 65536;
-
-typedef struct {
-    int ignoreKey;
-    int noCase;
-    int binary;
-} CmpOptions_T;
-
-/* Helper to get a filled in CmpOptions_T */
-#define InitCmpOptions_T(opts) {opts.ignoreKey = 0; opts.noCase = 0; opts.binary = 0;}
+/* Values for -result, in CMP_RESULT_* order */
+static CONST char *resultStyles[] = {
+    "bool", "offset", "line", (char *) NULL
+};
+/* Block size for binary comparisons */
+#define BINARY_BLOCK (1024 * 1024)
+/* Chunk size when comparing mapped files in parallel */
+#define PARALLEL_CHUNK (8 * 1024 * 1024)
 
 /* This is called when a dollar is encountered during ignore-keyword.
    If return is equal res1/2 says how far we covered and considered equal.
@@ -144,6 +148,9 @@ CompareNoKey(
     const char *scan1, *scan2;
 
     while (s1 < end1 && s2 < end2) {
+	/* On failure, res1/2 tell where the difference is */
+	*res1 = s1;
+	*res2 = s2;
 	if (cmpOptions->binary) {
 	    ch1 = *(s1++);
 	    ch2 = *(s2++);
@@ -179,11 +186,340 @@ CompareNoKey(
     return 1;
 }
 
+/*
+ * Move a position forward over data that was equal.
+ * In binary mode the offset is counted in bytes, otherwise in characters.
+ */
+static void
+AdvancePosition(
+    CmpPosition_T *posPtr,
+    const char *data,
+    unsigned long length,       /* In bytes */
+    int binary)
+{
+    const char *p, *end = data + length, *lineStart = NULL;
+
+    if (posPtr->style == CMP_RESULT_BOOL) {
+        return;
+    }
+    if (binary) {
+        posPtr->offset += length;
+    } else {
+        posPtr->offset += Tcl_NumUtfChars(data, (int) length);
+    }
+    if (posPtr->style != CMP_RESULT_LINE) {
+        return;
+    }
+    p = data;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        posPtr->line++;
+        p++;
+        lineStart = p;
+    }
+    if (lineStart != NULL) {
+        posPtr->column = 0;
+    } else {
+        lineStart = data;
+    }
+    if (binary) {
+        posPtr->column += end - lineStart;
+    } else {
+        posPtr->column += Tcl_NumUtfChars(lineStart, (int) (end - lineStart));
+    }
+}
+
+/*
+ * Find how many bytes of string1 are equal to string2, comparing
+ * characters.
+ */
+static unsigned long
+EqualUtfPrefix(
+    const char *string1, unsigned long length1,
+    const char *string2, unsigned long length2,
+    int noCase)
+{
+    const char *s1 = string1, *s2 = string2, *prev1;
+    const char *end1 = string1 + length1, *end2 = string2 + length2;
+    Tcl_UniChar ch1 = 0, ch2 = 0;
+
+    while (s1 < end1 && s2 < end2) {
+        prev1 = s1;
+        s1 += Tcl_UtfToUniChar(s1, &ch1);
+        s2 += Tcl_UtfToUniChar(s2, &ch2);
+        if (ch1 != ch2 && (!noCase || Tcl_UniCharToLower(ch1) !=
+                           Tcl_UniCharToLower(ch2))) {
+            return prev1 - string1;
+        }
+    }
+    return s1 - string1;
+}
+
+/*
+ * Find the first differing byte in two blocks that are known to differ.
+ * memcmp is used in strides to let it do the heavy lifting.
+ */
+static unsigned long
+FirstDifference(const char *s1, const char *s2, unsigned long length)
+{
+    unsigned long i = 0;
+
+    while (i + 64 <= length && memcmp(s1 + i, s2 + i, 64) == 0) {
+        i += 64;
+    }
+    while (i < length && s1[i] == s2[i]) {
+        i++;
+    }
+    return i;
+}
+
+/*
+ * Compare two byte ranges in large strides.
+ * Returns true if equal, otherwise the offset of the first difference
+ * is stored.
+ */
+static int
+CompareBytes(const char *s1, const char *s2, Tcl_WideUInt length,
+             Tcl_WideUInt *offsetPtr)
+{
+    Tcl_WideUInt pos = 0;
+    unsigned long n;
+
+    while (pos < length) {
+        n = BINARY_BLOCK;
+        if (length - pos < n) n = (unsigned long) (length - pos);
+        if (memcmp(s1 + pos, s2 + pos, n) != 0) {
+            *offsetPtr = pos + FirstDifference(s1 + pos, s2 + pos, n);
+            return 0;
+        }
+        pos += n;
+    }
+    return 1;
+}
+
+/*
+ * Fast binary comparison of two channels, using large blocks.
+ * Returns true if equal, otherwise the position of the first difference
+ * is stored.
+ */
+static int
+CompareBinaryChannels(
+    Tcl_Channel ch1,
+    Tcl_Channel ch2,
+    CmpPosition_T *posPtr)
+{
+    char *buf1, *buf2;
+    int read1, read2, n, equal = 1;
+    Tcl_WideUInt diff;
+
+    buf1 = ckalloc(BINARY_BLOCK);
+    buf2 = ckalloc(BINARY_BLOCK);
+    while (1) {
+        read1 = Tcl_Read(ch1, buf1, BINARY_BLOCK);
+        read2 = Tcl_Read(ch2, buf2, BINARY_BLOCK);
+        if (read1 < 0) read1 = 0;
+        if (read2 < 0) read2 = 0;
+        n = read1 < read2 ? read1 : read2;
+        if (!CompareBytes(buf1, buf2, n, &diff)) {
+            AdvancePosition(posPtr, buf1, (unsigned long) diff, 1);
+            equal = 0;
+            break;
+        }
+        AdvancePosition(posPtr, buf1, n, 1);
+        if (read1 != read2) {
+            /* One of the files is ended */
+            equal = 0;
+            break;
+        }
+        if (read1 == 0) {
+            break;
+        }
+    }
+    ckfree(buf1);
+    ckfree(buf2);
+    return equal;
+}
+
+#ifndef _WIN32
+/* Two mapped files compared in chunks by a pool of threads */
+typedef struct {
+    const char *s1, *s2;
+    Tcl_WideUInt length;
+    Tcl_WideUInt *diff;         /* Offset of difference in each chunk */
+    char *differ;               /* Set for each chunk that differs */
+    Parallel_T *parPtr;
+} ChunkCompare_T;
+
+static void
+CompareChunk(ClientData clientData, int index, ClientData *workerDataPtr)
+{
+    ChunkCompare_T *cmpPtr = (ChunkCompare_T *) clientData;
+    Tcl_WideUInt start = (Tcl_WideUInt) index * PARALLEL_CHUNK;
+    Tcl_WideUInt n = cmpPtr->length - start;
+
+    if (n > PARALLEL_CHUNK) n = PARALLEL_CHUNK;
+    if (!CompareBytes(cmpPtr->s1 + start, cmpPtr->s2 + start, n,
+                      &cmpPtr->diff[index])) {
+        cmpPtr->diff[index] += start;
+        cmpPtr->differ[index] = 1;
+        /*
+         * No need to look further. Chunks before this one have all
+         * been started, since they are handed out in order, and
+         * will be finished.
+         */
+        ParallelAbort(cmpPtr->parPtr);
+    }
+}
+
+/*
+ * As CompareBytes, but large ranges are split in chunks that are
+ * compared by up to nThreads threads.
+ */
+static int
+CompareBytesParallel(const char *s1, const char *s2, Tcl_WideUInt length,
+                     int nThreads, Tcl_WideUInt *offsetPtr)
+{
+    ChunkCompare_T cmp;
+    Parallel_T par;
+    int i, count, equal = 1;
+
+    if (nThreads <= 1 || length < 2 * PARALLEL_CHUNK ||
+            (length / PARALLEL_CHUNK) >= 0x7fffffff) {
+        return CompareBytes(s1, s2, length, offsetPtr);
+    }
+    count = (int) ((length + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK);
+    cmp.s1 = s1;
+    cmp.s2 = s2;
+    cmp.length = length;
+    cmp.diff = (Tcl_WideUInt *) ckalloc(count * sizeof(Tcl_WideUInt));
+    cmp.differ = ckalloc(count);
+    memset(cmp.differ, 0, count);
+    cmp.parPtr = &par;
+
+    ParallelStart(&par, nThreads, count, CompareChunk, NULL,
+                  (ClientData) &cmp);
+    /* The first differing chunk in order has the first difference */
+    for (i = 0; i < count; i++) {
+        if (!ParallelWait(&par, i)) break;
+        if (cmp.differ[i]) {
+            *offsetPtr = cmp.diff[i];
+            equal = 0;
+            break;
+        }
+    }
+    ParallelFinish(&par);
+
+    ckfree((char *) cmp.diff);
+    ckfree(cmp.differ);
+    return equal;
+}
+
+/*
+ * Binary comparison of two files by mapping them in memory.
+ * Returns -1 if the files could not be mapped, otherwise as
+ * CompareBinaryChannels.
+ */
+static int
+CompareMappedFiles(
+    const char *native1,
+    const char *native2,
+    int nThreads,
+    CmpPosition_T *posPtr)
+{
+    int fd1 = -1, fd2 = -1, equal = -1;
+    Tcl_WideUInt offset = 0;
+    struct stat st1, st2;
+    void *map1 = MAP_FAILED, *map2 = MAP_FAILED;
+    Tcl_WideUInt size1, size2, minSize;
+
+    fd1 = open(native1, O_RDONLY);
+    if (fd1 < 0) goto done;
+    fd2 = open(native2, O_RDONLY);
+    if (fd2 < 0) goto done;
+    if (fstat(fd1, &st1) != 0 || fstat(fd2, &st2) != 0) goto done;
+    if (!S_ISREG(st1.st_mode) || !S_ISREG(st2.st_mode)) goto done;
+    size1 = (Tcl_WideUInt) st1.st_size;
+    size2 = (Tcl_WideUInt) st2.st_size;
+    minSize = size1 < size2 ? size1 : size2;
+    if (minSize == 0 || minSize != (Tcl_WideUInt) (size_t) minSize) {
+        /* Nothing to map, or too large for the address space. */
+        goto done;
+    }
+    map1 = mmap(NULL, (size_t) minSize, PROT_READ, MAP_PRIVATE, fd1, 0);
+    if (map1 == MAP_FAILED) goto done;
+    map2 = mmap(NULL, (size_t) minSize, PROT_READ, MAP_PRIVATE, fd2, 0);
+    if (map2 == MAP_FAILED) goto done;
+#ifdef MADV_SEQUENTIAL
+    madvise(map1, (size_t) minSize, MADV_SEQUENTIAL);
+    madvise(map2, (size_t) minSize, MADV_SEQUENTIAL);
+#endif
+
+    equal = CompareBytesParallel((const char *) map1, (const char *) map2,
+                                 minSize, nThreads, &offset);
+    if (equal && size1 != size2) {
+        offset = minSize;
+        equal = 0;
+    }
+    if (!equal) {
+        AdvancePosition(posPtr, (const char *) map1, (unsigned long) offset, 1);
+    }
+
+    done:
+    if (map1 != MAP_FAILED) munmap(map1, (size_t) minSize);
+    if (map2 != MAP_FAILED) munmap(map2, (size_t) minSize);
+    if (fd1 >= 0) close(fd1);
+    if (fd2 >= 0) close(fd2);
+    return equal;
+}
+#endif
+
+/*
+ * Compare two channels line by line, ignoring things as diffFiles does.
+ * Stops at the first line that differs.
+ */
+static int
+CompareLineStreams(
+    Tcl_Channel ch1,
+    Tcl_Channel ch2,
+    const DiffOptions_T *optsPtr,
+    CmpPosition_T *posPtr)
+{
+    int equal = 1, n1, n2;
+    Tcl_Obj *line1Ptr, *line2Ptr;
+
+    line1Ptr = Tcl_NewObj();
+    line2Ptr = Tcl_NewObj();
+    Tcl_IncrRefCount(line1Ptr);
+    Tcl_IncrRefCount(line2Ptr);
+
+    while (1) {
+        Tcl_SetObjLength(line1Ptr, 0);
+        Tcl_SetObjLength(line2Ptr, 0);
+        n1 = Tcl_GetsObj(ch1, line1Ptr);
+        n2 = Tcl_GetsObj(ch2, line2Ptr);
+        if (n1 < 0 && n2 < 0) {
+            break;
+        }
+        if (n1 < 0 || n2 < 0 ||
+                CompareObjects(line1Ptr, line2Ptr, optsPtr)) {
+            equal = 0;
+            break;
+        }
+        /* The difference is reported at the start of its line. */
+        posPtr->offset += n1 + 1;
+        posPtr->line++;
+    }
+
+    Tcl_DecrRefCount(line1Ptr);
+    Tcl_DecrRefCount(line2Ptr);
+    return equal;
+}
+
 static int
 CompareStreams(
     Tcl_Channel ch1,
     Tcl_Channel ch2,
-    CmpOptions_T *cmpOptions)
+    CmpOptions_T *cmpOptions,
+    CmpPosition_T *posPtr)
 {
     int equal;
     Tcl_Obj *line1Ptr, *line2Ptr;
@@ -191,7 +527,20 @@ CompareStreams(
     int length1, length2;
     int firstblock;
     const char *string1, *string2;
-    
+    unsigned long prefix;
+    CmpPosition_T pos;
+
+    if (posPtr == NULL) {
+        InitCmpPosition_T(pos, CMP_RESULT_BOOL);
+        posPtr = &pos;
+    }
+    if (cmpOptions->lineOptsPtr != NULL) {
+        return CompareLineStreams(ch1, ch2, cmpOptions->lineOptsPtr, posPtr);
+    }
+    if (cmpOptions->binary && !cmpOptions->ignoreKey) {
+        return CompareBinaryChannels(ch1, ch2, posPtr);
+    }
+
     /* Initialize an object to use as line buffer. */
     line1Ptr = Tcl_NewObj();
     line2Ptr = Tcl_NewObj();
@@ -219,11 +568,6 @@ CompareStreams(
 	    equal = 0;
 	    break;
 	}
-	if (charactersRead1 != charactersRead2  && !cmpOptions->ignoreKey) {
-	    /* Different size */
-	    equal = 0;
-	    break;
-	}
 	if (cmpOptions->binary) {
 	    string1 = (char *) Tcl_GetByteArrayFromObj(line1Ptr, &length1);
 	    string2 = (char *) Tcl_GetByteArrayFromObj(line2Ptr, &length2);
@@ -239,6 +583,8 @@ CompareStreams(
 	    unsigned long rem1, rem2;
 	    int eq = CompareNoKey(string1, string2, length1, length2,
 				  cmpOptions, &res1, &res2);
+	    AdvancePosition(posPtr, string1, res1 - string1,
+			    cmpOptions->binary);
 	    if (!eq) {
 		equal = 0;
 		break;
@@ -289,26 +635,31 @@ CompareStreams(
 		}
 	    }
 	}
-	if (length1 != length2) {
-	    equal = 0;
-	    break;
-	}
 	if (cmpOptions->binary) {
-	    if (strncmp(string1, string2, length1) != 0) {
+	    if (length1 != length2 || memcmp(string1, string2, length1) != 0) {
+		prefix = FirstDifference(string1, string2,
+				length1 < length2 ? length1 : length2);
+		AdvancePosition(posPtr, string1, prefix, 1);
 		equal = 0;
 		break;
 	    }
 	} else if (cmpOptions->noCase) {
-	    if (Tcl_UtfNcasecmp(string1, string2, length1) != 0) {
+	    prefix = EqualUtfPrefix(string1, length1, string2, length2, 1);
+	    if (length1 != length2 || prefix != (unsigned long) length1) {
+		AdvancePosition(posPtr, string1, prefix, 0);
 		equal = 0;
 		break;
 	    }
 	} else {
-	    if (Tcl_UtfNcmp(string1, string2, length1) != 0) {
+	    /* Equal characters have equal UTF-8 */
+	    if (length1 != length2 || memcmp(string1, string2, length1) != 0) {
+		prefix = EqualUtfPrefix(string1, length1, string2, length2, 0);
+		AdvancePosition(posPtr, string1, prefix, 0);
 		equal = 0;
 		break;
 	    }
 	}
+	AdvancePosition(posPtr, string1, length1, cmpOptions->binary);
     }
 
     Tcl_DecrRefCount(line1Ptr);
@@ -316,7 +667,118 @@ CompareStreams(
     return equal;
 }
 
-	
+
+/*
+ * Open two files and compare them.
+ * The interpreter is only used for error messages and may be NULL,
+ * which allows this to be called from any thread for native files.
+ */
+int
+CompareFileNames(
+    Tcl_Interp *interp,
+    Tcl_Obj *file1Ptr,
+    Tcl_Obj *file2Ptr,
+    CmpOptions_T *cmpOptionsPtr,
+    CmpPosition_T *posPtr,      /* Where the first difference is, or NULL */
+    int *equalPtr)
+{
+    int result = TCL_OK;
+    Tcl_Channel ch1 = NULL, ch2 = NULL;
+    CmpPosition_T pos;
+
+    if (posPtr == NULL) {
+        InitCmpPosition_T(pos, CMP_RESULT_BOOL);
+        posPtr = &pos;
+    }
+#ifndef _WIN32
+    if (cmpOptionsPtr->binary && !cmpOptionsPtr->ignoreKey &&
+            cmpOptionsPtr->lineOptsPtr == NULL) {
+        const char *native1 = (const char *) Tcl_FSGetNativePath(file1Ptr);
+        const char *native2 = (const char *) Tcl_FSGetNativePath(file2Ptr);
+        if (native1 != NULL && native2 != NULL) {
+            int equal = CompareMappedFiles(native1, native2,
+                                           cmpOptionsPtr->threads, posPtr);
+            if (equal >= 0) {
+                *equalPtr = equal;
+                return TCL_OK;
+            }
+        }
+    }
+#endif
+
+    ch1 = Tcl_FSOpenFileChannel(interp, file1Ptr, "r", 0);
+    if (ch1 == NULL) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    ch2 = Tcl_FSOpenFileChannel(interp, file2Ptr, "r", 0);
+    if (ch2 == NULL) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (cmpOptionsPtr->encoding != NULL) {
+	if (Tcl_SetChannelOption(interp, ch1, "-encoding",
+				 cmpOptionsPtr->encoding) != TCL_OK) {
+	    result = TCL_ERROR;
+	    goto cleanup;
+	}
+	if (Tcl_SetChannelOption(interp, ch2, "-encoding",
+				 cmpOptionsPtr->encoding) != TCL_OK) {
+	    result = TCL_ERROR;
+	    goto cleanup;
+	}
+    }
+    if (cmpOptionsPtr->translation != NULL) {
+	if (Tcl_SetChannelOption(interp, ch1, "-translation",
+				 cmpOptionsPtr->translation) != TCL_OK) {
+	    result = TCL_ERROR;
+	    goto cleanup;
+	}
+	if (Tcl_SetChannelOption(interp, ch2, "-translation",
+				 cmpOptionsPtr->translation) != TCL_OK) {
+	    result = TCL_ERROR;
+	    goto cleanup;
+	}
+    }
+    *equalPtr = CompareStreams(ch1, ch2, cmpOptionsPtr, posPtr);
+
+    cleanup:
+    if (ch1 != NULL) {
+	Tcl_Close(interp, ch1);
+    }
+    if (ch2 != NULL) {
+	Tcl_Close(interp, ch2);
+    }
+    return result;
+}
+
+/*
+ * Build the result of a comparison in the requested style.
+ */
+static Tcl_Obj *
+CompareResult(int equal, CmpPosition_T *posPtr)
+{
+    Tcl_Obj *resPtr;
+
+    switch (posPtr->style) {
+      case CMP_RESULT_OFFSET:
+	  if (equal) {
+	      return Tcl_NewIntObj(-1);
+	  }
+	  return Tcl_NewWideIntObj((Tcl_WideInt) posPtr->offset);
+      case CMP_RESULT_LINE:
+	  resPtr = Tcl_NewListObj(0, NULL);
+	  if (!equal) {
+	      Tcl_ListObjAppendElement(NULL, resPtr,
+		      Tcl_NewWideIntObj((Tcl_WideInt) posPtr->line));
+	      Tcl_ListObjAppendElement(NULL, resPtr,
+		      Tcl_NewWideIntObj((Tcl_WideInt) posPtr->column));
+	  }
+	  return resPtr;
+    }
+    return Tcl_NewIntObj(equal);
+}
+
 int
 CompareFilesObjCmd(
     ClientData dummy,    	/* Not used. */
@@ -331,17 +793,22 @@ CompareFilesObjCmd(
     Tcl_Obj *encodingPtr = NULL;
     Tcl_Obj *translationPtr = NULL;
     Tcl_StatBuf *statBuf;
-    Tcl_Channel ch1 = NULL, ch2 = NULL;
     Tcl_WideUInt size1, size2;
     unsigned mode1, mode2;
+    CmpPosition_T pos;
+    DiffOptions_T lineOpts;
 
     static CONST char *options[] = {
 	"-nocase", "-ignorekey", "-encoding",
-        "-translation", (char *) NULL
+        "-translation", "-result", "-threads",
+        "-b", "-w", "-i", "-nodigit", "-regsub", "-regsubleft",
+        "-regsubright", (char *) NULL
     };
     enum options {
 	OPT_NOCASE, OPT_IGNOREKEY, OPT_ENCODING,
-        OPT_TRANSLATION
+        OPT_TRANSLATION, OPT_RESULT, OPT_THREADS,
+        OPT_B, OPT_W, OPT_I, OPT_NODIGIT, OPT_REGSUB, OPT_REGSUBLEFT,
+        OPT_REGSUBRIGHT
     };
 
     if (objc < 3) {
@@ -349,6 +816,9 @@ CompareFilesObjCmd(
 	return TCL_ERROR;
     }
     InitCmpOptions_T(cmpOptions);
+    InitCmpPosition_T(pos, CMP_RESULT_BOOL);
+    InitDiffOptions_T(lineOpts);
+    cmpOptions.threads = ParallelDefaultThreads();
 
     for (t = 1; t < objc - 2; t++) {
 	if (Tcl_GetIndexFromObj(interp, objv[t], options, "option", 0,
@@ -358,11 +828,86 @@ CompareFilesObjCmd(
 	}
 	switch (index) {
 	  case OPT_NOCASE:
+	  case OPT_I:
 	      cmpOptions.noCase = 1;
+	      lineOpts.ignore |= IGNORE_CASE;
+	      break;
+	  case OPT_B:
+	      lineOpts.ignore |= IGNORE_SPACE_CHANGE;
+	      break;
+	  case OPT_W:
+	      lineOpts.ignore |= IGNORE_ALL_SPACE;
+	      break;
+	  case OPT_NODIGIT:
+	      lineOpts.ignore |= IGNORE_NUMBERS;
+	      break;
+	  case OPT_REGSUB:
+	  case OPT_REGSUBLEFT:
+	  case OPT_REGSUBRIGHT:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (index != OPT_REGSUBRIGHT) {
+		  if (lineOpts.regsubLeftPtr == NULL) {
+		      lineOpts.regsubLeftPtr = Tcl_NewListObj(0, NULL);
+		      Tcl_IncrRefCount(lineOpts.regsubLeftPtr);
+		  }
+		  if (Tcl_ListObjAppendList(interp, lineOpts.regsubLeftPtr,
+			      objv[t]) != TCL_OK) {
+		      result = TCL_ERROR;
+		      goto cleanup;
+		  }
+	      }
+	      if (index != OPT_REGSUBLEFT) {
+		  if (lineOpts.regsubRightPtr == NULL) {
+		      lineOpts.regsubRightPtr = Tcl_NewListObj(0, NULL);
+		      Tcl_IncrRefCount(lineOpts.regsubRightPtr);
+		  }
+		  if (Tcl_ListObjAppendList(interp, lineOpts.regsubRightPtr,
+			      objv[t]) != TCL_OK) {
+		      result = TCL_ERROR;
+		      goto cleanup;
+		  }
+	      }
 	      break;
 	  case OPT_IGNOREKEY:
 	      cmpOptions.ignoreKey = 1;
 	      break;
+	  case OPT_RESULT:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (Tcl_GetIndexFromObj(interp, objv[t], resultStyles,
+		      "result style", 0, &pos.style) != TCL_OK) {
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      break;
+	  case OPT_THREADS:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (Tcl_GetIntFromObj(interp, objv[t], &cmpOptions.threads)
+		      != TCL_OK) {
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (cmpOptions.threads < 1) {
+		  Tcl_SetResult(interp, "Threads must be at least 1",
+				TCL_STATIC);
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      break;
 	  case OPT_ENCODING:
 	      t++;
 	      if (t >= objc - 2) {
@@ -388,8 +933,27 @@ CompareFilesObjCmd(
     file1Ptr = objv[objc-2];
     file2Ptr = objv[objc-1];
 
+    /*
+     * Ignoring space, digits or regsub:ed parts needs to compare line
+     * by line. Case alone can still be handled character by character.
+     */
+    if ((lineOpts.ignore & ~IGNORE_CASE) != 0 ||
+            lineOpts.regsubLeftPtr != NULL || lineOpts.regsubRightPtr != NULL) {
+	if (cmpOptions.ignoreKey) {
+	    Tcl_SetResult(interp, "-ignorekey cannot be combined with"
+			  " -b, -w, -nodigit or -regsub", TCL_STATIC);
+	    result = TCL_ERROR;
+	    goto cleanup;
+	}
+	cmpOptions.lineOptsPtr = &lineOpts;
+    }
+
+    if (encodingPtr != NULL) {
+	cmpOptions.encoding = Tcl_GetString(encodingPtr);
+    }
     if (translationPtr != NULL) {
 	char *valueName = Tcl_GetString(translationPtr);
+	cmpOptions.translation = valueName;
 	if (strcmp(valueName, "binary") == 0) {
 	    cmpOptions.binary = 1;
 	}
@@ -422,67 +986,47 @@ CompareFilesObjCmd(
 	equal = 0;
 	goto done;
     }
-    /* On binary comparison, different size means different */
-    if (cmpOptions.binary && !cmpOptions.ignoreKey && size1 != size2) {
+    /* On binary comparison, different size means different.
+       The position of the difference still needs a look at the data. */
+    if (cmpOptions.binary && !cmpOptions.ignoreKey && size1 != size2 &&
+            cmpOptions.lineOptsPtr == NULL && pos.style == CMP_RESULT_BOOL) {
 	equal = 0;
 	goto done;
     }
     
-    ch1 = Tcl_FSOpenFileChannel(interp, file1Ptr, "r", 0);
-    if (ch1 == NULL) {
-        result = TCL_ERROR;
-        goto cleanup;
+    /*
+     * With the file cache, cached fingerprints of the raw contents can
+     * tell that binary files differ without reading them. Otherwise the
+     * fingerprints are made while comparing, unless the files are large
+     * enough to be compared by several threads.
+     */
+    if (cmpOptions.binary && !cmpOptions.ignoreKey &&
+            cmpOptions.lineOptsPtr == NULL && pos.style == CMP_RESULT_BOOL &&
+            FileCacheEnabled(interp) &&
+            FileCacheCompare(interp, file1Ptr, file2Ptr,
+                             cmpOptions.threads <= 1 ||
+                             size1 < 2 * PARALLEL_CHUNK, &equal)) {
+        goto done;
     }
-    ch2 = Tcl_FSOpenFileChannel(interp, file2Ptr, "r", 0);
-    if (ch2 == NULL) {
+
+    if (CompareFileNames(interp, file1Ptr, file2Ptr, &cmpOptions, &pos,
+                         &equal) != TCL_OK) {
         result = TCL_ERROR;
         goto cleanup;
     }
-    if (encodingPtr != NULL) {
-	char *valueName = Tcl_GetString(encodingPtr);
-	if (Tcl_SetChannelOption(interp, ch1, "-encoding", valueName)
-		!= TCL_OK) {
-	    result = TCL_ERROR;
-	    goto cleanup;
-	}
-	if (Tcl_SetChannelOption(interp, ch2, "-encoding", valueName)
-		!= TCL_OK) {
-	    result = TCL_ERROR;
-	    goto cleanup;
-	}
-    }
-    if (translationPtr != NULL) {
-	char *valueName = Tcl_GetString(translationPtr);
-	if (Tcl_SetChannelOption(interp, ch1, "-translation", valueName)
-		!= TCL_OK) {
-	    result = TCL_ERROR;
-	    goto cleanup;
-	}
-	if (Tcl_SetChannelOption(interp, ch2, "-translation", valueName)
-		!= TCL_OK) {
-	    result = TCL_ERROR;
-	    goto cleanup;
-	}
-    }
-    equal = CompareStreams(ch1, ch2, &cmpOptions);
 
     done:
-    Tcl_SetObjResult(interp, Tcl_NewIntObj(equal));
+    Tcl_SetObjResult(interp, CompareResult(equal, &pos));
 
     cleanup:
 
-    if (ch1 != NULL) {
-	Tcl_Close(interp, ch1);
-    }
-    if (ch2 != NULL) {
-	Tcl_Close(interp, ch2);
-    }
     if (encodingPtr != NULL) {
 	Tcl_DecrRefCount(encodingPtr);
     }
     if (translationPtr != NULL) {
 	Tcl_DecrRefCount(translationPtr);
     }
+    FreeDiffFilesOptions(&lineOpts, NULL);
 
     return result;
 }
@@ -498,13 +1042,14 @@ CompareStreamsObjCmd(
     int equal;
     CmpOptions_T cmpOptions;
     Tcl_Channel ch1, ch2;
+    CmpPosition_T pos;
 
     static CONST char *options[] = {
-	"-nocase", "-ignorekey", "-binary",
+	"-nocase", "-ignorekey", "-binary", "-result",
         (char *) NULL
     };
     enum options {
-	OPT_NOCASE, OPT_IGNOREKEY, OPT_BINARY
+	OPT_NOCASE, OPT_IGNOREKEY, OPT_BINARY, OPT_RESULT
     };
 
     if (objc < 3) {
@@ -512,6 +1057,7 @@ CompareStreamsObjCmd(
 	return TCL_ERROR;
     }
     InitCmpOptions_T(cmpOptions);
+    InitCmpPosition_T(pos, CMP_RESULT_BOOL);
 
     for (t = 1; t < objc - 2; t++) {
 	if (Tcl_GetIndexFromObj(interp, objv[t], options, "option", 0,
@@ -529,6 +1075,19 @@ CompareStreamsObjCmd(
 	  case OPT_BINARY:
 	      cmpOptions.binary = 1;
 	      break;
+	  case OPT_RESULT:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? ch1 ch2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (Tcl_GetIndexFromObj(interp, objv[t], resultStyles,
+		      "result style", 0, &pos.style) != TCL_OK) {
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      break;
 	}
     }
 
@@ -543,8 +1102,8 @@ CompareStreamsObjCmd(
 	goto cleanup;
     }
 
-    equal = CompareStreams(ch1, ch2, &cmpOptions);
-    Tcl_SetObjResult(interp, Tcl_NewIntObj(equal));
+    equal = CompareStreams(ch1, ch2, &cmpOptions, &pos);
+    Tcl_SetObjResult(interp, CompareResult(equal, &pos));
 
     cleanup:
     return result;
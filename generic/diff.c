@@ -208,38 +208,21 @@ CheckAlign(const DiffOptions_T *optsPtr, Line_T i, Line_T j)
 #define HASH_ADD(hash, character) hash += (hash << 7) + (character)
 
 /*
- * Get a string from a Tcl object and compute the hash value for it.
+ * Compute the hash values for a string.
+ * This is the core of Hash() and does not involve any Tcl_Obj, so it
+ * can be used from any thread.  Regsub is not applied here.
  */
 void
-Hash(Tcl_Obj *objPtr,              /* Input Object */
-     const DiffOptions_T *optsPtr, /* Options      */
-     int left,                     /* Which side the string belongs to. */
-     Hash_T *result,               /* Hash value   */
-     Hash_T *real)                 /* Hash value when ignoring ignore */
+HashLine(const char *string,       /* Input string */
+         int length,               /* Length in bytes */
+         const DiffOptions_T *optsPtr, /* Options   */
+         Hash_T *result,           /* Hash value   */
+         Hash_T *real)             /* Hash value when ignoring ignore */
 {
     Hash_T hash;
-    int i, length;
-    char *string, *str;
+    int i;
+    const char *str, *end;
     Tcl_UniChar c;
-    Tcl_Obj *regsubPtr = left ?
-            optsPtr->regsubLeftPtr : optsPtr->regsubRightPtr;
-
-    Tcl_IncrRefCount(objPtr);
-    if (regsubPtr != NULL) {
-        int objc;
-        Tcl_Obj **objv;
-        Tcl_Obj *resultPtr = NULL;
-        Tcl_ListObjGetElements(NULL, regsubPtr, &objc, &objv);
-        for (i = 0; i < objc; i +=2) {
-            /* Silently ignore errors from regsub */
-            if (DiffOptsRegsub(NULL, objPtr, objv[i], objv[i+1], &resultPtr,
-                               optsPtr) == TCL_OK) {
-                Tcl_DecrRefCount(objPtr);
-                objPtr = resultPtr;
-            }
-        }
-    }
-    string = Tcl_GetStringFromObj(objPtr, &length);
 
     /* Use the fast way when no ignore flag is used. */
     hash = 0;
@@ -259,8 +242,9 @@ Hash(Tcl_Obj *objPtr,              /* Input Object */
         In_T in = IN_SPACE;
         hash = 0;
         str = string;
+        end = string + length;
 
-        while (*str != 0) {
+        while (str < end && *str != 0) {
             str += Tcl_UtfToUniChar(str, &c);
             if (c == '\n') break;
             if (Tcl_UniCharIsSpace(c)) {
@@ -285,73 +269,84 @@ Hash(Tcl_Obj *objPtr,              /* Input Object */
         }
     }
     *result = hash;
-    Tcl_DecrRefCount(objPtr);
-    return;
 }
 
 /*
- * Compare two strings, ignoring things in the same way as hash does.
- * FIXA: Should be recoded to use Unicode functions.
- * Returns true if they differ.
+ * Apply the regsub option for one side to an object.
+ * Returns a new reference to the resulting object, which may be objPtr
+ * itself if no regsub applies.
  */
-int
-CompareObjects(Tcl_Obj *obj1Ptr,
-               Tcl_Obj *obj2Ptr,
-               const DiffOptions_T *optsPtr)
+Tcl_Obj *
+ApplyRegsub(Tcl_Obj *objPtr,
+            const DiffOptions_T *optsPtr,
+            int left)
 {
-    int c1, c2, i1, i2, length1, length2, start;
-    int i, result = 0;
-    char *string1, *string2;
-    const int ignoreAllSpace = (optsPtr->ignore & IGNORE_ALL_SPACE);
-    const int ignoreSpace    = (optsPtr->ignore & IGNORE_SPACE_CHANGE);
-    const int ignoreCase     = (optsPtr->ignore & IGNORE_CASE);
-    const int ignoreNum      = (optsPtr->ignore & IGNORE_NUMBERS);
+    int i;
+    Tcl_Obj *regsubPtr = left ?
+            optsPtr->regsubLeftPtr : optsPtr->regsubRightPtr;
 
-    Tcl_IncrRefCount(obj1Ptr);
-    Tcl_IncrRefCount(obj2Ptr);
-    if (optsPtr->regsubLeftPtr != NULL) {
+    Tcl_IncrRefCount(objPtr);
+    if (regsubPtr != NULL) {
         int objc;
         Tcl_Obj **objv;
         Tcl_Obj *resultPtr = NULL;
-
-        Tcl_ListObjGetElements(NULL, optsPtr->regsubLeftPtr, &objc, &objv);
-
-        for (i = 0; i < objc; i += 2) {
+        Tcl_ListObjGetElements(NULL, regsubPtr, &objc, &objv);
+        for (i = 0; i < objc; i +=2) {
             /* Silently ignore errors from regsub */
-            if (DiffOptsRegsub(NULL, obj1Ptr, objv[i], objv[i+1], &resultPtr,
-                            optsPtr) == TCL_OK) {
-                Tcl_DecrRefCount(obj1Ptr);
-                obj1Ptr = resultPtr;
+            if (DiffOptsRegsub(NULL, objPtr, objv[i], objv[i+1], &resultPtr,
+                               optsPtr) == TCL_OK) {
+                Tcl_DecrRefCount(objPtr);
+                objPtr = resultPtr;
             }
         }
     }
-    if (optsPtr->regsubRightPtr != NULL) {
-        int objc;
-        Tcl_Obj **objv;
-        Tcl_Obj *resultPtr = NULL;
+    return objPtr;
+}
 
-        Tcl_ListObjGetElements(NULL, optsPtr->regsubRightPtr, &objc, &objv);
+/*
+ * Get a string from a Tcl object and compute the hash value for it.
+ */
+void
+Hash(Tcl_Obj *objPtr,              /* Input Object */
+     const DiffOptions_T *optsPtr, /* Options      */
+     int left,                     /* Which side the string belongs to. */
+     Hash_T *result,               /* Hash value   */
+     Hash_T *real)                 /* Hash value when ignoring ignore */
+{
+    int length;
+    char *string;
 
-        for (i = 0; i < objc; i += 2) {
-            /* Silently ignore errors from regsub */
-            if (DiffOptsRegsub(NULL, obj2Ptr, objv[i], objv[i+1], &resultPtr,
-                            optsPtr) == TCL_OK) {
-                Tcl_DecrRefCount(obj2Ptr);
-                obj2Ptr = resultPtr;
-            }
-        }
-    }
-    string1 = Tcl_GetStringFromObj(obj1Ptr, &length1);
-    string2 = Tcl_GetStringFromObj(obj2Ptr, &length2);
+    objPtr = ApplyRegsub(objPtr, optsPtr, left);
+    string = Tcl_GetStringFromObj(objPtr, &length);
+    HashLine(string, length, optsPtr, result, real);
+    Tcl_DecrRefCount(objPtr);
+}
+
+/*
+ * Compare two strings, ignoring things in the same way as hash does.
+ * This is the core of CompareObjects() and does not involve any Tcl_Obj.
+ * Regsub is not applied here.
+ * FIXA: Should be recoded to use Unicode functions.
+ * Returns true if they differ.
+ */
+int
+CompareLines(const char *string1, int length1,
+             const char *string2, int length2,
+             const DiffOptions_T *optsPtr)
+{
+    int c1, c2, i1, i2, start;
+    const int ignoreAllSpace = (optsPtr->ignore & IGNORE_ALL_SPACE);
+    const int ignoreSpace    = (optsPtr->ignore & IGNORE_SPACE_CHANGE);
+    const int ignoreCase     = (optsPtr->ignore & IGNORE_CASE);
+    const int ignoreNum      = (optsPtr->ignore & IGNORE_NUMBERS);
 
     /* Use the fast way when no ignore flag is used. */
     if (optsPtr->ignore == 0) {
         if (length1 != length2) {
-            result = 1;
-        } else {
-            result = Tcl_UtfNcmp(string1, string2, length1);
+            return 1;
         }
-        goto cleanup;
+        /* Byte lengths, and the strings need not be null terminated */
+        return memcmp(string1, string2, length1);
     }
 
     i1 = i2 = 0;
@@ -363,7 +358,8 @@ CompareObjects(Tcl_Obj *obj1Ptr,
                 start = i1;
                 while (i1 < length1 && isspace(string1[i1])) i1++;
                 if (ignoreAllSpace || start == 0) {
-                    c1 = string1[i1];
+                    /* The string need not be null terminated */
+                    c1 = (i1 < length1) ? string1[i1] : 0;
                 } else {
                     i1--;
                     c1 = ' ';
@@ -387,7 +383,8 @@ CompareObjects(Tcl_Obj *obj1Ptr,
                 start = i2;
                 while (i2 < length2 && isspace(string2[i2])) i2++;
                 if (ignoreAllSpace || start == 0) {
-                    c2 = string2[i2];
+                    /* The string need not be null terminated */
+                    c2 = (i2 < length2) ? string2[i2] : 0;
                 } else {
                     i2--;
                     c2 = ' ';
@@ -404,14 +401,127 @@ CompareObjects(Tcl_Obj *obj1Ptr,
             c2 = tolower(c2);
         }
 
-        if (i1 >= length1 && i2 <  length2) { result = -1; goto cleanup; }
-        if (i1 < length1  && i2 >= length2) { result =  1; goto cleanup; }
-        if (c1 < c2) { result = -1; goto cleanup; }
-        if (c1 > c2) { result =  1; goto cleanup; }
+        if (i1 >= length1 && i2 <  length2) return -1;
+        if (i1 < length1  && i2 >= length2) return  1;
+        if (c1 < c2) return -1;
+        if (c1 > c2) return  1;
         i1++;
         i2++;
     }
-    cleanup:
+    return 0;
+}
+
+/*
+ * Compare two objects, ignoring things in the same way as hash does.
+ * Returns true if they differ.
+ */
+int
+CompareObjects(Tcl_Obj *obj1Ptr,
+               Tcl_Obj *obj2Ptr,
+               const DiffOptions_T *optsPtr)
+{
+    int length1, length2, result;
+    char *string1, *string2;
+
+    obj1Ptr = ApplyRegsub(obj1Ptr, optsPtr, 1);
+    obj2Ptr = ApplyRegsub(obj2Ptr, optsPtr, 0);
+    string1 = Tcl_GetStringFromObj(obj1Ptr, &length1);
+    string2 = Tcl_GetStringFromObj(obj2Ptr, &length2);
+
+    result = CompareLines(string1, length1, string2, length2, optsPtr);
+
+    Tcl_DecrRefCount(obj1Ptr);
+    Tcl_DecrRefCount(obj2Ptr);
+    return result;
+}
+
+/*
+ * Get the next character of a line as HashLine sees it, or -1 at the end.
+ */
+static int
+NextLineChar(const char **strPtr, const char *end, In_T *inPtr,
+             const DiffOptions_T *optsPtr)
+{
+    Tcl_UniChar c;
+    const char *str = *strPtr;
+
+    while (str < end && *str != 0) {
+        str += Tcl_UtfToUniChar(str, &c);
+        if (c == '\n') break;
+        if (Tcl_UniCharIsSpace(c)) {
+            if (optsPtr->ignore & IGNORE_ALL_SPACE) continue;
+            if (optsPtr->ignore & IGNORE_SPACE_CHANGE) {
+                if (*inPtr == IN_SPACE) continue;
+                c = ' ';
+            }
+            *inPtr = IN_SPACE;
+        } else if ((optsPtr->ignore & IGNORE_NUMBERS) &&
+                   Tcl_UniCharIsDigit(c)) {
+            if (*inPtr == IN_NUMBER) continue;
+            c = '0';
+            *inPtr = IN_NUMBER;
+        } else {
+            *inPtr = IN_NONE;
+            if (optsPtr->ignore & IGNORE_CASE) {
+                c = Tcl_UniCharToLower(c);
+            }
+        }
+        *strPtr = str;
+        return c;
+    }
+    *strPtr = end;
+    return -1;
+}
+
+/*
+ * Order two strings, ignoring things in the same way as hash does.
+ * Without ignore flags, this is byte order, which for UTF-8 is the
+ * same as character order.
+ * Returns <0, 0 or >0 like strcmp.
+ */
+int
+OrderLines(const char *string1, int length1,
+           const char *string2, int length2,
+           const DiffOptions_T *optsPtr)
+{
+    int c1, c2, result;
+    const char *end1 = string1 + length1, *end2 = string2 + length2;
+    In_T in1 = IN_SPACE, in2 = IN_SPACE;
+
+    if (optsPtr->ignore == 0) {
+        result = memcmp(string1, string2,
+                        length1 < length2 ? length1 : length2);
+        if (result != 0) {
+            return result;
+        }
+        return length1 - length2;
+    }
+    do {
+        c1 = NextLineChar(&string1, end1, &in1, optsPtr);
+        c2 = NextLineChar(&string2, end2, &in2, optsPtr);
+    } while (c1 == c2 && c1 >= 0);
+    return c1 - c2;
+}
+
+/*
+ * Order two objects, ignoring things in the same way as hash does.
+ * left1 and left2 tell which side each object belongs to, for regsub.
+ */
+int
+OrderObjects(Tcl_Obj *obj1Ptr, int left1,
+             Tcl_Obj *obj2Ptr, int left2,
+             const DiffOptions_T *optsPtr)
+{
+    int length1, length2, result;
+    char *string1, *string2;
+
+    obj1Ptr = ApplyRegsub(obj1Ptr, optsPtr, left1);
+    obj2Ptr = ApplyRegsub(obj2Ptr, optsPtr, left2);
+    string1 = Tcl_GetStringFromObj(obj1Ptr, &length1);
+    string2 = Tcl_GetStringFromObj(obj2Ptr, &length2);
+
+    result = OrderLines(string1, length1, string2, length2, optsPtr);
+
     Tcl_DecrRefCount(obj1Ptr);
     Tcl_DecrRefCount(obj2Ptr);
     return result;
@@ -447,6 +557,64 @@ SortV(V_T *V, Line_T n, const DiffOptions_T *optsPtr)
     qsort(&V[1], (unsigned long) n, sizeof(V_T), CompareV);
 }
 
+/*
+ * Candidate blocks are kept in a per-thread free list after use, to
+ * avoid allocating them again and again when many diffs are done,
+ * e.g. by a worker thread. The list is limited to a few MB per thread.
+ */
+#define CANDIDATE_KEEP_BLOCKS 64
+
+typedef struct {
+    int initialized;
+    int nFree;
+    CandidateAlloc_T *free;
+} CandidateTSD_T;
+
+static Tcl_ThreadDataKey candidateKey;
+
+static void
+FreeCandidateCache(ClientData clientData)
+{
+    CandidateTSD_T *tsdPtr = (CandidateTSD_T *)
+            Tcl_GetThreadData(&candidateKey, sizeof(CandidateTSD_T));
+    CandidateAlloc_T *candalloc = tsdPtr->free, *next;
+
+    while (candalloc != NULL) {
+        next = candalloc->next;
+        ckfree((char *) candalloc);
+        candalloc = next;
+    }
+    tsdPtr->free = NULL;
+    tsdPtr->nFree = 0;
+}
+
+static CandidateTSD_T *
+GetCandidateTSD(void)
+{
+    CandidateTSD_T *tsdPtr = (CandidateTSD_T *)
+            Tcl_GetThreadData(&candidateKey, sizeof(CandidateTSD_T));
+    if (!tsdPtr->initialized) {
+        tsdPtr->initialized = 1;
+        Tcl_CreateThreadExitHandler(FreeCandidateCache, NULL);
+    }
+    return tsdPtr;
+}
+
+/* Get a candidate block, from the free list if possible */
+static CandidateAlloc_T *
+GetCandidateBlock(void)
+{
+    CandidateTSD_T *tsdPtr = GetCandidateTSD();
+    CandidateAlloc_T *candalloc = tsdPtr->free;
+
+    if (candalloc != NULL) {
+        tsdPtr->free = candalloc->next;
+        tsdPtr->nFree--;
+        return candalloc;
+    }
+    return (CandidateAlloc_T *) ckalloc(sizeof(CandidateAlloc_T));
+}
+
 /* Create a new candidate */
 static Candidate_T *
 NewCandidate(
@@ -459,7 +627,7 @@ NewCandidate(
 
     /* Allocate a new block if needed. */
     if (*first == NULL || (*first)->used >= CANDIDATE_ALLOC) {
-        candalloc = (CandidateAlloc_T *) ckalloc(sizeof(CandidateAlloc_T));
+        candalloc = GetCandidateBlock();
         candalloc->used = 0;
 #ifdef CANDIDATE_STATS
         if (*first != NULL) {
@@ -498,13 +666,21 @@ NewCandidate(
 static void
 FreeCandidates(CandidateAlloc_T **first) {
     CandidateAlloc_T *candalloc = *first, *next;
+    CandidateTSD_T *tsdPtr;
 #ifdef CANDIDATE_STATS
     printf("Allocs %d * %d + %d = %d\n", (*first)->serial, CANDIDATE_ALLOC,
            (*first)->used, (*first)->serial * CANDIDATE_ALLOC+(*first)->used);
 #endif
+    tsdPtr = GetCandidateTSD();
     while (candalloc != NULL) {
         next = candalloc->next;
-        ckfree((char *) candalloc);
+        if (tsdPtr->nFree < CANDIDATE_KEEP_BLOCKS) {
+            candalloc->next = tsdPtr->free;
+            tsdPtr->free = candalloc;
+            tsdPtr->nFree++;
+        } else {
+            ckfree((char *) candalloc);
+        }
         candalloc = next;
     }
     *first = NULL;
@@ -1559,6 +1735,63 @@ BuildResultFromJ(
     return BuildResultFromJMatchStyle(interp, optsPtr, m, n, J);
 }
 
+/*
+ * Build a result from matches that are found in order, without a J
+ * vector, e.g. while streaming through sorted files.
+ */
+void
+ResultBuilderInit(
+    Tcl_Interp *interp, const DiffOptions_T *optsPtr,
+    ResultBuilder_T *rbPtr)
+{
+    rbPtr->resPtr = Tcl_NewListObj(0, NULL);
+    rbPtr->leftPtr = rbPtr->rightPtr = NULL;
+    if (optsPtr->resultStyle != Result_Diff) {
+        rbPtr->leftPtr = Tcl_NewListObj(0, NULL);
+        rbPtr->rightPtr = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(interp, rbPtr->resPtr, rbPtr->leftPtr);
+        Tcl_ListObjAppendElement(interp, rbPtr->resPtr, rbPtr->rightPtr);
+    }
+    rbPtr->startBlock1 = rbPtr->startBlock2 = 1;
+}
+
+/* Line i on side 1 matches line j on side 2 */
+void
+ResultBuilderMatch(
+    Tcl_Interp *interp, const DiffOptions_T *optsPtr,
+    ResultBuilder_T *rbPtr, Line_T i, Line_T j)
+{
+    if (optsPtr->resultStyle != Result_Diff) {
+        Tcl_ListObjAppendElement(interp, rbPtr->leftPtr,
+                Tcl_NewLongObj(i + (optsPtr->firstIndex - 1)));
+        Tcl_ListObjAppendElement(interp, rbPtr->rightPtr,
+                Tcl_NewLongObj(j + (optsPtr->firstIndex - 1)));
+        return;
+    }
+    if (i > rbPtr->startBlock1 || j > rbPtr->startBlock2) {
+        AppendChunk(interp, rbPtr->resPtr, optsPtr,
+                    rbPtr->startBlock1, i - rbPtr->startBlock1,
+                    rbPtr->startBlock2, j - rbPtr->startBlock2);
+    }
+    rbPtr->startBlock1 = i + 1;
+    rbPtr->startBlock2 = j + 1;
+}
+
+/*
+ * Finish a result when the sides had m and n lines, and return it.
+ * An unfinished result can be thrown away with Tcl_DecrRefCount.
+ */
+Tcl_Obj *
+ResultBuilderFinish(
+    Tcl_Interp *interp, const DiffOptions_T *optsPtr,
+    ResultBuilder_T *rbPtr, Line_T m, Line_T n)
+{
+    if (optsPtr->resultStyle == Result_Diff) {
+        ResultBuilderMatch(interp, optsPtr, rbPtr, m + 1, n + 1);
+    }
+    return rbPtr->resPtr;
+}
+
 /* Fill in the range option from a Tcl Value */
 int
 SetOptsRange(
@@ -1670,6 +1903,24 @@ SetOptsAlign(Tcl_Interp *interp,
     return TCL_OK;
 }
 
+/*
+ * Copy a DiffOptions structure.
+ * The align list is copied while regsub objects are shared with the source.
+ */
+void
+CopyDiffOptions(DiffOptions_T *dstPtr, const DiffOptions_T *srcPtr)
+{
+    *dstPtr = *srcPtr;
+    if (srcPtr->alignLength > STATIC_ALIGN) {
+        dstPtr->align = (Line_T *)
+                ckalloc(sizeof(Line_T) * srcPtr->alignLength);
+        memcpy(dstPtr->align, srcPtr->align,
+               sizeof(Line_T) * srcPtr->alignLength);
+    } else {
+        dstPtr->align = dstPtr->staticAlign;
+    }
+}
+
 /* Tidy up a DiffOptions structure before it is used */
 void
 NormaliseOpts(DiffOptions_T *optsPtr)
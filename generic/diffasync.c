@@ -0,0 +1,285 @@
+/***********************************************************************
+ *
+ * This file implements diffFilesAsync, which does the reading and
+ * diffing of two files in a worker thread and reports the result
+ * through a callback in the calling thread.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "diffutil.h"
+
+/*
+ * Everything a worker needs. Nothing in here may be a Tcl_Obj
+ * belonging to the calling thread.
+ */
+typedef struct {
+    Tcl_ThreadId owner;          /* Thread that gets the result */
+    Tcl_Interp *interp;          /* Interpreter to run the callback in */
+    Tcl_Obj *callbackPtr;        /* Only touched by the owner thread */
+    SharedOptions_T shared;
+    char *path1, *path2;         /* NULL if the file is already read */
+    LineStore_T store1, store2;
+    /* Result */
+    Line_T m, n;
+    Line_T *J;
+    char *errorMsg;
+} DiffJob_T;
+
+typedef struct {
+    Tcl_Event header;
+    DiffJob_T *jobPtr;
+} DiffJobEvent_T;
+
+static int DiffJobEventProc(Tcl_Event *evPtr, int flags);
+
+static void
+FreeDiffJob(DiffJob_T *jobPtr)
+{
+    if (jobPtr->callbackPtr != NULL) {
+        Tcl_DecrRefCount(jobPtr->callbackPtr);
+    }
+    FreeSharedOptions(&jobPtr->shared);
+    if (jobPtr->path1       != NULL) ckfree(jobPtr->path1);
+    if (jobPtr->path2       != NULL) ckfree(jobPtr->path2);
+    if (jobPtr->J           != NULL) ckfree((char *) jobPtr->J);
+    if (jobPtr->errorMsg    != NULL) ckfree(jobPtr->errorMsg);
+    FreeLineStore(&jobPtr->store1);
+    FreeLineStore(&jobPtr->store2);
+    ckfree((char *) jobPtr);
+}
+
+/*
+ * The part of the job that can run in any thread.
+ * When done, the result is sent back to the owner as an event.
+ */
+static void
+RunDiffJob(DiffJob_T *jobPtr)
+{
+    DiffOptions_T opts;
+    DiffJobEvent_T *evPtr;
+
+    if (jobPtr->path1 != NULL) {
+        jobPtr->errorMsg = LineStoreReadFile(&jobPtr->store1, jobPtr->path1,
+                &jobPtr->shared, jobPtr->shared.opts.rFrom1,
+                jobPtr->shared.opts.rTo1);
+    }
+    if (jobPtr->errorMsg == NULL && jobPtr->path2 != NULL) {
+        jobPtr->errorMsg = LineStoreReadFile(&jobPtr->store2, jobPtr->path2,
+                &jobPtr->shared, jobPtr->shared.opts.rFrom2,
+                jobPtr->shared.opts.rTo2);
+    }
+    if (jobPtr->errorMsg == NULL) {
+        SharedOptionsGet(&jobPtr->shared, &opts);
+        jobPtr->J = DiffLineStores(NULL, &jobPtr->store1, &jobPtr->store2,
+                                   &opts, &jobPtr->m, &jobPtr->n);
+        FreeDiffFilesOptions(&opts, NULL);
+    }
+    /* The lines are not needed anymore, release memory early. */
+    FreeLineStore(&jobPtr->store1);
+    FreeLineStore(&jobPtr->store2);
+
+    evPtr = (DiffJobEvent_T *) ckalloc(sizeof(DiffJobEvent_T));
+    evPtr->header.proc = DiffJobEventProc;
+    evPtr->jobPtr = jobPtr;
+    Tcl_ThreadQueueEvent(jobPtr->owner, (Tcl_Event *) evPtr, TCL_QUEUE_TAIL);
+    Tcl_ThreadAlert(jobPtr->owner);
+}
+
+#ifdef TCL_THREADS
+static Tcl_ThreadCreateType
+DiffJobThread(ClientData clientData)
+{
+    RunDiffJob((DiffJob_T *) clientData);
+    Tcl_ExitThread(0);
+    TCL_THREAD_CREATE_RETURN;
+}
+#endif
+
+/*
+ * Called in the owner thread when a job is done.
+ * Builds the result and runs the callback.
+ */
+static int
+DiffJobEventProc(Tcl_Event *evPtr, int flags)
+{
+    DiffJob_T *jobPtr = ((DiffJobEvent_T *) evPtr)->jobPtr;
+    Tcl_Interp *interp = jobPtr->interp;
+    Tcl_Obj *cmdPtr, *resPtr;
+
+    if (!(flags & TCL_FILE_EVENTS)) {
+        return 0;
+    }
+
+    if (!Tcl_InterpDeleted(interp)) {
+        if (jobPtr->errorMsg != NULL) {
+            resPtr = Tcl_NewStringObj(jobPtr->errorMsg, -1);
+        } else {
+            resPtr = BuildResultFromJ(interp, &jobPtr->shared.opts,
+                                      jobPtr->m, jobPtr->n, jobPtr->J);
+        }
+        cmdPtr = Tcl_DuplicateObj(jobPtr->callbackPtr);
+        Tcl_IncrRefCount(cmdPtr);
+        Tcl_ListObjAppendElement(NULL, cmdPtr, Tcl_NewStringObj(
+                jobPtr->errorMsg != NULL ? "error" : "ok", -1));
+        Tcl_ListObjAppendElement(NULL, cmdPtr, resPtr);
+        if (Tcl_EvalObjEx(interp, cmdPtr, TCL_EVAL_GLOBAL) != TCL_OK) {
+            Tcl_AddErrorInfo(interp, "\n    (diffFilesAsync callback)");
+            Tcl_BackgroundException(interp, TCL_ERROR);
+        }
+        Tcl_DecrRefCount(cmdPtr);
+    }
+    Tcl_Release(interp);
+    FreeDiffJob(jobPtr);
+    return 1;
+}
+
+/*
+ * Read a file into a line store in this thread, through the same
+ * channel setup as diffFiles.
+ */
+static int
+ReadFileHere(Tcl_Interp *interp, Tcl_Obj *namePtr, FileOptions_T *fileOptsPtr,
+             LineStore_T *storePtr, Line_T first, Line_T last)
+{
+    Tcl_Channel ch;
+
+    ch = OpenReadChannel(interp, namePtr, fileOptsPtr);
+    if (ch == NULL) {
+        return TCL_ERROR;
+    }
+    LineStoreReadChannel(storePtr, ch, first, last);
+    CloseReadChannel(interp, ch);
+    return TCL_OK;
+}
+
+int
+DiffFilesAsyncObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int result = TCL_OK, i, length;
+    Tcl_Obj *file1Ptr, *file2Ptr;
+    Tcl_StatBuf *statBuf;
+    DiffOptions_T opts;
+    FileOptions_T fileOpts;
+    DiffJob_T *jobPtr = NULL;
+#ifdef TCL_THREADS
+    Tcl_ThreadId id;
+#endif
+
+    if (objc < 4) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2 callback");
+	return TCL_ERROR;
+    }
+
+    InitDiffOptions_T(opts);
+    InitFileOptions_T(fileOpts);
+
+    if (ParseDiffFilesOptions(interp, objc, objv, 1, objc - 3,
+                    "?opts? file1 file2 callback", &opts, &fileOpts, NULL,
+                    NULL, NULL, NULL)
+            != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (Tcl_ListObjLength(interp, objv[objc - 1], &length) != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (fileOpts.encodingPtr != NULL) {
+        /* Catch a bad encoding here, where it can be reported. */
+        Tcl_Encoding enc = Tcl_GetEncoding(interp,
+                Tcl_GetString(fileOpts.encodingPtr));
+        if (enc == NULL) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+        Tcl_FreeEncoding(enc);
+    }
+    file1Ptr = objv[objc - 3];
+    file2Ptr = objv[objc - 2];
+
+    /* Check the files now, to report simple errors directly. */
+    statBuf = Tcl_AllocStatBuf();
+    for (i = 0; i < 2; i++) {
+        Tcl_Obj *namePtr = i == 0 ? file1Ptr : file2Ptr;
+        if (Tcl_FSStat(namePtr, statBuf) != 0 ||
+                S_ISDIR(Tcl_GetModeFromStat(statBuf))) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf("bad file \"%s\"",
+                                                   Tcl_GetString(namePtr)));
+            result = TCL_ERROR;
+            break;
+        }
+    }
+    ckfree((char *) statBuf);
+    if (result != TCL_OK) {
+        goto cleanup;
+    }
+
+    jobPtr = (DiffJob_T *) ckalloc(sizeof(DiffJob_T));
+    memset(jobPtr, 0, sizeof(DiffJob_T));
+    jobPtr->owner = Tcl_GetCurrentThread();
+    jobPtr->interp = interp;
+    jobPtr->callbackPtr = objv[objc - 1];
+    Tcl_IncrRefCount(jobPtr->callbackPtr);
+    InitSharedOptions(&jobPtr->shared, &opts, &fileOpts);
+    InitLineStore(&jobPtr->store1);
+    InitLineStore(&jobPtr->store2);
+
+    /* Files that cannot be opened by the worker are read here. */
+    jobPtr->path1 = LineStorePath(file1Ptr);
+    jobPtr->path2 = LineStorePath(file2Ptr);
+    if (jobPtr->path1 == NULL) {
+        if (ReadFileHere(interp, file1Ptr, &fileOpts, &jobPtr->store1,
+                         opts.rFrom1, opts.rTo1) != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    }
+    if (jobPtr->path2 == NULL) {
+        if (ReadFileHere(interp, file2Ptr, &fileOpts, &jobPtr->store2,
+                         opts.rFrom2, opts.rTo2) != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    }
+
+    Tcl_Preserve(interp);
+#ifdef TCL_THREADS
+    if (Tcl_CreateThread(&id, DiffJobThread, jobPtr,
+                         TCL_THREAD_STACK_DEFAULT, TCL_THREAD_NOFLAGS)
+            != TCL_OK) {
+        /* No thread, do it the slow way. */
+        RunDiffJob(jobPtr);
+    }
+#else
+    RunDiffJob(jobPtr);
+#endif
+    /* The job is now owned by the worker */
+    jobPtr = NULL;
+    Tcl_ResetResult(interp);
+
+    cleanup:
+    if (jobPtr != NULL) {
+        FreeDiffJob(jobPtr);
+    }
+    FreeDiffFilesOptions(&opts, &fileOpts);
+    return result;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -14,21 +14,10 @@
 #include <sys/stat.h>
 #include "diffutil.h"
 
-typedef struct {
-    Tcl_Obj *encodingPtr;
-    Tcl_Obj *translationPtr;
-    int     gzip;
-    Tcl_Obj *lines1Ptr;
-    Tcl_Obj *lines2Ptr;
-} FileOptions_T;
-
-/* Helper to get a filled in FileOptions_T */
-#define InitFileOptions_T(opts) {opts.encodingPtr = NULL; opts.translationPtr = NULL; opts.gzip = 0; opts.lines1Ptr = NULL; opts.lines2Ptr = NULL;}
-
 /*
  * Close a channel that was opened by OpenReadChannel.
  */
-static void
+void
 CloseReadChannel(Tcl_Interp *interp,
                  Tcl_Channel ch)
 {
@@ -37,7 +26,7 @@ CloseReadChannel(Tcl_Interp *interp,
 /*
  * Open a file for reading and configure the channel.
  */
-static Tcl_Channel
+Tcl_Channel
 OpenReadChannel(Tcl_Interp *interp,
                 Tcl_Obj *namePtr,
                 FileOptions_T *fileOptsPtr)
@@ -50,20 +39,12 @@ OpenReadChannel(Tcl_Interp *interp,
     Tcl_RegisterChannel(interp, ch);
 
     if (fileOptsPtr->gzip) {
-        /* zlib push gunzip $ch */
-        Tcl_Obj *res;
-        res = Tcl_NewListObj(0, NULL);
-        Tcl_IncrRefCount(res);
-        Tcl_ListObjAppendElement(interp, res, Tcl_NewStringObj("zlib", -1));
-        Tcl_ListObjAppendElement(interp, res, Tcl_NewStringObj("push", -1));
-        Tcl_ListObjAppendElement(interp, res, Tcl_NewStringObj("gunzip", -1));
-        Tcl_ListObjAppendElement(interp, res,
-                                 Tcl_NewStringObj(Tcl_GetChannelName(ch), -1));
-        if (Tcl_EvalObjEx(interp, res, TCL_EVAL_DIRECT) != TCL_OK) {
+        Tcl_Channel top = PushGunzip(interp, ch);
+        if (top == NULL) {
             CloseReadChannel(interp, ch);
             return NULL;
         }
-        Tcl_DecrRefCount(res);
+        ch = top;
     }
 
     if (fileOptsPtr->translationPtr != NULL) {
@@ -89,14 +70,227 @@ OpenReadChannel(Tcl_Interp *interp,
     return ch;
 }
 
+/*
+ * Report a failed read, e.g. of bad compressed data, and close the channel.
+ */
+static void
+ReadError(Tcl_Interp *interp,
+          Tcl_Channel ch,
+          Tcl_Obj *namePtr)
+{
+    Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+            "error reading \"%s\": %s", Tcl_GetString(namePtr),
+            Tcl_PosixError(interp)));
+    CloseReadChannel(interp, ch);
+}
+
+/*
+ * Describe everything that affects the line hashes of one side,
+ * for the file cache.
+ */
+static Tcl_Obj *
+CacheOptions(DiffOptions_T *optsPtr,
+             FileOptions_T *fileOptsPtr,
+             int left,
+             Tcl_WideInt offset)
+{
+    Tcl_Obj *regsubPtr = left ? optsPtr->regsubLeftPtr :
+            optsPtr->regsubRightPtr;
+    Tcl_Obj *keyPtr;
+
+    keyPtr = Tcl_ObjPrintf("lines %d %lu %lu %d",
+            optsPtr->ignore,
+            left ? optsPtr->rFrom1 : optsPtr->rFrom2,
+            left ? optsPtr->rTo1 : optsPtr->rTo2,
+            fileOptsPtr->gzip);
+    if (offset > 0) {
+        /* The range was seeked to, and lines are counted from there */
+        Tcl_AppendPrintfToObj(keyPtr, " @%" TCL_LL_MODIFIER "d", offset);
+    }
+    Tcl_ListObjAppendElement(NULL, keyPtr, fileOptsPtr->encodingPtr != NULL ?
+            fileOptsPtr->encodingPtr : Tcl_NewObj());
+    Tcl_ListObjAppendElement(NULL, keyPtr, fileOptsPtr->translationPtr != NULL ?
+            fileOptsPtr->translationPtr : Tcl_NewObj());
+    Tcl_ListObjAppendElement(NULL, keyPtr, regsubPtr != NULL ?
+            regsubPtr : Tcl_NewObj());
+    Tcl_IncrRefCount(keyPtr);
+    return keyPtr;
+}
+
+/*
+ * Look up one side in the file cache, if in use and possible.
+ */
+static FileCacheEntry_T *
+CacheLookup(Tcl_Interp *interp,
+            Tcl_Obj *namePtr,
+            DiffOptions_T *optsPtr,
+            FileOptions_T *fileOptsPtr,
+            int left,
+            Tcl_WideInt offset,
+            FileCacheKey_T *keyPtr)
+{
+    Tcl_Obj *optionsPtr;
+    FileCacheEntry_T *entryPtr;
+
+    keyPtr->key = NULL;
+    /* The cache cannot give back the lines */
+    if (!FileCacheEnabled(interp) ||
+            (left ? fileOptsPtr->lines1Ptr : fileOptsPtr->lines2Ptr) != NULL) {
+        return NULL;
+    }
+    optionsPtr = CacheOptions(optsPtr, fileOptsPtr, left, offset);
+    entryPtr = FileCacheLookup(interp, namePtr, Tcl_GetString(optionsPtr),
+                               keyPtr);
+    Tcl_DecrRefCount(optionsPtr);
+    return entryPtr;
+}
+
+/*
+ * Open a file for reading, positioned at a byte offset from RangeOffset.
+ */
+static Tcl_Channel
+OpenRangeChannel(Tcl_Interp *interp,
+                 Tcl_Obj *namePtr,
+                 FileOptions_T *fileOptsPtr,
+                 Tcl_WideInt offset)
+{
+    Tcl_Channel ch;
+
+    ch = OpenReadChannel(interp, namePtr, fileOptsPtr);
+    if (ch != NULL && offset > 0 && Tcl_Seek(ch, offset, SEEK_SET) < 0) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                "error seeking \"%s\": %s", Tcl_GetString(namePtr),
+                Tcl_PosixError(interp)));
+        CloseReadChannel(interp, ch);
+        return NULL;
+    }
+    return ch;
+}
+
+/*
+ * Can line ends be found as plain bytes in this encoding?
+ * A NULL name means the system encoding.
+ */
+static int
+LineEndsAreBytes(const char *encodingName)
+{
+    Tcl_Encoding encoding;
+    char buf[16];
+    int wrote, result;
+
+    encoding = Tcl_GetEncoding(NULL, encodingName);
+    if (encoding == NULL) {
+        return 0;
+    }
+    /* Stateful encodings cannot be started in the middle */
+    if (strncmp(Tcl_GetEncodingName(encoding), "iso2022", 7) == 0) {
+        Tcl_FreeEncoding(encoding);
+        return 0;
+    }
+    Tcl_UtfToExternal(NULL, encoding, "\r\n", 2, 0, NULL, buf, sizeof(buf),
+                      NULL, &wrote, NULL);
+    result = wrote == 2 && buf[0] == '\r' && buf[1] == '\n';
+    Tcl_FreeEncoding(encoding);
+    return result;
+}
+
+/*
+ * Get the byte offset where line "from" of a file starts, to let a range
+ * diff seek there instead of reading all lines before it.
+ * Returns 0 if the file must be read from the start.
+ */
+static Tcl_WideInt
+RangeOffset(Tcl_Interp *interp,
+            Tcl_Obj *namePtr,
+            FileOptions_T *fileOptsPtr,
+            Line_T from, Line_T to,
+            Tcl_Obj *linesPtr)
+{
+    const char *translation = "auto", *encoding = NULL;
+    Tcl_WideInt offset;
+    int lineEnd;
+
+    /* Skipped lines are part of -lines */
+    if (from <= 1 || (to > 0 && to < from) || fileOptsPtr->gzip ||
+            linesPtr != NULL) {
+        return 0;
+    }
+    if (fileOptsPtr->translationPtr != NULL) {
+        translation = Tcl_GetString(fileOptsPtr->translationPtr);
+    }
+    if (fileOptsPtr->encodingPtr != NULL) {
+        encoding = Tcl_GetString(fileOptsPtr->encodingPtr);
+    }
+    if (strcmp(translation, "auto") == 0) {
+        lineEnd = LINE_END_AUTO;
+    } else if (strcmp(translation, "cr") == 0) {
+        lineEnd = LINE_END_CR;
+    } else if (strcmp(translation, "crlf") == 0) {
+        lineEnd = LINE_END_CRLF;
+    } else if (strcmp(translation, "lf") == 0 ||
+               strcmp(translation, "binary") == 0) {
+        lineEnd = LINE_END_LF;
+    } else {
+        return 0;
+    }
+    /* -translation binary without -encoding reads bytes */
+    if ((encoding != NULL || strcmp(translation, "binary") != 0) &&
+            !LineEndsAreBytes(encoding)) {
+        return 0;
+    }
+    if (FileCacheLineOffset(interp, namePtr, lineEnd, from, &offset)
+            != TCL_OK) {
+        return 0;
+    }
+    return offset;
+}
+
+/*
+ * Move line numbers in the result of a diff done on ranges that were
+ * seeked to, back to line numbers in the files.
+ */
+static void
+ShiftResult(Tcl_Obj *resPtr,
+            DiffOptions_T *optsPtr,
+            Line_T skip1, Line_T skip2)
+{
+    Tcl_Obj **elemPtrs, **linePtrs;
+    int i, j, nElems, nLines;
+    long line;
+
+    /* An empty list may have no internal representation to keep */
+    Tcl_ListObjGetElements(NULL, resPtr, &nElems, &elemPtrs);
+    if (nElems == 0) return;
+    for (i = 0; i < nElems; i++) {
+        Tcl_ListObjGetElements(NULL, elemPtrs[i], &nLines, &linePtrs);
+        if (nLines == 0) continue;
+        for (j = 0; j < nLines; j++) {
+            /* Chunks are {start1 n1 start2 n2}, matches {lines1 lines2} */
+            if (optsPtr->resultStyle == Result_Diff && (j & 1)) continue;
+            Tcl_GetLongFromObj(NULL, linePtrs[j], &line);
+            if (optsPtr->resultStyle == Result_Diff) {
+                line += j == 0 ? skip1 : skip2;
+            } else {
+                line += i == 0 ? skip1 : skip2;
+            }
+            Tcl_SetLongObj(linePtrs[j], line);
+        }
+        Tcl_InvalidateStringRep(elemPtrs[i]);
+    }
+    Tcl_InvalidateStringRep(resPtr);
+}
+
 /*
  * Read two files, hash them and prepare the datastructures needed in LCS.
+ * The files are read from the given byte offsets, where the line numbers
+ * in the options start.
  */
 static int
 ReadAndHashFiles(Tcl_Interp *interp,
 	         Tcl_Obj *name1Ptr, Tcl_Obj *name2Ptr,
                  DiffOptions_T *optsPtr,
                  FileOptions_T *fileOptsPtr,
+                 Tcl_WideInt offset1, Tcl_WideInt offset2,
                  Line_T *mPtr, Line_T *nPtr,
                  P_T **PPtr, E_T **EPtr)
 {
@@ -111,7 +305,11 @@ ReadAndHashFiles(Tcl_Interp *interp,
     Line_T allocedV, allocedP;
     Tcl_Channel ch;
     Tcl_Obj *linePtr;
+    FileCacheKey_T key;
+    FileCacheEntry_T *entryPtr;
+    Hash_T *hashes;
 
+    key.key = NULL;
     statBuf = Tcl_AllocStatBuf();
 
     /* Stat files first to quickly see if they don't exist */
@@ -139,17 +337,37 @@ ReadAndHashFiles(Tcl_Interp *interp,
     Tcl_SetObjLength(linePtr, 0);
 
     /* Guess the number of lines in name2 for an inital allocation of V */
-    allocedV = fSize2 / 40;
+    allocedV = (fSize2 - offset2) / 40;
+    if (optsPtr->rTo2 > 0 && allocedV > optsPtr->rTo2 + 1) {
+        allocedV = optsPtr->rTo2 + 1;
+    }
     /* If the guess is low, alloc some more to be safe. */
     if (allocedV < 5000) allocedV = 5000;
     V = (V_T *) ckalloc(allocedV * sizeof(V_T));
 
     /*
      * Read file 2 and calculate hashes for each line, to fill in
-     * the V vector.
+     * the V vector. With a cache hit, no reading is needed.
      */
 
-    ch = OpenReadChannel(interp, name2Ptr, fileOptsPtr);
+    entryPtr = CacheLookup(interp, name2Ptr, optsPtr, fileOptsPtr, 0, offset2,
+                           &key);
+    if (entryPtr != NULL) {
+        n = entryPtr->n;
+        if (n >= allocedV) {
+            allocedV = n + 1;
+            V = (V_T *) ckrealloc((char *) V, allocedV * sizeof(V_T));
+        }
+        for (j = 1; j <= n; j++) {
+            V[j].serial = j;
+            V[j].hash = entryPtr->hashes[2 * j];
+            V[j].realhash = entryPtr->hashes[2 * j + 1];
+        }
+        FileCacheRelease(&key);
+        goto haveV;
+    }
+
+    ch = OpenRangeChannel(interp, name2Ptr, fileOptsPtr, offset2);
     if (ch == NULL) {
         result = TCL_ERROR;
         goto cleanup;
@@ -161,6 +379,11 @@ ReadAndHashFiles(Tcl_Interp *interp,
         V[n].serial = n;
         Tcl_SetObjLength(linePtr, 0);
         if (Tcl_GetsObj(ch, linePtr) < 0) {
+            if (!Tcl_Eof(ch)) {
+                ReadError(interp, ch, name2Ptr);
+                result = TCL_ERROR;
+                goto cleanup;
+            }
             n--;
             break;
         }
@@ -189,6 +412,17 @@ ReadAndHashFiles(Tcl_Interp *interp,
     }
     CloseReadChannel(interp, ch);
 
+    if (key.key != NULL) {
+        hashes = (Hash_T *) ckalloc(2 * (n + 1) * sizeof(Hash_T));
+        for (j = 1; j <= n; j++) {
+            hashes[2 * j] = V[j].hash;
+            hashes[2 * j + 1] = V[j].realhash;
+        }
+        FileCacheStore(interp, &key, n, hashes, 0);
+        FileCacheRelease(&key);
+    }
+
+    haveV:
     /*
      * Sort the V vector on hash/serial to allow fast search.
      */
@@ -203,13 +437,39 @@ ReadAndHashFiles(Tcl_Interp *interp,
      */
 
     /* Guess the number of lines in name1 for an inital allocation of P */
-    allocedP = fSize1 / 40;
+    allocedP = (fSize1 - offset1) / 40;
+    if (optsPtr->rTo1 > 0 && allocedP > optsPtr->rTo1 + 1) {
+        allocedP = optsPtr->rTo1 + 1;
+    }
     /* If the guess is low, alloc some more to be safe. */
     if (allocedP < 10000) allocedP = 10000;
     P = (P_T *) ckalloc(allocedP * sizeof(P_T));
 
+    entryPtr = CacheLookup(interp, name1Ptr, optsPtr, fileOptsPtr, 1, offset1,
+                           &key);
+    if (entryPtr != NULL) {
+        m = entryPtr->n;
+        if (m >= allocedP) {
+            allocedP = m + 1;
+            P = (P_T *) ckrealloc((char *) P, allocedP * sizeof(P_T));
+        }
+        for (m = 1; m <= entryPtr->n; m++) {
+            P[m].Eindex = 0;
+            P[m].forbidden = 0;
+            P[m].hash = h = entryPtr->hashes[2 * m];
+            P[m].realhash = entryPtr->hashes[2 * m + 1];
+            j = BSearchVVector(V, n, h, optsPtr);
+            if (V[j].hash == h) {
+                P[m].Eindex = E[j].first;
+            }
+        }
+        m = entryPtr->n;
+        FileCacheRelease(&key);
+        goto cleanup;
+    }
+
     /* Read file and calculate hashes for each line */
-    ch = OpenReadChannel(interp, name1Ptr, fileOptsPtr);
+    ch = OpenRangeChannel(interp, name1Ptr, fileOptsPtr, offset1);
     if (ch == NULL) {
         result = TCL_ERROR;
         goto cleanup;
@@ -222,6 +482,11 @@ ReadAndHashFiles(Tcl_Interp *interp,
         P[m].forbidden = 0;
         Tcl_SetObjLength(linePtr, 0);
         if (Tcl_GetsObj(ch, linePtr) < 0) {
+            if (!Tcl_Eof(ch)) {
+                ReadError(interp, ch, name1Ptr);
+                result = TCL_ERROR;
+                goto cleanup;
+            }
             m--;
             break;
         }
@@ -263,8 +528,18 @@ ReadAndHashFiles(Tcl_Interp *interp,
     }
     CloseReadChannel(interp, ch);
 
+    if (key.key != NULL) {
+        hashes = (Hash_T *) ckalloc(2 * (m + 1) * sizeof(Hash_T));
+        for (j = 1; j <= m; j++) {
+            hashes[2 * j] = P[j].hash;
+            hashes[2 * j + 1] = P[j].realhash;
+        }
+        FileCacheStore(interp, &key, m, hashes, 0);
+    }
+
     /* Clean up */
     cleanup:
+    FileCacheRelease(&key);
     ckfree((char *) V);
     Tcl_DecrRefCount(linePtr);
 
@@ -296,17 +571,49 @@ CompareFiles(
     Tcl_Channel ch1, ch2;
     Tcl_Obj *line1Ptr, *line2Ptr;
     Line_T current1, current2;
+    Line_T skip1 = 0, skip2 = 0;
+    Tcl_WideInt offset1 = 0, offset2 = 0;
+    DiffOptions_T opts;
     /*Line_T startBlock1, startBlock2;*/
 
+    /*
+     * With a range, try to seek to where it starts and diff from there
+     * as if the files started at the range.  Alignment is given in file
+     * line numbers, so it needs the whole files.
+     */
+    if (optsPtr->alignLength == 0) {
+        offset1 = RangeOffset(interp, name1Ptr, fileOptsPtr,
+                optsPtr->rFrom1, optsPtr->rTo1, fileOptsPtr->lines1Ptr);
+        offset2 = RangeOffset(interp, name2Ptr, fileOptsPtr,
+                optsPtr->rFrom2, optsPtr->rTo2, fileOptsPtr->lines2Ptr);
+    }
+    if (offset1 > 0 || offset2 > 0) {
+        opts = *optsPtr;
+        if (offset1 > 0) {
+            skip1 = opts.rFrom1 - 1;
+            opts.rFrom1 = 1;
+            if (opts.rTo1 > 0) opts.rTo1 -= skip1;
+        }
+        if (offset2 > 0) {
+            skip2 = opts.rFrom2 - 1;
+            opts.rFrom2 = 1;
+            if (opts.rTo2 > 0) opts.rTo2 -= skip2;
+        }
+        optsPtr = &opts;
+    }
+
     /*printf("Doing ReadAndHash\n"); */
     if (ReadAndHashFiles(interp, name1Ptr, name2Ptr, optsPtr, fileOptsPtr,
-		    &m, &n, &P, &E) != TCL_OK) {
+                    offset1, offset2, &m, &n, &P, &E) != TCL_OK) {
         return TCL_ERROR;
     }
 
     /* Handle the trivial case. */
     if (m == 0 || n == 0) {
         *resPtr = BuildResultFromJ(interp, optsPtr, m, n, NULL);
+        if (skip1 > 0 || skip2 > 0) {
+            ShiftResult(*resPtr, optsPtr, skip1, skip2);
+        }
 	ckfree((char *) E);
 	ckfree((char *) P);
 	return TCL_OK;
@@ -332,8 +639,8 @@ CompareFiles(
     Tcl_SetObjLength(line2Ptr, 1000);
 
     /* Assume open will work since it worked earlier */
-    ch1 = OpenReadChannel(interp, name1Ptr, fileOptsPtr);
-    ch2 = OpenReadChannel(interp, name2Ptr, fileOptsPtr);
+    ch1 = OpenRangeChannel(interp, name1Ptr, fileOptsPtr, offset1);
+    ch2 = OpenRangeChannel(interp, name2Ptr, fileOptsPtr, offset2);
 
     /* Skip start if there is a range */
     if (optsPtr->rFrom1 > 1) {
@@ -396,207 +703,573 @@ CompareFiles(
      */
 
     *resPtr = BuildResultFromJ(interp, optsPtr, m, n, J);
+    if (skip1 > 0 || skip2 > 0) {
+        ShiftResult(*resPtr, optsPtr, skip1, skip2);
+    }
 
     ckfree((char *) J);
     return TCL_OK;
 }
 
+/*
+ * Read the next line of one side of a sorted diff into a new object,
+ * and check that it does not sort before the previous one.
+ * Returns 1 for a line, 0 at the end, -1 if out of order, or -2 on a
+ * read error.
+ */
+static int
+NextSortedLine(
+    Tcl_Channel ch,
+    Tcl_Obj **linePtrPtr,
+    Tcl_Obj *linesPtr,
+    int left,
+    const DiffOptions_T *optsPtr)
+{
+    Tcl_Obj *prevPtr = *linePtrPtr, *linePtr;
+    int order;
+
+    linePtr = Tcl_NewObj();
+    Tcl_IncrRefCount(linePtr);
+    if (Tcl_GetsObj(ch, linePtr) < 0) {
+        Tcl_DecrRefCount(linePtr);
+        return Tcl_Eof(ch) ? 0 : -2;
+    }
+    if (linesPtr != NULL) {
+        Tcl_ListObjAppendElement(NULL, linesPtr, linePtr);
+    }
+    order = 0;
+    if (prevPtr != NULL) {
+        order = OrderObjects(prevPtr, left, linePtr, left, optsPtr);
+        Tcl_DecrRefCount(prevPtr);
+    }
+    *linePtrPtr = linePtr;
+    return order > 0 ? -1 : 1;
+}
+
+/*
+ * Diff files that are sorted, by merging them line by line.
+ * Only the current line of each file is kept, and the order is checked
+ * on the way.  Returns TCL_CONTINUE if a file turned out not to be
+ * sorted, and a normal diff is needed.
+ */
+static int
+SortedCompareFiles(
+	Tcl_Interp *interp,
+	Tcl_Obj *name1Ptr,
+	Tcl_Obj *name2Ptr,
+	DiffOptions_T *optsPtr,
+	FileOptions_T *fileOptsPtr,
+	Tcl_Obj **resPtr)
+{
+    Tcl_Channel ch1, ch2;
+    Tcl_Obj *line1Ptr = NULL, *line2Ptr = NULL;
+    ResultBuilder_T rb;
+    Line_T i = 0, j = 0;
+    int have1, have2, order, result = TCL_OK;
+
+    ch1 = OpenReadChannel(interp, name1Ptr, fileOptsPtr);
+    if (ch1 == NULL) {
+        return TCL_ERROR;
+    }
+    ch2 = OpenReadChannel(interp, name2Ptr, fileOptsPtr);
+    if (ch2 == NULL) {
+        CloseReadChannel(interp, ch1);
+        return TCL_ERROR;
+    }
+    ResultBuilderInit(interp, optsPtr, &rb);
+
+    have1 = NextSortedLine(ch1, &line1Ptr, fileOptsPtr->lines1Ptr, 1,
+                           optsPtr);
+    have2 = NextSortedLine(ch2, &line2Ptr, fileOptsPtr->lines2Ptr, 0,
+                           optsPtr);
+    while ((have1 > 0 || have2 > 0) && have1 >= 0 && have2 >= 0) {
+        if (have1 > 0 && have2 > 0) {
+            order = OrderObjects(line1Ptr, 1, line2Ptr, 0, optsPtr);
+        } else {
+            order = have1 > 0 ? -1 : 1;
+        }
+        /*
+         * The order may fold more than the compare does, e.g. non-ASCII
+         * case, so a match is confirmed like in the other diffs.
+         */
+        if (order == 0 &&
+                CompareObjects(line1Ptr, line2Ptr, optsPtr) == 0) {
+            ResultBuilderMatch(interp, optsPtr, &rb, i + 1, j + 1);
+        }
+        if (order <= 0) {
+            i++;
+            have1 = NextSortedLine(ch1, &line1Ptr, fileOptsPtr->lines1Ptr, 1,
+                                   optsPtr);
+        }
+        if (order >= 0) {
+            j++;
+            have2 = NextSortedLine(ch2, &line2Ptr, fileOptsPtr->lines2Ptr, 0,
+                                   optsPtr);
+        }
+    }
+
+    if (have1 == -2 || have2 == -2) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                "error reading \"%s\": %s",
+                Tcl_GetString(have1 == -2 ? name1Ptr : name2Ptr),
+                Tcl_PosixError(interp)));
+        result = TCL_ERROR;
+    } else if (have1 == -1 || have2 == -1) {
+        result = TCL_CONTINUE;
+        /* The normal diff will fill in the lines again */
+        if (fileOptsPtr->lines1Ptr != NULL) {
+            Tcl_SetListObj(fileOptsPtr->lines1Ptr, 0, NULL);
+            Tcl_SetListObj(fileOptsPtr->lines2Ptr, 0, NULL);
+        }
+    }
+    if (result == TCL_OK) {
+        *resPtr = ResultBuilderFinish(interp, optsPtr, &rb, i, j);
+    } else {
+        Tcl_DecrRefCount(rb.resPtr);
+    }
+    if (line1Ptr != NULL) {
+        Tcl_DecrRefCount(line1Ptr);
+    }
+    if (line2Ptr != NULL) {
+        Tcl_DecrRefCount(line2Ptr);
+    }
+    CloseReadChannel(interp, ch1);
+    CloseReadChannel(interp, ch2);
+    return result;
+}
+
+/*
+ * Read all lines of a file into a line store.
+ */
+static int
+ReadFileStore(
+	Tcl_Interp *interp,
+	Tcl_Obj *namePtr,
+	FileOptions_T *fileOptsPtr,
+	LineStore_T *storePtr)
+{
+    Tcl_Channel ch;
+
+    ch = OpenReadChannel(interp, namePtr, fileOptsPtr);
+    if (ch == NULL) {
+        return TCL_ERROR;
+    }
+    LineStoreReadChannel(storePtr, ch, 1, 0);
+    if (!Tcl_Eof(ch)) {
+        ReadError(interp, ch, namePtr);
+        return TCL_ERROR;
+    }
+    CloseReadChannel(interp, ch);
+    return TCL_OK;
+}
+
+/*
+ * Diff files regardless of the order of their lines, by a hash join.
+ * A file that is a handle from prepare uses its lines as they are.
+ */
+static int
+UnorderedCompareFiles(
+	Tcl_Interp *interp,
+	Tcl_Obj *name1Ptr,
+	Tcl_Obj *name2Ptr,
+	Prepared_T *prep1Ptr,
+	Prepared_T *prep2Ptr,
+	DiffOptions_T *optsPtr,
+	FileOptions_T *fileOptsPtr,
+	int nThreads,
+	Tcl_Obj **resPtr)
+{
+    LineStore_T store1, store2;
+    Unordered_T side1, side2;
+    const LineStore_T *store1Ptr, *store2Ptr;
+
+    InitLineStore(&store1);
+    InitLineStore(&store2);
+    store1Ptr = prep1Ptr != NULL ? &prep1Ptr->store : &store1;
+    store2Ptr = prep2Ptr != NULL ? &prep2Ptr->store : &store2;
+    if ((prep1Ptr == NULL &&
+         ReadFileStore(interp, name1Ptr, fileOptsPtr, &store1) != TCL_OK) ||
+        (prep2Ptr == NULL &&
+         ReadFileStore(interp, name2Ptr, fileOptsPtr, &store2) != TCL_OK)) {
+        FreeLineStore(&store1);
+        FreeLineStore(&store2);
+        return TCL_ERROR;
+    }
+
+    UnorderedFromStore(&side1, store1Ptr, optsPtr, 1, nThreads);
+    UnorderedFromStore(&side2, store2Ptr, optsPtr, 0, nThreads);
+    UnorderedJoin(&side1, &side2, optsPtr, nThreads);
+    *resPtr = UnorderedResult(&side1, &side2, optsPtr);
+
+    if (fileOptsPtr->lines1Ptr != NULL) {
+        LineStoreToList(store1Ptr, fileOptsPtr->lines1Ptr);
+        LineStoreToList(store2Ptr, fileOptsPtr->lines2Ptr);
+    }
+    FreeUnordered(&side1);
+    FreeUnordered(&side2);
+    FreeLineStore(&store1);
+    FreeLineStore(&store2);
+    return TCL_OK;
+}
+
+/*
+ * Parse the options of the diffFiles family of commands.
+ * The options are objv[first] up to, but not including, objv[last].
+ * The -lines, -threads, -command, -sorted and -unordered options are
+ * only allowed if the corresponding pointer is not NULL.
+ * On error, the caller should still clean up with FreeDiffFilesOptions.
+ */
 int
-DiffFilesObjCmd(
-    ClientData dummy,    	/* Not used. */
+ParseDiffFilesOptions(
     Tcl_Interp *interp,		/* Current interpreter. */
     int objc,			/* Number of arguments. */
-    Tcl_Obj *CONST objv[])	/* Argument objects. */
+    Tcl_Obj *CONST objv[],	/* Argument objects. */
+    int first, int last,	/* Range of options in objv */
+    const char *usage,		/* Arguments for the wrong # args message */
+    DiffOptions_T *optsPtr,
+    FileOptions_T *fileOptsPtr,
+    Tcl_Obj **linesVarObjPtr,
+    int *threadsPtr,
+    Tcl_Obj **commandPtrPtr,
+    DiffMode_T *modePtr)
 {
-    int index, resultStyle, t, result = TCL_OK;
-    Tcl_Obj *resPtr, *file1Ptr, *file2Ptr;
-    Tcl_Obj *linesPtr = NULL, *linesVarObj = NULL;
-    DiffOptions_T opts;
-    FileOptions_T fileOpts;
+    int index, resultStyle, t;
     static CONST char *options[] = {
 	"-b", "-w", "-i", "-nocase", "-align", "-encoding", "-range",
 	"-lines",
         "-noempty", "-nodigit", "-pivot", "-regsub", "-regsubleft",
-	"-regsubright", "-result", "-translation", "-gz", (char *) NULL
+	"-regsubright", "-result", "-translation", "-gz", "-threads",
+	"-command", "-sorted", "-unordered", (char *) NULL
     };
     enum options {
 	OPT_B, OPT_W, OPT_I, OPT_NOCASE, OPT_ALIGN, OPT_ENCODING, OPT_RANGE,
 	OPT_LINES,
         OPT_NOEMPTY, OPT_NODIGIT, OPT_PIVOT, OPT_REGSUB, OPT_REGSUBLEFT,
-	OPT_REGSUBRIGHT, OPT_RESULT, OPT_TRANSLATION, OPT_GZ
+	OPT_REGSUBRIGHT, OPT_RESULT, OPT_TRANSLATION, OPT_GZ, OPT_THREADS,
+	OPT_COMMAND, OPT_SORTED, OPT_UNORDERED
     };
     static CONST char *resultOptions[] = {
 	"diff", "match", (char *) NULL
     };
 
-    if (objc < 3) {
-        Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
-	return TCL_ERROR;
-    }
-
-    InitDiffOptions_T(opts);
-    InitFileOptions_T(fileOpts);
-
-    for (t = 1; t < objc - 2; t++) {
+    for (t = first; t < last; t++) {
 	if (Tcl_GetIndexFromObj(interp, objv[t], options, "option", 0,
 		&index) != TCL_OK) {
-            result = TCL_ERROR;
-            goto cleanup;
+            return TCL_ERROR;
 	}
 	switch (index) {
 	  case OPT_NOCASE:
 	  case OPT_I:
-            opts.ignore |= IGNORE_CASE;
+            optsPtr->ignore |= IGNORE_CASE;
 	    break;
 	  case OPT_B:
-            opts.ignore |= IGNORE_SPACE_CHANGE;
+            optsPtr->ignore |= IGNORE_SPACE_CHANGE;
 	    break;
 	  case OPT_W:
-            opts.ignore |= IGNORE_ALL_SPACE;
+            optsPtr->ignore |= IGNORE_ALL_SPACE;
 	    break;
 	  case OPT_NODIGIT:
-            opts.ignore |= IGNORE_NUMBERS;
+            optsPtr->ignore |= IGNORE_NUMBERS;
 	    break;
 	  case OPT_NOEMPTY:
-            opts.noempty = 1;
+            optsPtr->noempty = 1;
             break;
           case OPT_GZ:
-            fileOpts.gzip = 1;
+            fileOptsPtr->gzip = 1;
             break;
           case OPT_PIVOT:
             t++;
-            if (t >= objc - 2) {
-                Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
-                result = TCL_ERROR;
-                goto cleanup;
+            if (t >= last) {
+                Tcl_WrongNumArgs(interp, 1, objv, usage);
+                return TCL_ERROR;
             }
-            if (Tcl_GetIntFromObj(interp, objv[t], &opts.pivot) != TCL_OK) {
-                result = TCL_ERROR;
-                goto cleanup;
+            if (Tcl_GetIntFromObj(interp, objv[t], &optsPtr->pivot)
+                    != TCL_OK) {
+                return TCL_ERROR;
             }
-            if (opts.pivot < 1) {
+            if (optsPtr->pivot < 1) {
                 Tcl_SetResult(interp, "Pivot must be at least 1", TCL_STATIC);
-                result = TCL_ERROR;
-                goto cleanup;
+                return TCL_ERROR;
             }
             break;
           case OPT_REGSUB:
           case OPT_REGSUBLEFT:
           case OPT_REGSUBRIGHT:
             t++;
-            if (t >= (objc - 2)) {
+            if (t >= last) {
                 /* FIXA error message */
                 Tcl_SetResult(interp, "missing value", TCL_STATIC);
-                result = TCL_ERROR;
-                goto cleanup;
+                return TCL_ERROR;
             }
 	    if (index != OPT_REGSUBRIGHT) {
-		if (opts.regsubLeftPtr == NULL) {
-		    opts.regsubLeftPtr = Tcl_NewListObj(0, NULL);
-		    Tcl_IncrRefCount(opts.regsubLeftPtr);
+		if (optsPtr->regsubLeftPtr == NULL) {
+		    optsPtr->regsubLeftPtr = Tcl_NewListObj(0, NULL);
+		    Tcl_IncrRefCount(optsPtr->regsubLeftPtr);
 		}
-		if (Tcl_ListObjAppendList(interp, opts.regsubLeftPtr, objv[t])
-			!= TCL_OK) {
-		    result = TCL_ERROR;
-		    goto cleanup;
+		if (Tcl_ListObjAppendList(interp, optsPtr->regsubLeftPtr,
+                                objv[t]) != TCL_OK) {
+		    return TCL_ERROR;
 		}
 	    }
 	    if (index != OPT_REGSUBLEFT) {
-		if (opts.regsubRightPtr == NULL) {
-		    opts.regsubRightPtr = Tcl_NewListObj(0, NULL);
-		    Tcl_IncrRefCount(opts.regsubRightPtr);
+		if (optsPtr->regsubRightPtr == NULL) {
+		    optsPtr->regsubRightPtr = Tcl_NewListObj(0, NULL);
+		    Tcl_IncrRefCount(optsPtr->regsubRightPtr);
 		}
-		if (Tcl_ListObjAppendList(interp, opts.regsubRightPtr, objv[t])
-			!= TCL_OK) {
-		    result = TCL_ERROR;
-		    goto cleanup;
+		if (Tcl_ListObjAppendList(interp, optsPtr->regsubRightPtr,
+                                objv[t]) != TCL_OK) {
+		    return TCL_ERROR;
 		}
 	    }
 	    break;
 	  case OPT_RANGE:
             t++;
-            if (t >= (objc - 2)) {
+            if (t >= last) {
                 /* FIXA error message */
                 Tcl_SetResult(interp, "missing value", TCL_STATIC);
-                result = TCL_ERROR;
-                goto cleanup;
+                return TCL_ERROR;
             }
-            if (SetOptsRange(interp, objv[t], 1, &opts) != TCL_OK) {
-                result = TCL_ERROR;
-                goto cleanup;
+            if (SetOptsRange(interp, objv[t], 1, optsPtr) != TCL_OK) {
+                return TCL_ERROR;
             }
             break;
 	  case OPT_LINES:
+            if (linesVarObjPtr == NULL) {
+                goto notSupported;
+            }
             t++;
-            if (t >= (objc - 2)) {
+            if (t >= last) {
                 /* FIXA error message */
                 Tcl_SetResult(interp, "missing value", TCL_STATIC);
-                result = TCL_ERROR;
-                goto cleanup;
+                return TCL_ERROR;
             }
-	    linesVarObj = objv[t];
-	    linesPtr = Tcl_NewListObj(0, NULL);
-	    Tcl_IncrRefCount(linesPtr);
-	    fileOpts.lines1Ptr = Tcl_NewListObj(0, NULL);
-	    fileOpts.lines2Ptr = Tcl_NewListObj(0, NULL);
-	    Tcl_ListObjAppendElement(NULL, linesPtr, fileOpts.lines1Ptr);
-	    Tcl_ListObjAppendElement(NULL, linesPtr, fileOpts.lines2Ptr);
+	    *linesVarObjPtr = objv[t];
 	    break;
 	  case OPT_ALIGN:
             t++;
-            if (t >= (objc - 2)) {
+            if (t >= last) {
                 /* FIXA error message */
                 Tcl_SetResult(interp, "missing value", TCL_STATIC);
-                result = TCL_ERROR;
-                goto cleanup;
+                return TCL_ERROR;
             }
-            if (SetOptsAlign(interp, objv[t], 1, &opts) != TCL_OK) {
-                result = TCL_ERROR;
-                goto cleanup;
+            if (SetOptsAlign(interp, objv[t], 1, optsPtr) != TCL_OK) {
+                return TCL_ERROR;
             }
             break;
 	  case OPT_RESULT:
 	      t++;
-	      if (t >= objc - 2) {
-		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
-		  result = TCL_ERROR;
-		  goto cleanup;
+	      if (t >= last) {
+		  Tcl_WrongNumArgs(interp, 1, objv, usage);
+		  return TCL_ERROR;
 	      }
 	      if (Tcl_GetIndexFromObj(interp, objv[t], resultOptions,
 			      "result style", 0, &resultStyle) != TCL_OK) {
-		  result = TCL_ERROR;
-		  goto cleanup;
+		  return TCL_ERROR;
 	      }
-	      opts.resultStyle = resultStyle;
+	      optsPtr->resultStyle = resultStyle;
 	      break;
 	  case OPT_ENCODING:
 	      t++;
-	      if (t >= objc - 2) {
-		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
-		  result = TCL_ERROR;
-		  goto cleanup;
+	      if (t >= last) {
+		  Tcl_WrongNumArgs(interp, 1, objv, usage);
+		  return TCL_ERROR;
 	      }
-	      fileOpts.encodingPtr = objv[t];
+	      fileOptsPtr->encodingPtr = objv[t];
 	      Tcl_IncrRefCount(objv[t]);
 	      break;
 	  case OPT_TRANSLATION:
 	      t++;
-	      if (t >= objc - 2) {
-		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
-		  result = TCL_ERROR;
-		  goto cleanup;
+	      if (t >= last) {
+		  Tcl_WrongNumArgs(interp, 1, objv, usage);
+		  return TCL_ERROR;
 	      }
-	      fileOpts.translationPtr = objv[t];
+	      fileOptsPtr->translationPtr = objv[t];
 	      Tcl_IncrRefCount(objv[t]);
 	      break;
+	  case OPT_THREADS:
+	      if (threadsPtr == NULL) {
+		  goto notSupported;
+	      }
+	      t++;
+	      if (t >= last) {
+		  Tcl_WrongNumArgs(interp, 1, objv, usage);
+		  return TCL_ERROR;
+	      }
+	      if (Tcl_GetIntFromObj(interp, objv[t], threadsPtr) != TCL_OK) {
+		  return TCL_ERROR;
+	      }
+	      if (*threadsPtr < 1) {
+		  Tcl_SetResult(interp, "Threads must be at least 1",
+				TCL_STATIC);
+		  return TCL_ERROR;
+	      }
+	      break;
+	  case OPT_COMMAND:
+	      if (commandPtrPtr == NULL) {
+		  goto notSupported;
+	      }
+	      t++;
+	      if (t >= last) {
+		  Tcl_WrongNumArgs(interp, 1, objv, usage);
+		  return TCL_ERROR;
+	      }
+	      *commandPtrPtr = objv[t];
+	      break;
+	  case OPT_SORTED:
+	      if (modePtr == NULL) {
+		  goto notSupported;
+	      }
+	      if (*modePtr == Mode_Unordered) {
+		  goto bothModes;
+	      }
+	      *modePtr = Mode_Sorted;
+	      break;
+	  case OPT_UNORDERED:
+	      if (modePtr == NULL) {
+		  goto notSupported;
+	      }
+	      if (*modePtr == Mode_Sorted) {
+		  goto bothModes;
+	      }
+	      *modePtr = Mode_Unordered;
+	      break;
 	}
     }
-    NormaliseOpts(&opts);
+    if (modePtr != NULL && *modePtr != Mode_Lcs &&
+	    (optsPtr->alignLength > 0 || optsPtr->rFrom1 > 1 ||
+	     optsPtr->rFrom2 > 1 || optsPtr->rTo1 > 0 || optsPtr->rTo2 > 0)) {
+	Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+		"%s cannot be combined with -range or -align",
+		*modePtr == Mode_Sorted ? "-sorted" : "-unordered"));
+	return TCL_ERROR;
+    }
+    NormaliseOpts(optsPtr);
+    return TCL_OK;
+
+    notSupported:
+    Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+            "option \"%s\" is not supported by this command",
+            Tcl_GetString(objv[t])));
+    return TCL_ERROR;
+
+    bothModes:
+    Tcl_SetResult(interp, "-sorted and -unordered cannot be combined",
+	    TCL_STATIC);
+    return TCL_ERROR;
+}
+
+/*
+ * Release anything allocated by ParseDiffFilesOptions.
+ */
+void
+FreeDiffFilesOptions(
+    DiffOptions_T *optsPtr,
+    FileOptions_T *fileOptsPtr)
+{
+    if (optsPtr->regsubLeftPtr != NULL) {
+	Tcl_DecrRefCount(optsPtr->regsubLeftPtr);
+        optsPtr->regsubLeftPtr = NULL;
+    }
+    if (optsPtr->regsubRightPtr != NULL) {
+	Tcl_DecrRefCount(optsPtr->regsubRightPtr);
+        optsPtr->regsubRightPtr = NULL;
+    }
+    if (optsPtr->alignLength > STATIC_ALIGN) {
+        ckfree((char *) optsPtr->align);
+    }
+    optsPtr->alignLength = 0;
+    optsPtr->align = optsPtr->staticAlign;
+    if (fileOptsPtr == NULL) {
+        return;
+    }
+    if (fileOptsPtr->encodingPtr != NULL) {
+	Tcl_DecrRefCount(fileOptsPtr->encodingPtr);
+        fileOptsPtr->encodingPtr = NULL;
+    }
+    if (fileOptsPtr->translationPtr != NULL) {
+	Tcl_DecrRefCount(fileOptsPtr->translationPtr);
+        fileOptsPtr->translationPtr = NULL;
+    }
+}
+
+int
+DiffFilesObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int result = TCL_OK;
+    Tcl_Obj *resPtr, *file1Ptr, *file2Ptr;
+    Tcl_Obj *linesPtr = NULL, *linesVarObj = NULL;
+    DiffOptions_T opts;
+    FileOptions_T fileOpts;
+    Prepared_T *prep1Ptr, *prep2Ptr;
+    DiffMode_T mode = Mode_Lcs;
+    int sorted = TCL_CONTINUE, threads = 0;
+
+    if (objc < 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
+	return TCL_ERROR;
+    }
+
+    InitDiffOptions_T(opts);
+    InitFileOptions_T(fileOpts);
+
+    if (ParseDiffFilesOptions(interp, objc, objv, 1, objc - 2,
+                    "?opts? file1 file2", &opts, &fileOpts, &linesVarObj,
+                    &threads, NULL, &mode)
+            != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    /* Threads are only used for -unordered */
+    if (threads > 0 && mode != Mode_Unordered) {
+        Tcl_SetResult(interp, "-threads can only be used with -unordered",
+                      TCL_STATIC);
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (linesVarObj != NULL) {
+        linesPtr = Tcl_NewListObj(0, NULL);
+        Tcl_IncrRefCount(linesPtr);
+        fileOpts.lines1Ptr = Tcl_NewListObj(0, NULL);
+        fileOpts.lines2Ptr = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(NULL, linesPtr, fileOpts.lines1Ptr);
+        Tcl_ListObjAppendElement(NULL, linesPtr, fileOpts.lines2Ptr);
+    }
     file1Ptr = objv[objc-2];
     file2Ptr = objv[objc-1];
 
-    if (CompareFiles(interp, file1Ptr, file2Ptr, &opts, &fileOpts, &resPtr)
-	    != TCL_OK) {
+    /* Either file may be a handle from prepare */
+    prep1Ptr = GetPrepared(interp, file1Ptr, 0);
+    prep2Ptr = GetPrepared(interp, file2Ptr, 0);
+    if (mode == Mode_Sorted && prep1Ptr == NULL && prep2Ptr == NULL) {
+        /* Falls back to a normal diff if the files are not sorted */
+        sorted = SortedCompareFiles(interp, file1Ptr, file2Ptr, &opts,
+                                    &fileOpts, &resPtr);
+        if (sorted == TCL_ERROR) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    }
+    if (mode == Mode_Unordered) {
+        if (UnorderedCompareFiles(interp, file1Ptr, file2Ptr, prep1Ptr,
+                                  prep2Ptr, &opts, &fileOpts, threads,
+                                  &resPtr) != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    } else if (sorted == TCL_OK) {
+        /* The sorted files were merged */
+    } else if (prep1Ptr != NULL || prep2Ptr != NULL) {
+        if (PreparedDiff(interp, file1Ptr, file2Ptr, prep1Ptr, prep2Ptr,
+                         &opts, &fileOpts, &resPtr) != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    } else if (CompareFiles(interp, file1Ptr, file2Ptr, &opts, &fileOpts,
+                            &resPtr) != TCL_OK) {
         result = TCL_ERROR;
         goto cleanup;
     }
@@ -613,21 +1286,201 @@ DiffFilesObjCmd(
     if (linesPtr != NULL) {
 	Tcl_DecrRefCount(linesPtr);
     }
-    if (opts.regsubLeftPtr != NULL) {
-	Tcl_DecrRefCount(opts.regsubLeftPtr);
+    FreeDiffFilesOptions(&opts, &fileOpts);
+
+    return result;
+}
+
+/*
+ * Read lines from a channel given by name, with the file options applied.
+ */
+static int
+ReadStream(
+    Tcl_Interp *interp,
+    Tcl_Obj *namePtr,
+    FileOptions_T *fileOptsPtr,
+    Line_T first, Line_T last,
+    LineStore_T *storePtr)
+{
+    Tcl_Channel ch;
+    int mode;
+
+    ch = Tcl_GetChannel(interp, Tcl_GetString(namePtr), &mode);
+    if (ch == NULL) {
+        return TCL_ERROR;
+    }
+    if (!(mode & TCL_READABLE)) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                "channel \"%s\" wasn't opened for reading",
+                Tcl_GetString(namePtr)));
+        return TCL_ERROR;
+    }
+    if (fileOptsPtr->translationPtr != NULL &&
+            Tcl_SetChannelOption(interp, ch, "-translation",
+                    Tcl_GetString(fileOptsPtr->translationPtr)) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    /* Encoding after translation, see OpenReadChannel. */
+    if (fileOptsPtr->encodingPtr != NULL &&
+            Tcl_SetChannelOption(interp, ch, "-encoding",
+                    Tcl_GetString(fileOptsPtr->encodingPtr)) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    LineStoreReadChannel(storePtr, ch, first, last);
+    if (!Tcl_Eof(ch) && (last == 0 || storePtr->n < last)) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                "error reading \"%s\": %s", Tcl_GetString(namePtr),
+                Tcl_PosixError(interp)));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ * DiffUtil::diffStreams ?opts? ch1 ch2
+ *
+ * Like diffFiles, but reads from open channels. Since a channel cannot
+ * be read twice, all lines are kept in memory.
+ */
+int
+DiffStreamsObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int result = TCL_OK;
+    DiffOptions_T opts;
+    FileOptions_T fileOpts;
+    LineStore_T store1, store2;
+    Tcl_Obj *linesVarObj = NULL, *linesPtr, *lines1Ptr, *lines2Ptr, *resPtr;
+    Line_T m, n, *J;
+
+    if (objc < 3) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?opts? ch1 ch2");
+	return TCL_ERROR;
+    }
+
+    InitDiffOptions_T(opts);
+    InitFileOptions_T(fileOpts);
+    InitLineStore(&store1);
+    InitLineStore(&store2);
+
+    if (ParseDiffFilesOptions(interp, objc, objv, 1, objc - 2,
+                    "?opts? ch1 ch2", &opts, &fileOpts, &linesVarObj,
+                    NULL, NULL, NULL)
+            != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (fileOpts.gzip) {
+        Tcl_SetResult(interp, "-gz is not supported by diffStreams,"
+                      " use zlib push", TCL_STATIC);
+        result = TCL_ERROR;
+        goto cleanup;
     }
-    if (opts.regsubRightPtr != NULL) {
-	Tcl_DecrRefCount(opts.regsubRightPtr);
+    if (ReadStream(interp, objv[objc - 2], &fileOpts, opts.rFrom1, opts.rTo1,
+                   &store1) != TCL_OK ||
+            ReadStream(interp, objv[objc - 1], &fileOpts, opts.rFrom2,
+                       opts.rTo2, &store2) != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
     }
-    if (fileOpts.encodingPtr != NULL) {
-	Tcl_DecrRefCount(fileOpts.encodingPtr);
+
+    J = DiffLineStores(interp, &store1, &store2, &opts, &m, &n);
+    resPtr = BuildResultFromJ(interp, &opts, m, n, J);
+    ckfree((char *) J);
+    Tcl_IncrRefCount(resPtr);
+
+    if (linesVarObj != NULL) {
+        lines1Ptr = Tcl_NewListObj(0, NULL);
+        lines2Ptr = Tcl_NewListObj(0, NULL);
+        LineStoreToList(&store1, lines1Ptr);
+        LineStoreToList(&store2, lines2Ptr);
+        linesPtr = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(NULL, linesPtr, lines1Ptr);
+        Tcl_ListObjAppendElement(NULL, linesPtr, lines2Ptr);
+        if (Tcl_ObjSetVar2(interp, linesVarObj, NULL, linesPtr,
+                           TCL_LEAVE_ERR_MSG) == NULL) {
+            Tcl_DecrRefCount(resPtr);
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    }
+    Tcl_SetObjResult(interp, resPtr);
+    Tcl_DecrRefCount(resPtr);
+
+    cleanup:
+    FreeLineStore(&store1);
+    FreeLineStore(&store2);
+    FreeDiffFilesOptions(&opts, &fileOpts);
+    return result;
+}
+
+/*
+ * DiffUtil::diffText ?opts? text1 text2
+ *
+ * Like diffFiles, but with the contents given as values. Lines are
+ * found and hashed directly in the values' buffers.
+ */
+int
+DiffTextObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int result = TCL_OK, length1, length2;
+    DiffOptions_T opts;
+    FileOptions_T fileOpts;
+    LineStore_T store1, store2;
+    Tcl_Obj *text1Ptr, *text2Ptr;
+    const char *text1, *text2;
+    Line_T m, n, *J;
+
+    if (objc < 3) {
+	Tcl_WrongNumArgs(interp, 1, objv, "?opts? text1 text2");
+	return TCL_ERROR;
     }
-    if (fileOpts.translationPtr != NULL) {
-	Tcl_DecrRefCount(fileOpts.translationPtr);
+
+    InitDiffOptions_T(opts);
+    InitFileOptions_T(fileOpts);
+
+    if (ParseDiffFilesOptions(interp, objc, objv, 1, objc - 2,
+                    "?opts? text1 text2", &opts, &fileOpts, NULL,
+                    NULL, NULL, NULL)
+            != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
     }
-    if (opts.alignLength > STATIC_ALIGN) {
-        ckfree((char *) opts.align);
+    if (fileOpts.encodingPtr != NULL || fileOpts.translationPtr != NULL ||
+            fileOpts.gzip) {
+        Tcl_SetResult(interp, "-encoding, -translation and -gz are not"
+                      " supported by diffText", TCL_STATIC);
+        result = TCL_ERROR;
+        goto cleanup;
     }
 
+    /* Hold on to the values, in case a -regsub changes their type */
+    text1Ptr = objv[objc - 2];
+    text2Ptr = objv[objc - 1];
+    Tcl_IncrRefCount(text1Ptr);
+    Tcl_IncrRefCount(text2Ptr);
+    text1 = Tcl_GetStringFromObj(text1Ptr, &length1);
+    text2 = Tcl_GetStringFromObj(text2Ptr, &length2);
+    LineStoreView(&store1, text1, length1);
+    LineStoreView(&store2, text2, length2);
+
+    J = DiffLineStores(interp, &store1, &store2, &opts, &m, &n);
+    Tcl_SetObjResult(interp, BuildResultFromJ(interp, &opts, m, n, J));
+    ckfree((char *) J);
+
+    FreeLineStore(&store1);
+    FreeLineStore(&store2);
+    Tcl_DecrRefCount(text1Ptr);
+    Tcl_DecrRefCount(text2Ptr);
+
+    cleanup:
+    FreeDiffFilesOptions(&opts, &fileOpts);
     return result;
 }
@@ -14,6 +14,84 @@
 #include <sys/stat.h>
 #include "diffutil.h"
 
+/*
+ * List elements remember their hash in their internal representation,
+ * so diffing the same list objects again does not hash them again.
+ * Only pure strings get this type, an element with another type keeps
+ * it to not make the caller lose e.g. a list or number representation.
+ * Any change to the string frees the internal representation, so a
+ * cached hash can not get stale.
+ */
+typedef struct {
+    int ignore;               /* The ignore flags the hash was made with */
+    Hash_T hash, realhash;
+} ElemHash_T;
+
+static void FreeElemHash(Tcl_Obj *objPtr);
+static void DupElemHash(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr);
+
+static Tcl_ObjType elemHashType = {
+    "diffutil-hash",
+    FreeElemHash,
+    DupElemHash,
+    NULL,                     /* The string rep is always valid */
+    NULL
+};
+
+static void
+FreeElemHash(Tcl_Obj *objPtr)
+{
+    ckfree((char *) objPtr->internalRep.otherValuePtr);
+    objPtr->typePtr = NULL;
+}
+
+static void
+DupElemHash(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr)
+{
+    ElemHash_T *ehPtr = (ElemHash_T *) ckalloc(sizeof(ElemHash_T));
+
+    *ehPtr = *(ElemHash_T *) srcPtr->internalRep.otherValuePtr;
+    dupPtr->internalRep.otherValuePtr = (void *) ehPtr;
+    dupPtr->typePtr = &elemHashType;
+}
+
+/*
+ * Hash a list element, using and updating the hash cached in it.
+ */
+static void
+HashElem(Tcl_Obj *objPtr, const DiffOptions_T *optsPtr, int left,
+         Hash_T *result, Hash_T *real)
+{
+    ElemHash_T *ehPtr;
+    Tcl_Obj *regsubPtr = left ?
+            optsPtr->regsubLeftPtr : optsPtr->regsubRightPtr;
+    char *string;
+    int length;
+
+    if (regsubPtr != NULL ||
+            (objPtr->typePtr != NULL && objPtr->typePtr != &elemHashType)) {
+        Hash(objPtr, optsPtr, left, result, real);
+        return;
+    }
+    if (objPtr->typePtr == &elemHashType) {
+        ehPtr = (ElemHash_T *) objPtr->internalRep.otherValuePtr;
+        if (ehPtr->ignore == optsPtr->ignore) {
+            *result = ehPtr->hash;
+            *real = ehPtr->realhash;
+            return;
+        }
+    } else {
+        ehPtr = (ElemHash_T *) ckalloc(sizeof(ElemHash_T));
+    }
+    string = Tcl_GetStringFromObj(objPtr, &length);
+    HashLine(string, length, optsPtr, result, real);
+    ehPtr->ignore = optsPtr->ignore;
+    ehPtr->hash = *result;
+    ehPtr->realhash = *real;
+    objPtr->internalRep.otherValuePtr = (void *) ehPtr;
+    objPtr->typePtr = &elemHashType;
+}
+
 /*
  * Scan two lists, hash them and prepare the datastructures needed in LCS.
  */
@@ -52,7 +130,7 @@ HashLists(Tcl_Interp *interp,
     for (t = 1; t <= n; t++) {
         V[t].serial = t;
 
-        Hash(elem2Ptrs[t-1], optsPtr, 0, &V[t].hash, &V[t].realhash);
+        HashElem(elem2Ptrs[t-1], optsPtr, 0, &V[t].hash, &V[t].realhash);
     }
 
     /*
@@ -75,7 +153,7 @@ HashLists(Tcl_Interp *interp,
     for (t = 1; t <= m; t++) {
         P[t].Eindex = 0;
         P[t].forbidden = 0;
-        Hash(elem1Ptrs[t-1], optsPtr, 1, &h, &realh);
+        HashElem(elem1Ptrs[t-1], optsPtr, 1, &h, &realh);
         P[t].hash = h;
         P[t].realhash = realh;
 
@@ -97,14 +175,20 @@ HashLists(Tcl_Interp *interp,
     return TCL_OK;
 }
 
-/* Do the diff lists operation */
-int
-CompareLists(
+/*
+ * Diff two lists and check that matching elements really are matching.
+ * The J vector is returned in *JPtr, which the caller should free.
+ * It is NULL if either list is empty.
+ */
+static int
+CompareListsJ(
 	Tcl_Interp *interp,
 	Tcl_Obj *list1Ptr,
 	Tcl_Obj *list2Ptr,
 	DiffOptions_T *optsPtr,
-	Tcl_Obj **resPtr)
+	Line_T **JPtr,
+	Line_T *mPtr,
+	Line_T *nPtr)
 {
     E_T *E;
     P_T *P;
@@ -118,10 +202,12 @@ CompareLists(
         != TCL_OK) {
         return TCL_ERROR;
     }
+    *mPtr = m;
+    *nPtr = n;
 
     /* Handle the trivial case. */
     if (m == 0 || n == 0) {
-        *resPtr = BuildResultFromJ(interp, optsPtr, m, n, NULL);
+        *JPtr = NULL;
 	ckfree((char *) E);
 	ckfree((char *) P);
 	return TCL_OK;
@@ -162,6 +248,93 @@ CompareLists(
 	    J[current1] = 0;
 	}
     }
+    *JPtr = J;
+    return TCL_OK;
+}
+
+/*
+ * Is a list sorted, in the order OrderObjects gives?
+ */
+static int
+ListIsSorted(Tcl_Obj **elemPtrs, int length, int left,
+             const DiffOptions_T *optsPtr)
+{
+    int i;
+
+    for (i = 1; i < length; i++) {
+        if (OrderObjects(elemPtrs[i - 1], left, elemPtrs[i], left,
+                         optsPtr) > 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Diff two sorted lists by merging them, which needs no LCS.
+ * The J vector is returned in *JPtr, like CompareListsJ does.
+ * Returns 0 if either list is not sorted.
+ */
+static int
+SortedListsJ(
+	Tcl_Obj *list1Ptr,
+	Tcl_Obj *list2Ptr,
+	DiffOptions_T *optsPtr,
+	Line_T **JPtr,
+	Line_T *mPtr,
+	Line_T *nPtr)
+{
+    int length1, length2, order;
+    Tcl_Obj **elem1Ptrs, **elem2Ptrs;
+    Line_T i, j, *J;
+
+    if (Tcl_ListObjGetElements(NULL, list1Ptr, &length1, &elem1Ptrs)
+            != TCL_OK ||
+        Tcl_ListObjGetElements(NULL, list2Ptr, &length2, &elem2Ptrs)
+            != TCL_OK) {
+        /* Let the normal diff report it */
+        return 0;
+    }
+    if (!ListIsSorted(elem1Ptrs, length1, 1, optsPtr) ||
+        !ListIsSorted(elem2Ptrs, length2, 0, optsPtr)) {
+        return 0;
+    }
+    J = (Line_T *) ckalloc((length1 + 1) * sizeof(Line_T));
+    memset(J, 0, (length1 + 1) * sizeof(Line_T));
+    i = j = 1;
+    while (i <= length1 && j <= length2) {
+        order = OrderObjects(elem1Ptrs[i - 1], 1, elem2Ptrs[j - 1], 0,
+                             optsPtr);
+        /* Confirm a match, as the order may fold more than the compare */
+        if (order == 0 &&
+                CompareObjects(elem1Ptrs[i - 1], elem2Ptrs[j - 1],
+                               optsPtr) == 0) {
+            J[i] = j;
+        }
+        if (order <= 0) i++;
+        if (order >= 0) j++;
+    }
+    *JPtr = J;
+    *mPtr = length1;
+    *nPtr = length2;
+    return 1;
+}
+
+/* Do the diff lists operation */
+int
+CompareLists(
+	Tcl_Interp *interp,
+	Tcl_Obj *list1Ptr,
+	Tcl_Obj *list2Ptr,
+	DiffOptions_T *optsPtr,
+	Tcl_Obj **resPtr)
+{
+    Line_T m, n, *J;
+
+    if (CompareListsJ(interp, list1Ptr, list2Ptr, optsPtr, &J, &m, &n)
+            != TCL_OK) {
+        return TCL_ERROR;
+    }
 
     /*
      * Now the J vector is valid, generate a list of
@@ -170,7 +343,203 @@ CompareLists(
 
     *resPtr = BuildResultFromJ(interp, optsPtr, m, n, J);
 
-    ckfree((char *) J);
+    if (J != NULL) {
+        ckfree((char *) J);
+    }
+    return TCL_OK;
+}
+
+/*
+ * Get a field from a record, like lindex does.
+ * Returns NULL if the record is not a proper list.
+ */
+static Tcl_Obj *
+RecordField(Tcl_Interp *interp, Tcl_Obj *recordPtr, int index)
+{
+    Tcl_Obj *fieldPtr;
+
+    if (Tcl_ListObjIndex(interp, recordPtr, index, &fieldPtr) != TCL_OK) {
+        return NULL;
+    }
+    if (fieldPtr == NULL) {
+        /* Out of range, like lindex */
+        fieldPtr = Tcl_NewObj();
+    }
+    return fieldPtr;
+}
+
+/*
+ * Build a list of the keys of a list of records, from -key or
+ * -keycommand. The keys of -key are the records' own elements.
+ * Returns a new list with a reference count of one, or NULL on error.
+ */
+static Tcl_Obj *
+KeyList(
+    Tcl_Interp *interp,
+    Tcl_Obj *listPtr,
+    int keyIndex,
+    Tcl_Obj *keyCmdPtr)
+{
+    int length, i, cmdLength, result = TCL_OK;
+    Tcl_Obj **elemPtrs, **cmdPtrs, **callPtrs = NULL, *keysPtr, *keyPtr;
+
+    if (Tcl_ListObjGetElements(interp, listPtr, &length, &elemPtrs)
+            != TCL_OK) {
+        return NULL;
+    }
+    if (keyCmdPtr != NULL) {
+        if (Tcl_ListObjGetElements(interp, keyCmdPtr, &cmdLength, &cmdPtrs)
+                != TCL_OK) {
+            return NULL;
+        }
+        /* Own copies, since the command could change the originals */
+        listPtr = Tcl_DuplicateObj(listPtr);
+        Tcl_IncrRefCount(listPtr);
+        Tcl_ListObjGetElements(NULL, listPtr, &length, &elemPtrs);
+        keyCmdPtr = Tcl_DuplicateObj(keyCmdPtr);
+        Tcl_IncrRefCount(keyCmdPtr);
+        Tcl_ListObjGetElements(NULL, keyCmdPtr, &cmdLength, &cmdPtrs);
+        callPtrs = (Tcl_Obj **) ckalloc((cmdLength + 1) * sizeof(Tcl_Obj *));
+        memcpy(callPtrs, cmdPtrs, cmdLength * sizeof(Tcl_Obj *));
+    }
+    keysPtr = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(keysPtr);
+    for (i = 0; i < length; i++) {
+        if (keyCmdPtr != NULL) {
+            callPtrs[cmdLength] = elemPtrs[i];
+            result = Tcl_EvalObjv(interp, cmdLength + 1, callPtrs, 0);
+            if (result != TCL_OK) {
+                break;
+            }
+            Tcl_ListObjAppendElement(NULL, keysPtr, Tcl_GetObjResult(interp));
+            Tcl_ResetResult(interp);
+        } else {
+            keyPtr = RecordField(interp, elemPtrs[i], keyIndex);
+            if (keyPtr == NULL) {
+                result = TCL_ERROR;
+                break;
+            }
+            Tcl_ListObjAppendElement(NULL, keysPtr, keyPtr);
+        }
+    }
+    if (keyCmdPtr != NULL) {
+        ckfree((char *) callPtrs);
+        Tcl_DecrRefCount(keyCmdPtr);
+        Tcl_DecrRefCount(listPtr);
+    }
+    if (result != TCL_OK) {
+        Tcl_DecrRefCount(keysPtr);
+        return NULL;
+    }
+    return keysPtr;
+}
+
+/*
+ * Find the matched records where the -compare field differs.
+ * Returns a list of index pairs, or NULL on error.
+ */
+static Tcl_Obj *
+ChangedRecords(
+    Tcl_Interp *interp,
+    Tcl_Obj *list1Ptr,
+    Tcl_Obj *list2Ptr,
+    int compareIndex,
+    const DiffOptions_T *optsPtr,
+    Line_T m,
+    const Line_T *J)
+{
+    Tcl_Obj *resPtr, *pairPtr, *field1Ptr, *field2Ptr;
+    Tcl_Obj **elem1Ptrs, **elem2Ptrs;
+    int length1, length2, differ;
+    Line_T i;
+
+    resPtr = Tcl_NewListObj(0, NULL);
+    if (J == NULL) {
+        return resPtr;
+    }
+    Tcl_ListObjGetElements(NULL, list1Ptr, &length1, &elem1Ptrs);
+    Tcl_ListObjGetElements(NULL, list2Ptr, &length2, &elem2Ptrs);
+    for (i = 1; i <= m; i++) {
+        if (J[i] == 0) continue;
+        field1Ptr = RecordField(interp, elem1Ptrs[i - 1], compareIndex);
+        field2Ptr = field1Ptr == NULL ? NULL :
+                RecordField(interp, elem2Ptrs[J[i] - 1], compareIndex);
+        if (field2Ptr == NULL) {
+            if (field1Ptr != NULL) {
+                Tcl_IncrRefCount(field1Ptr);
+                Tcl_DecrRefCount(field1Ptr);
+            }
+            Tcl_DecrRefCount(resPtr);
+            return NULL;
+        }
+        Tcl_IncrRefCount(field1Ptr);
+        Tcl_IncrRefCount(field2Ptr);
+        differ = CompareObjects(field1Ptr, field2Ptr, optsPtr);
+        Tcl_DecrRefCount(field1Ptr);
+        Tcl_DecrRefCount(field2Ptr);
+        if (differ) {
+            pairPtr = Tcl_NewListObj(0, NULL);
+            Tcl_ListObjAppendElement(NULL, pairPtr,
+                    Tcl_NewLongObj((long) (i - 1)));
+            Tcl_ListObjAppendElement(NULL, pairPtr,
+                    Tcl_NewLongObj((long) (J[i] - 1)));
+            Tcl_ListObjAppendElement(NULL, resPtr, pairPtr);
+        }
+    }
+    return resPtr;
+}
+
+/*
+ * Diff lists regardless of the order of their elements, by a hash join.
+ * The J vector gets the matching element for each in list1, but is
+ * not in order like from the normal diff.
+ */
+static int
+UnorderedListsJ(
+    Tcl_Interp *interp,
+    Tcl_Obj *list1Ptr,
+    Tcl_Obj *list2Ptr,
+    DiffOptions_T *optsPtr,
+    int nThreads,
+    Line_T **JPtr,
+    Line_T *mPtr,
+    Tcl_Obj **resPtr)
+{
+    Unordered_T side1, side2;
+    Tcl_Obj **elem1Ptrs, **elem2Ptrs;
+    int length1, length2, t;
+    Hash_T real;
+
+    if (Tcl_ListObjGetElements(interp, list1Ptr, &length1, &elem1Ptrs)
+            != TCL_OK ||
+        Tcl_ListObjGetElements(interp, list2Ptr, &length2, &elem2Ptrs)
+            != TCL_OK) {
+        return TCL_ERROR;
+    }
+
+    /*
+     * Elements are hashed here since they are objects, and the lists
+     * keep their strings while the join is done.
+     */
+    InitUnordered(&side1, length1);
+    for (t = 0; t < length1; t++) {
+        side1.strings[t + 1] = Tcl_GetStringFromObj(elem1Ptrs[t],
+                                                    &side1.lengths[t + 1]);
+        HashElem(elem1Ptrs[t], optsPtr, 1, &side1.hashes[t + 1], &real);
+    }
+    InitUnordered(&side2, length2);
+    for (t = 0; t < length2; t++) {
+        side2.strings[t + 1] = Tcl_GetStringFromObj(elem2Ptrs[t],
+                                                    &side2.lengths[t + 1]);
+        HashElem(elem2Ptrs[t], optsPtr, 0, &side2.hashes[t + 1], &real);
+    }
+    UnorderedJoin(&side1, &side2, optsPtr, nThreads);
+    *resPtr = UnorderedResult(&side1, &side2, optsPtr);
+    *JPtr = side1.match;
+    *mPtr = length1;
+    side1.match = NULL;
+    FreeUnordered(&side1);
+    FreeUnordered(&side2);
     return TCL_OK;
 }
 
@@ -182,15 +551,22 @@ DiffListsObjCmd(
     Tcl_Obj *CONST objv[])	/* Argument objects. */
 {
     int index, resultStyle, t, result = TCL_OK;
-    Tcl_Obj *resPtr, *list1Ptr, *list2Ptr;
+    int keyIndex = -1, compareIndex = -1, threads = 0;
+    Tcl_Obj *resPtr, *list1Ptr, *list2Ptr, *changedPtr;
+    Tcl_Obj *keyCmdPtr = NULL, *keys1Ptr = NULL, *keys2Ptr = NULL;
     DiffOptions_T opts;
+    Prepared_T *prep1Ptr, *prep2Ptr;
+    Line_T m, n, *J = NULL;
+    DiffMode_T mode = Mode_Lcs;
     static CONST char *options[] = {
 	"-b", "-w", "-i", "-nocase",
-        "-noempty", "-nodigit", "-result", (char *) NULL
+        "-noempty", "-nodigit", "-result", "-key", "-keycommand",
+        "-compare", "-sorted", "-unordered", "-threads", (char *) NULL
     };
     enum options {
 	OPT_B, OPT_W, OPT_I, OPT_NOCASE,
-        OPT_NOEMPTY, OPT_NODIGIT, OPT_RESULT
+        OPT_NOEMPTY, OPT_NODIGIT, OPT_RESULT, OPT_KEY, OPT_KEYCOMMAND,
+        OPT_COMPARE, OPT_SORTED, OPT_UNORDERED, OPT_THREADS
     };
     static CONST char *resultOptions[] = {
 	"diff", "match", (char *) NULL
@@ -240,8 +616,86 @@ DiffListsObjCmd(
 	      }
 	      opts.resultStyle = resultStyle;
 	      break;
+	  case OPT_KEY:
+	  case OPT_COMPARE:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? list1 list2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (Tcl_GetIntFromObj(interp, objv[t],
+			      index == OPT_KEY ? &keyIndex : &compareIndex)
+		      != TCL_OK) {
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if ((index == OPT_KEY ? keyIndex : compareIndex) < 0) {
+		  Tcl_SetResult(interp, "bad index", TCL_STATIC);
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      break;
+	  case OPT_KEYCOMMAND:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? list1 list2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      keyCmdPtr = objv[t];
+	      break;
+	  case OPT_SORTED:
+	  case OPT_UNORDERED:
+	      if (mode != Mode_Lcs &&
+		      mode != (index == OPT_SORTED ? Mode_Sorted :
+			      Mode_Unordered)) {
+		  Tcl_SetResult(interp,
+			  "-sorted and -unordered cannot be combined",
+			  TCL_STATIC);
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      mode = index == OPT_SORTED ? Mode_Sorted : Mode_Unordered;
+	      break;
+	  case OPT_THREADS:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? list1 list2");
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (Tcl_GetIntFromObj(interp, objv[t], &threads) != TCL_OK) {
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      if (threads < 1) {
+		  Tcl_SetResult(interp, "Threads must be at least 1",
+				TCL_STATIC);
+		  result = TCL_ERROR;
+		  goto cleanup;
+	      }
+	      break;
 	}
     }
+    if (keyIndex >= 0 && keyCmdPtr != NULL) {
+        Tcl_SetResult(interp, "-key and -keycommand cannot be combined",
+                      TCL_STATIC);
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (compareIndex >= 0 && keyIndex < 0 && keyCmdPtr == NULL) {
+        Tcl_SetResult(interp, "-compare requires -key or -keycommand",
+                      TCL_STATIC);
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (threads > 0 && mode != Mode_Unordered) {
+        Tcl_SetResult(interp, "-threads can only be used with -unordered",
+                      TCL_STATIC);
+        result = TCL_ERROR;
+        goto cleanup;
+    }
     NormaliseOpts(&opts);
     /*
      * Element indexes starts with 0, while LCS works from 1.
@@ -252,13 +706,86 @@ DiffListsObjCmd(
     list1Ptr = objv[objc-2];
     list2Ptr = objv[objc-1];
 
-    if (CompareLists(interp, list1Ptr, list2Ptr, &opts, &resPtr) != TCL_OK) {
+    if (keyIndex >= 0 || keyCmdPtr != NULL || mode != Mode_Lcs) {
+        /*
+         * Records are matched on their keys, which are then diffed as
+         * lists of their own. Records are not handles from prepare, and
+         * are not looked up as such to not make strings of them.
+         */
+        if (keyIndex >= 0 || keyCmdPtr != NULL) {
+            keys1Ptr = KeyList(interp, list1Ptr, keyIndex, keyCmdPtr);
+            if (keys1Ptr == NULL) {
+                result = TCL_ERROR;
+                goto cleanup;
+            }
+            keys2Ptr = KeyList(interp, list2Ptr, keyIndex, keyCmdPtr);
+            if (keys2Ptr == NULL) {
+                result = TCL_ERROR;
+                goto cleanup;
+            }
+        } else {
+            keys1Ptr = list1Ptr;
+            keys2Ptr = list2Ptr;
+            Tcl_IncrRefCount(keys1Ptr);
+            Tcl_IncrRefCount(keys2Ptr);
+        }
+        if (mode == Mode_Unordered) {
+            if (UnorderedListsJ(interp, keys1Ptr, keys2Ptr, &opts, threads,
+                                &J, &m, &resPtr) != TCL_OK) {
+                result = TCL_ERROR;
+                goto cleanup;
+            }
+        } else {
+            if (mode == Mode_Sorted &&
+                    SortedListsJ(keys1Ptr, keys2Ptr, &opts, &J, &m, &n)) {
+                /* The sorted lists were merged */
+            } else if (CompareListsJ(interp, keys1Ptr, keys2Ptr, &opts, &J,
+                                     &m, &n) != TCL_OK) {
+                result = TCL_ERROR;
+                goto cleanup;
+            }
+            resPtr = BuildResultFromJ(interp, &opts, m, n, J);
+        }
+        if (compareIndex >= 0) {
+            changedPtr = ChangedRecords(interp, list1Ptr, list2Ptr,
+                                        compareIndex, &opts, m, J);
+            if (changedPtr == NULL) {
+                Tcl_DecrRefCount(resPtr);
+                result = TCL_ERROR;
+                goto cleanup;
+            }
+            resPtr = Tcl_NewListObj(1, &resPtr);
+            Tcl_ListObjAppendElement(NULL, resPtr, changedPtr);
+        }
+        Tcl_SetObjResult(interp, resPtr);
+        goto cleanup;
+    }
+
+    /* Either list may be a handle from prepare -list */
+    prep1Ptr = GetPrepared(interp, list1Ptr, 1);
+    prep2Ptr = GetPrepared(interp, list2Ptr, 1);
+    if (prep1Ptr != NULL || prep2Ptr != NULL) {
+        if (PreparedDiff(interp, list1Ptr, list2Ptr, prep1Ptr, prep2Ptr,
+                         &opts, NULL, &resPtr) != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    } else if (CompareLists(interp, list1Ptr, list2Ptr, &opts, &resPtr)
+            != TCL_OK) {
         result = TCL_ERROR;
         goto cleanup;
     }
     Tcl_SetObjResult(interp, resPtr);
 
     cleanup:
-
+    if (keys1Ptr != NULL) {
+        Tcl_DecrRefCount(keys1Ptr);
+    }
+    if (keys2Ptr != NULL) {
+        Tcl_DecrRefCount(keys2Ptr);
+    }
+    if (J != NULL) {
+        ckfree((char *) J);
+    }
     return result;
 }
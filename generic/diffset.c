@@ -0,0 +1,290 @@
+/***********************************************************************
+ *
+ * This file implements diffFileSet, which diffs a number of file pairs
+ * using a pool of worker threads.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "diffutil.h"
+
+/* One file pair */
+typedef struct {
+    Tcl_Obj *file1Ptr, *file2Ptr; /* Only touched by the calling thread */
+    char *path1, *path2;
+    /* Result */
+    Line_T m, n;
+    Line_T *J;
+    char *errorMsg;
+} SetItem_T;
+
+typedef struct {
+    Tcl_Interp *interp;           /* Only used when run without workers */
+    FileOptions_T *fileOptsPtr;   /* Only used when run without workers */
+    SharedOptions_T shared;
+    SetItem_T *items;
+} DiffSet_T;
+
+/*
+ * Data kept by each worker. The read buffers and the options are
+ * reused for all pairs handled by the worker.
+ */
+typedef struct {
+    DiffOptions_T opts;
+    LineStore_T store1, store2;
+} SetWorker_T;
+
+/*
+ * Read a file in the calling thread, through the same channel setup
+ * as diffFiles. Returns a ckalloc:ed error message on failure, or NULL.
+ */
+static char *
+ReadSetFileHere(DiffSet_T *setPtr, Tcl_Obj *namePtr, LineStore_T *storePtr,
+                Line_T first, Line_T last)
+{
+    Tcl_Channel ch;
+    char *msg;
+
+    ch = OpenReadChannel(setPtr->interp, namePtr, setPtr->fileOptsPtr);
+    if (ch == NULL) {
+        msg = CopyString(Tcl_GetStringResult(setPtr->interp));
+        Tcl_ResetResult(setPtr->interp);
+        return msg;
+    }
+    LineStoreReadChannel(storePtr, ch, first, last);
+    CloseReadChannel(setPtr->interp, ch);
+    return NULL;
+}
+
+/*
+ * Diff one pair. This is called from a worker thread, or from the
+ * calling thread when running without workers.
+ */
+static void
+DiffSetItem(ClientData clientData, int index, ClientData *workerDataPtr)
+{
+    DiffSet_T *setPtr = (DiffSet_T *) clientData;
+    SetItem_T *itemPtr = &setPtr->items[index];
+    SetWorker_T *workerPtr = (SetWorker_T *) *workerDataPtr;
+    DiffOptions_T *optsPtr;
+
+    if (workerPtr == NULL) {
+        workerPtr = (SetWorker_T *) ckalloc(sizeof(SetWorker_T));
+        SharedOptionsGet(&setPtr->shared, &workerPtr->opts);
+        InitLineStore(&workerPtr->store1);
+        InitLineStore(&workerPtr->store2);
+        *workerDataPtr = (ClientData) workerPtr;
+    }
+    optsPtr = &workerPtr->opts;
+    ResetLineStore(&workerPtr->store1);
+    ResetLineStore(&workerPtr->store2);
+
+    if (itemPtr->path1 != NULL) {
+        itemPtr->errorMsg = LineStoreReadFile(&workerPtr->store1,
+                itemPtr->path1, &setPtr->shared,
+                optsPtr->rFrom1, optsPtr->rTo1);
+    } else {
+        itemPtr->errorMsg = ReadSetFileHere(setPtr, itemPtr->file1Ptr,
+                &workerPtr->store1, optsPtr->rFrom1, optsPtr->rTo1);
+    }
+    if (itemPtr->errorMsg != NULL) return;
+    if (itemPtr->path2 != NULL) {
+        itemPtr->errorMsg = LineStoreReadFile(&workerPtr->store2,
+                itemPtr->path2, &setPtr->shared,
+                optsPtr->rFrom2, optsPtr->rTo2);
+    } else {
+        itemPtr->errorMsg = ReadSetFileHere(setPtr, itemPtr->file2Ptr,
+                &workerPtr->store2, optsPtr->rFrom2, optsPtr->rTo2);
+    }
+    if (itemPtr->errorMsg != NULL) return;
+
+    itemPtr->J = DiffLineStores(NULL, &workerPtr->store1, &workerPtr->store2,
+                                optsPtr, &itemPtr->m, &itemPtr->n);
+}
+
+static void
+DiffSetWorkerDone(ClientData clientData, ClientData workerData)
+{
+    SetWorker_T *workerPtr = (SetWorker_T *) workerData;
+
+    FreeDiffFilesOptions(&workerPtr->opts, NULL);
+    FreeLineStore(&workerPtr->store1);
+    FreeLineStore(&workerPtr->store2);
+    ckfree((char *) workerPtr);
+}
+
+int
+DiffFileSetObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int result = TCL_OK, i, count, pairc, nThreads, started = 0;
+    Tcl_Obj **pairv, **filev, *resPtr = NULL, *listPtr = NULL;
+    Tcl_Obj *commandPtr = NULL, *cmdPtr;
+    DiffOptions_T opts;
+    FileOptions_T fileOpts;
+    DiffSet_T set;
+    Parallel_T par;
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?opts? pairList");
+	return TCL_ERROR;
+    }
+
+    InitDiffOptions_T(opts);
+    InitFileOptions_T(fileOpts);
+    set.items = NULL;
+    count = 0;
+    nThreads = ParallelDefaultThreads();
+
+    if (ParseDiffFilesOptions(interp, objc, objv, 1, objc - 1,
+                    "?opts? pairList", &opts, &fileOpts, NULL,
+                    &nThreads, &commandPtr, NULL) != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (fileOpts.encodingPtr != NULL) {
+        /* Catch a bad encoding here, where it can be reported. */
+        Tcl_Encoding enc = Tcl_GetEncoding(interp,
+                Tcl_GetString(fileOpts.encodingPtr));
+        if (enc == NULL) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+        Tcl_FreeEncoding(enc);
+    }
+    if (Tcl_ListObjGetElements(interp, objv[objc - 1], &count, &pairv)
+            != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+
+    set.interp = interp;
+    set.fileOptsPtr = &fileOpts;
+    InitSharedOptions(&set.shared, &opts, &fileOpts);
+    set.items = (SetItem_T *) ckalloc((count + 1) * sizeof(SetItem_T));
+    memset(set.items, 0, (count + 1) * sizeof(SetItem_T));
+
+    for (i = 0; i < count; i++) {
+        if (Tcl_ListObjGetElements(interp, pairv[i], &pairc, &filev)
+                != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+        if (pairc != 2) {
+            Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                    "bad pair \"%s\": must be a list of two file names",
+                    Tcl_GetString(pairv[i])));
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+        set.items[i].file1Ptr = filev[0];
+        set.items[i].file2Ptr = filev[1];
+        Tcl_IncrRefCount(filev[0]);
+        Tcl_IncrRefCount(filev[1]);
+        set.items[i].path1 = LineStorePath(filev[0]);
+        set.items[i].path2 = LineStorePath(filev[1]);
+        if (set.items[i].path1 == NULL || set.items[i].path2 == NULL) {
+            /* This pair must be read by this thread, so no workers. */
+            nThreads = 1;
+        }
+    }
+
+    ParallelStart(&par, nThreads, count, DiffSetItem, DiffSetWorkerDone,
+                  (ClientData) &set);
+    started = 1;
+
+    if (commandPtr == NULL) {
+        listPtr = Tcl_NewListObj(0, NULL);
+        Tcl_IncrRefCount(listPtr);
+    }
+
+    /* Collect the results in order */
+    for (i = 0; i < count; i++) {
+        SetItem_T *itemPtr = &set.items[i];
+        int code;
+
+        ParallelWait(&par, i);
+        if (itemPtr->errorMsg != NULL) {
+            resPtr = Tcl_NewStringObj(itemPtr->errorMsg, -1);
+        } else {
+            resPtr = BuildResultFromJ(interp, &set.shared.opts,
+                                      itemPtr->m, itemPtr->n, itemPtr->J);
+            ckfree((char *) itemPtr->J);
+            itemPtr->J = NULL;
+        }
+
+        if (commandPtr == NULL) {
+            if (itemPtr->errorMsg != NULL) {
+                Tcl_SetObjResult(interp, resPtr);
+                result = TCL_ERROR;
+                break;
+            }
+            Tcl_ListObjAppendElement(interp, listPtr, resPtr);
+            continue;
+        }
+
+        cmdPtr = Tcl_DuplicateObj(commandPtr);
+        Tcl_IncrRefCount(cmdPtr);
+        Tcl_ListObjAppendElement(NULL, cmdPtr, Tcl_NewIntObj(i));
+        Tcl_ListObjAppendElement(NULL, cmdPtr, Tcl_NewStringObj(
+                itemPtr->errorMsg != NULL ? "error" : "ok", -1));
+        Tcl_ListObjAppendElement(NULL, cmdPtr, resPtr);
+        code = Tcl_EvalObjEx(interp, cmdPtr, 0);
+        Tcl_DecrRefCount(cmdPtr);
+        if (code == TCL_BREAK) {
+            break;
+        }
+        if (code == TCL_ERROR) {
+            Tcl_AddErrorInfo(interp, "\n    (diffFileSet command)");
+            result = TCL_ERROR;
+            break;
+        }
+    }
+
+    if (result == TCL_OK) {
+        if (listPtr != NULL) {
+            Tcl_SetObjResult(interp, listPtr);
+        } else {
+            Tcl_ResetResult(interp);
+        }
+    }
+
+    cleanup:
+    if (started) {
+        ParallelFinish(&par);
+    }
+    if (listPtr != NULL) {
+        Tcl_DecrRefCount(listPtr);
+    }
+    if (set.items != NULL) {
+        for (i = 0; i < count; i++) {
+            SetItem_T *itemPtr = &set.items[i];
+            if (itemPtr->file1Ptr != NULL) Tcl_DecrRefCount(itemPtr->file1Ptr);
+            if (itemPtr->file2Ptr != NULL) Tcl_DecrRefCount(itemPtr->file2Ptr);
+            if (itemPtr->path1 != NULL) ckfree(itemPtr->path1);
+            if (itemPtr->path2 != NULL) ckfree(itemPtr->path2);
+            if (itemPtr->J != NULL) ckfree((char *) itemPtr->J);
+            if (itemPtr->errorMsg != NULL) ckfree(itemPtr->errorMsg);
+        }
+        ckfree((char *) set.items);
+        FreeSharedOptions(&set.shared);
+    }
+    FreeDiffFilesOptions(&opts, &fileOpts);
+    return result;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
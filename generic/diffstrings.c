@@ -101,34 +101,324 @@ PrepareStringsLcs(Tcl_Interp *interp,
 }
 
 /*
- * Split a string into a list where each element is good as a chunk
- * for comparison.
- * E.g. if ws is ignored, any stretch of whitespace becomes one element.
- * If nothing is ignored, it will be one element per character.
+ * Strings up to this many characters are compared with BitLcs
+ * instead of the general LcsCore.
  */
-Tcl_Obj *
-SplitString(Tcl_Obj *strPtr,
-            DiffOptions_T *optsPtr)
+#define BIT_LCS_LIMIT 2048
+
+static int
+CompareUniChar(const void *a, const void *b)
+{
+    return (int) *(const Tcl_UniChar *) a - (int) *(const Tcl_UniChar *) b;
+}
+
+/* Find a character in a sorted array, or return -1. */
+static int
+FindUniChar(const Tcl_UniChar *chars, int n, Tcl_UniChar c)
+{
+    int first = 0, last = n - 1, mid;
+
+    while (first <= last) {
+        mid = (first + last) / 2;
+        if (chars[mid] == c) return mid;
+        if (chars[mid] < c) {
+            first = mid + 1;
+        } else {
+            last = mid - 1;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Find an LCS of two short character arrays with the bit-parallel
+ * algorithm of Allison-Dix and Hyyro, 64 characters per word.
+ * The bit vector of each row is kept to trace back the matches,
+ * which are taken from the end whenever possible.
+ * Returns a ckalloc:ed J vector.
+ */
+static Line_T *
+BitLcsOnce(const Tcl_UniChar *s1, Line_T m, const Tcl_UniChar *s2, Line_T n)
+{
+    Line_T words = (n + 63) / 64, i, j, w;
+    Tcl_WideUInt *rows, *masks, *row, *prev, *mask, u, sum, carry, c1;
+    Tcl_UniChar *chars;
+    Line_T *J;
+    int nChars, k;
+
+    /* The distinct characters of s2, each with a mask of where it is */
+    chars = (Tcl_UniChar *) ckalloc(n * sizeof(Tcl_UniChar));
+    memcpy(chars, s2, n * sizeof(Tcl_UniChar));
+    qsort(chars, n, sizeof(Tcl_UniChar), CompareUniChar);
+    nChars = 1;
+    for (j = 1; j < n; j++) {
+        if (chars[j] != chars[nChars - 1]) {
+            chars[nChars++] = chars[j];
+        }
+    }
+    masks = (Tcl_WideUInt *) ckalloc(nChars * words * sizeof(Tcl_WideUInt));
+    memset(masks, 0, nChars * words * sizeof(Tcl_WideUInt));
+    for (j = 0; j < n; j++) {
+        k = FindUniChar(chars, nChars, s2[j]);
+        masks[k * words + j / 64] |= (Tcl_WideUInt) 1 << (j % 64);
+    }
+
+    /*
+     * Row i has a zero bit at j-1 where the LCS of s1[1..i] and
+     * s2[1..j] is longer than that of s1[1..i] and s2[1..j-1].
+     */
+    rows = (Tcl_WideUInt *) ckalloc((m + 1) * words * sizeof(Tcl_WideUInt));
+    memset(rows, 0xff, words * sizeof(Tcl_WideUInt));
+    for (i = 1; i <= m; i++) {
+        prev = rows + (i - 1) * words;
+        row = rows + i * words;
+        k = FindUniChar(chars, nChars, s1[i - 1]);
+        if (k < 0) {
+            memcpy(row, prev, words * sizeof(Tcl_WideUInt));
+            continue;
+        }
+        mask = masks + k * words;
+        carry = 0;
+        for (w = 0; w < words; w++) {
+            u = prev[w] & mask[w];
+            sum = prev[w] + u;
+            c1 = sum < u;
+            sum += carry;
+            carry = c1 | (sum < carry);
+            row[w] = sum | (prev[w] - u);
+        }
+    }
+
+    /* Trace back from the end */
+    J = (Line_T *) ckalloc((m + 1) * sizeof(Line_T));
+    memset(J, 0, (m + 1) * sizeof(Line_T));
+    i = m;
+    j = n;
+    while (i > 0 && j > 0) {
+        if (s1[i - 1] == s2[j - 1]) {
+            J[i] = j;
+            i--;
+            j--;
+            continue;
+        }
+        row = rows + i * words;
+        if (row[(j - 1) / 64] & ((Tcl_WideUInt) 1 << ((j - 1) % 64))) {
+            /* Nothing gained by s2[j] */
+            j--;
+        } else {
+            /* Then nothing is gained by s1[i] */
+            i--;
+        }
+    }
+
+    ckfree((char *) rows);
+    ckfree((char *) masks);
+    ckfree((char *) chars);
+    return J;
+}
+
+/* Count the runs of consecutive matches in a J vector */
+static Line_T
+CountRuns(const Line_T *J, Line_T m)
+{
+    Line_T i, runs = 0;
+
+    for (i = 1; i <= m; i++) {
+        if (J[i] != 0 && (i == 1 || J[i - 1] == 0 || J[i - 1] + 1 != J[i])) {
+            runs++;
+        }
+    }
+    return runs;
+}
+
+/*
+ * Where a change is only a deletion, or only an insertion, it can
+ * sometimes be slid over a short run of matches to join a neighbouring
+ * change, leaving fewer and longer runs of matches.
+ */
+static void
+CompactJ(Line_T *J, Line_T m, const Tcl_UniChar *s1, const Tcl_UniChar *s2)
+{
+    Line_T i, a, b, c, d, r, k;
+
+    /* Deletions, s1[a..b] */
+    i = 1;
+    while (i <= m) {
+        if (J[i] != 0) {
+            i++;
+            continue;
+        }
+        a = i;
+        while (i <= m && J[i] == 0) i++;
+        b = i - 1;
+        if (a == 1 || b == m || J[b + 1] != J[a - 1] + 1) continue;
+        /* The run of matches before it, and after it */
+        for (r = 1; a - 1 - r >= 1 && J[a - 1 - r] != 0 &&
+                     J[a - 1 - r] + r == J[a - 1]; r++);
+        for (k = 0; k < r && s1[a - 2 - k] == s1[b - 1 - k]; k++);
+        if (k == r) {
+            for (k = 0; k < r; k++) {
+                J[b - k] = J[a - 1 - k];
+                J[a - 1 - k] = 0;
+            }
+            continue;
+        }
+        for (r = 1; b + 1 + r <= m && J[b + 1 + r] == J[b + 1] + r; r++);
+        for (k = 0; k < r && s1[a - 1 + k] == s1[b + k]; k++);
+        if (k == r) {
+            for (k = 0; k < r; k++) {
+                J[a + k] = J[b + 1 + k];
+                J[b + 1 + k] = 0;
+            }
+        }
+    }
+
+    /* Insertions, s2[c..d] between s1[i] and s1[i+1] */
+    for (i = 1; i < m; i++) {
+        if (J[i] == 0 || J[i + 1] <= J[i] + 1) continue;
+        c = J[i] + 1;
+        d = J[i + 1] - 1;
+        for (r = 1; i - r >= 1 && J[i - r] != 0 && J[i - r] + r == J[i]; r++);
+        for (k = 0; k < r && s2[J[i] - 1 - k] == s2[d - 1 - k]; k++);
+        if (k == r) {
+            for (k = 0; k < r; k++) {
+                J[i - k] = d - k;
+            }
+            continue;
+        }
+        for (r = 1; i + 1 + r <= m && J[i + 1 + r] == J[i + 1] + r; r++);
+        for (k = 0; k < r && s2[c - 1 + k] == s2[J[i + 1] - 1 + k]; k++);
+        if (k == r) {
+            for (k = 0; k < r; k++) {
+                J[i + 1 + k] = c + k;
+            }
+        }
+    }
+}
+
+/*
+ * Find the LCS of two short character arrays. There are often several,
+ * so it is done both from the end and, on reversed strings, from the
+ * start, keeping the one with fewest runs of matches. That mostly gives
+ * the same result as LcsCore.
+ */
+static Line_T *
+BitLcs(const Tcl_UniChar *s1, Line_T m, const Tcl_UniChar *s2, Line_T n)
+{
+    Tcl_UniChar *r1, *r2;
+    Line_T *J, *revJ, i;
+
+    J = BitLcsOnce(s1, m, s2, n);
+
+    r1 = (Tcl_UniChar *) ckalloc(m * sizeof(Tcl_UniChar));
+    r2 = (Tcl_UniChar *) ckalloc(n * sizeof(Tcl_UniChar));
+    for (i = 0; i < m; i++) r1[i] = s1[m - 1 - i];
+    for (i = 0; i < n; i++) r2[i] = s2[n - 1 - i];
+    revJ = BitLcsOnce(r1, m, r2, n);
+    ckfree((char *) r1);
+    ckfree((char *) r2);
+
+    /* Turn it back to refer to the original strings */
+    for (i = 1; i <= m / 2; i++) {
+        Line_T tmp = revJ[i];
+        revJ[i] = revJ[m + 1 - i];
+        revJ[m + 1 - i] = tmp;
+    }
+    for (i = 1; i <= m; i++) {
+        if (revJ[i] != 0) revJ[i] = n + 1 - revJ[i];
+    }
+    CompactJ(J, m, s1, s2);
+    CompactJ(revJ, m, s1, s2);
+    if (CountRuns(revJ, m) <= CountRuns(J, m)) {
+        ckfree((char *) J);
+        return revJ;
+    }
+    ckfree((char *) revJ);
+    return J;
+}
+
+/*
+ * Decode a string into an array of characters, folding case if needed.
+ * Returns the number of characters.
+ */
+static Line_T
+StringToUniChars(const char *str, int len, int nocase, Tcl_UniChar *chars)
+{
+    const char *end = str + len;
+    Line_T n = 0;
+
+    while (str < end) {
+        str += Tcl_UtfToUniChar(str, &chars[n]);
+        if (nocase) {
+            chars[n] = Tcl_UniCharToLower(chars[n]);
+        }
+        n++;
+    }
+    return n;
+}
+
+/*
+ * The chunks of a string that are compared when space or words matter.
+ * They are kept as offsets into the string, with the hash of each chunk.
+ */
+typedef struct {
+    Line_T n;            /* Number of chunks */
+    int *byteStart;      /* Where each chunk starts, and the end */
+    int *charStart;      /* Character index of the same, or NULL if */
+                         /* each character is a chunk */
+    Hash_T *hashes;      /* Hash and real hash of chunk i at 2*i, */
+                         /* counting chunks from 1 */
+} Chunks_T;
+
+/* The character index of 1-based chunk k, where k may be n+1 */
+#define ChunkChar(chunksPtr, k) ((chunksPtr)->charStart == NULL ? \
+        (int) (k) - 1 : (chunksPtr)->charStart[(k) - 1])
+
+static void
+AddChunk(Chunks_T *chunksPtr, const char *string, const char *start,
+         const char *end, int startChar, const DiffOptions_T *optsPtr)
+{
+    Line_T k = ++chunksPtr->n;
+
+    chunksPtr->byteStart[k - 1] = start - string;
+    chunksPtr->charStart[k - 1] = startChar;
+    HashLine(start, end - start, optsPtr, &chunksPtr->hashes[2 * k],
+             &chunksPtr->hashes[2 * k + 1]);
+}
+
+/*
+ * Split a string into chunks that are good for comparison.
+ * E.g. if ws is ignored, any stretch of whitespace becomes one chunk.
+ * If nothing is ignored, it will be one chunk per character.
+ * Everything is kept in one allocation, freed through byteStart.
+ */
+static void
+SplitString(const char *string, int length,
+            const DiffOptions_T *optsPtr, Chunks_T *chunksPtr)
 {
     int state = 0;
-    int length, chsize, isSpace;
-    char *string, *str, *startWord, *endWord;
+    int chsize, isSpace, nChars, startChar, endChar;
+    const char *str, *startWord, *endWord, *end = string + length;
     Tcl_UniChar c;
-    Tcl_Obj *resPtr;
     int igSpace = (optsPtr->ignore & (IGNORE_SPACE_CHANGE | IGNORE_ALL_SPACE));
     int word = optsPtr->wordparse;
 
-    resPtr = Tcl_NewListObj(0, NULL);
-    Tcl_IncrRefCount(resPtr);
-    
-    string = Tcl_GetStringFromObj(strPtr, &length);
+    chunksPtr->hashes = (Hash_T *) ckalloc(
+            2 * (length + 2) * (sizeof(Hash_T) + sizeof(int)));
+    chunksPtr->byteStart = (int *) (chunksPtr->hashes + 2 * (length + 2));
+    chunksPtr->charStart = chunksPtr->byteStart + length + 2;
+    chunksPtr->n = 0;
+
     str = string;
     startWord = str;
-    while (*str != 0) {
+    nChars = startChar = 0;
+    while (str < end) {
         endWord = str;
+        endChar = nChars;
         chsize = Tcl_UtfToUniChar(str, &c);
         isSpace = Tcl_UniCharIsSpace(c);
         str += chsize;
+        nChars++;
         if (state == 0) {
             if (igSpace && isSpace) {
                 state = 1;
@@ -148,38 +438,71 @@ SplitString(Tcl_Obj *strPtr,
         if (state == 0) {
             /* The just seen char is part of the chunk */
             endWord = str;
+            endChar = nChars;
         }
-        Tcl_ListObjAppendElement(
-            NULL, resPtr,
-            Tcl_NewStringObj(startWord, endWord-startWord));
+        AddChunk(chunksPtr, string, startWord, endWord, startChar, optsPtr);
         startWord = endWord;
+        startChar = endChar;
         str = endWord;
+        nChars = endChar;
         state = 0;
     }
     if (startWord < str) {
         /* Last chunk */
-        Tcl_ListObjAppendElement(
-            NULL, resPtr,
-            Tcl_NewStringObj(startWord, str-startWord));
+        AddChunk(chunksPtr, string, startWord, str, startChar, optsPtr);
+    }
+    chunksPtr->byteStart[chunksPtr->n] = str - string;
+    chunksPtr->charStart[chunksPtr->n] = nChars;
+}
+
+/*
+ * Compare the chunks of two strings.
+ * Returns the J vector of chunks, which the caller should free.
+ */
+static Line_T *
+CompareChunks(Tcl_Interp *interp,
+              const char *string1, const Chunks_T *chunks1Ptr,
+              const char *string2, const Chunks_T *chunks2Ptr,
+              const DiffOptions_T *optsPtr)
+{
+    Line_T i, j, *J;
+    const int *start1 = chunks1Ptr->byteStart;
+    const int *start2 = chunks2Ptr->byteStart;
+
+    J = DiffHashWindow(interp, chunks1Ptr->hashes, 0, chunks1Ptr->n,
+                       chunks2Ptr->hashes, 0, chunks2Ptr->n, optsPtr);
+
+    /* Check that matching chunks really are matching */
+    for (i = 1; i <= chunks1Ptr->n; i++) {
+        j = J[i];
+        if (j == 0) continue;
+        if (CompareLines(string1 + start1[i - 1], start1[i] - start1[i - 1],
+                         string2 + start2[j - 1], start2[j] - start2[j - 1],
+                         optsPtr) != 0) {
+            J[i] = 0;
+        }
     }
-    return resPtr;
+    return J;
 }
 
 /*
  * The main string LCS routine returns the J vector.
  * J is ckalloc:ed and need to be freed by the caller.
+ * The strings must be null terminated. This does not use any Tcl_Obj
+ * and may be called from any thread, with a NULL interp.
  */
 static void
 CompareStrings1(Tcl_Interp *interp,
-	Tcl_Obj *str1Ptr, Tcl_Obj *str2Ptr,
+	char *string1, int length1,
+	char *string2, int length2,
 	DiffOptions_T *optsPtr,
 	Line_T **resPtr, Line_T *mPtr, Line_T *nPtr)
 {
     E_T *E;
     P_T *P;
     Line_T m, n, *J, *newJ;
-    int i, j, length1, length2, chsize1, chsize2, len1, len2;
-    char *string1, *string2, *str1, *str2;
+    int i, j, chsize1, chsize2, len1, len2;
+    char *str1, *str2;
     int skip1start = 0, skip2start = 0;
     Tcl_UniChar c1, c2;
     const int nocase = optsPtr->ignore & IGNORE_CASE;
@@ -188,8 +511,6 @@ CompareStrings1(Tcl_Interp *interp,
      * Start by detecting leading and trailing equalities to lessen
      * the load on the LCS algorithm
      */
-    string1 = Tcl_GetStringFromObj(str1Ptr, &length1);
-    string2 = Tcl_GetStringFromObj(str2Ptr, &length2);
     str1 = string1;
     str2 = string2;
     if (optsPtr->ignore & (IGNORE_SPACE_CHANGE | IGNORE_ALL_SPACE)) {
@@ -227,14 +548,27 @@ CompareStrings1(Tcl_Interp *interp,
 	/*
 	 * The trivial case of nothing left.
 	 * Just fill in an empty J vector.
+	 * J is indexed by character, so count characters, not bytes.
 	 */
 
-	m = len1;
-	n = len2;
+	m = Tcl_NumUtfChars(str1, len1);
+	n = Tcl_NumUtfChars(str2, len2);
 	J = (Line_T *) ckalloc((m + 1) * sizeof(Line_T));
 	for (i = 0; i <= m; i++) {
 	    J[i] = 0;
 	}
+    } else if (Tcl_NumUtfChars(str1, len1) <= BIT_LCS_LIMIT &&
+               Tcl_NumUtfChars(str2, len2) <= BIT_LCS_LIMIT) {
+        /* Short strings, the usual case for lines, are done bitwise */
+        Tcl_UniChar *chars1, *chars2;
+
+        chars1 = (Tcl_UniChar *) ckalloc(len1 * sizeof(Tcl_UniChar));
+        chars2 = (Tcl_UniChar *) ckalloc(len2 * sizeof(Tcl_UniChar));
+        m = StringToUniChars(str1, len1, nocase, chars1);
+        n = StringToUniChars(str2, len2, nocase, chars2);
+        J = BitLcs(chars1, m, chars2, n);
+        ckfree((char *) chars1);
+        ckfree((char *) chars2);
     } else {
 	/*printf("Doing ReadAndHash\n");*/
 	PrepareStringsLcs(interp, str1, len1, str2, len2,
@@ -285,89 +619,128 @@ CompareStrings1(Tcl_Interp *interp,
 }
 
 /*
- * Make a string by joining a subrange of a list.
+ * A position in a string, moved forward to find the bytes of character
+ * indices without converting the string to unicode.
+ */
+typedef struct {
+    const char *bytes;
+    int index;
+} StrPos_T;
+
+static const char *
+StrPosAt(StrPos_T *posPtr, int index)
+{
+    if (index > posPtr->index) {
+        posPtr->bytes = Tcl_UtfAtIndex(posPtr->bytes, index - posPtr->index);
+        posPtr->index = index;
+    }
+    return posPtr->bytes;
+}
+
+/*
+ * Add the characters from index "from" up to, but not including, "to"
+ * of a string to a result list. With -result indices, the first and
+ * last index are added instead.
  */
-static Tcl_Obj *
-JoinRange(Tcl_Obj **elemPtrs, int from, int to)
+static void
+AppendPart(Tcl_Obj *resPtr, StrPos_T *posPtr, int from, int to,
+           int indices, Tcl_Obj *emptyPtr)
 {
-    Tcl_Obj *resPtr;
-    int i;
+    Tcl_Obj *partPtr;
+    const char *start;
 
-    resPtr = Tcl_NewObj();
-    for (i = from; i <= to; i++) {
-	Tcl_AppendObjToObj(resPtr, elemPtrs[i]);
+    if (indices) {
+        partPtr = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(NULL, partPtr, Tcl_NewIntObj(from));
+        Tcl_ListObjAppendElement(NULL, partPtr, Tcl_NewIntObj(to - 1));
+    } else if (to <= from) {
+        partPtr = emptyPtr;
+    } else {
+        start = StrPosAt(posPtr, from);
+        partPtr = Tcl_NewStringObj(start, StrPosAt(posPtr, to) - start);
     }
-    return resPtr;
+    Tcl_ListObjAppendElement(NULL, resPtr, partPtr);
 }
 
 /*
- * Compare Strings through list chunks.
+ * Compare two strings, by character or by chunk depending on options.
+ * The result is a J vector of chunks, and the chunks of each string
+ * for finding their characters. The caller should free J and call
+ * FreeChunks.
+ * This does not use any Tcl_Obj and may be called from any thread.
  */
+static Line_T *
+CompareStrings2(Tcl_Interp *interp,
+                char *string1, int length1,
+                char *string2, int length2,
+                const DiffOptions_T *optsPtr,
+                Chunks_T *chunks1Ptr, Chunks_T *chunks2Ptr)
+{
+    Line_T *J;
+
+    if ((optsPtr->ignore & (IGNORE_SPACE_CHANGE | IGNORE_ALL_SPACE)) ||
+        optsPtr->wordparse) {
+        /* Do it chunk-wise */
+        SplitString(string1, length1, optsPtr, chunks1Ptr);
+        SplitString(string2, length2, optsPtr, chunks2Ptr);
+        return CompareChunks(interp, string1, chunks1Ptr,
+                             string2, chunks2Ptr, optsPtr);
+    }
+
+    /* Char by char will work */
+    chunks1Ptr->hashes = chunks2Ptr->hashes = NULL;
+    chunks1Ptr->charStart = chunks2Ptr->charStart = NULL;
+    CompareStrings1(interp, string1, length1, string2, length2,
+                    (DiffOptions_T *) optsPtr, &J,
+                    &chunks1Ptr->n, &chunks2Ptr->n);
+    return J;
+}
+
 static void
-CompareStringsL(Tcl_Interp *interp,
-                Tcl_Obj *str1Ptr, Tcl_Obj *str2Ptr,
-                DiffOptions_T *optsPtr,
-                Tcl_Obj **resPtr)
+FreeChunks(Chunks_T *chunksPtr)
 {
-    Tcl_Obj *list1Ptr, *list2Ptr, *listResPtr;
-    int chunk, from1, from2, to1, to2;
-    int ch1, ch2, ch3, ch4;
-    int length1, length2, lengthr, lengthc;
-    Tcl_Obj **elem1Ptrs, **elem2Ptrs, **elemRPtrs, **elemCPtrs;
-
-    /* Do it chunk-wise through list diff */
-    list1Ptr = SplitString(str1Ptr, optsPtr);
-    list2Ptr = SplitString(str2Ptr, optsPtr);
-    optsPtr->resultStyle = Result_Diff;
-    optsPtr->firstIndex = 0;
-    CompareLists(interp, list1Ptr, list2Ptr, optsPtr, &listResPtr);
-    /* Go through the chunks */
-    *resPtr = Tcl_NewListObj(0, NULL);
-    Tcl_ListObjGetElements(NULL, list1Ptr, &length1, &elem1Ptrs);
-    Tcl_ListObjGetElements(NULL, list2Ptr, &length2, &elem2Ptrs);
-    /*printf("Split l1 %d l2 %d\n", length1, length2);
-    printf("L1 %s\n", Tcl_GetString(list1Ptr));
-    printf("L2 %s\n", Tcl_GetString(list2Ptr));*/
-
-    Tcl_ListObjGetElements(NULL, listResPtr, &lengthr, &elemRPtrs);
-    from1 = from2 = 0;
-    for (chunk = 0; chunk < lengthr; chunk++) {
-        Tcl_ListObjGetElements(NULL, elemRPtrs[chunk], &lengthc, &elemCPtrs);
-        Tcl_GetIntFromObj(interp, elemCPtrs[0], &ch1);
-        Tcl_GetIntFromObj(interp, elemCPtrs[1], &ch2);
-        Tcl_GetIntFromObj(interp, elemCPtrs[2], &ch3);
-        Tcl_GetIntFromObj(interp, elemCPtrs[3], &ch4);
-        /*printf("Chunk %d %d %d %d\n", ch1, ch2, ch3, ch4);*/
-
-        /* Pre chunk */
-        to1 = ch1 - 1;
-        to2 = ch3 - 1;
-        Tcl_ListObjAppendElement(interp, *resPtr,
-                                 JoinRange(elem1Ptrs, from1, to1));
-        Tcl_ListObjAppendElement(interp, *resPtr,
-                                 JoinRange(elem2Ptrs, from2, to2));
-        /* Chunk */
-        from1 = ch1;
-        from2 = ch3;
-        to1 = ch1 + ch2 - 1;
-        to2 = ch3 + ch4 - 1;
-        Tcl_ListObjAppendElement(interp, *resPtr,
-                                 JoinRange(elem1Ptrs, from1, to1));
-        Tcl_ListObjAppendElement(interp, *resPtr,
-                                 JoinRange(elem2Ptrs, from2, to2));
-        from1 = to1+1;
-        from2 = to2+1;
-    }
-    /* Post last chunk */
-    to1 = length1 - 1;
-    to2 = length2 - 1;
-    Tcl_ListObjAppendElement(interp, *resPtr,
-                             JoinRange(elem1Ptrs, from1, to1));
-    Tcl_ListObjAppendElement(interp, *resPtr,
-                             JoinRange(elem2Ptrs, from2, to2));
-
-    Tcl_DecrRefCount(list1Ptr);
-    Tcl_DecrRefCount(list2Ptr);
+    if (chunksPtr->hashes != NULL) {
+        ckfree((char *) chunksPtr->hashes);
+    }
+}
+
+/*
+ * Step through a J vector to the next change. current1/2 are where to
+ * continue from, counting from 1. On return start1/2 are where the
+ * change starts and current1/2 where it ends, exclusive.
+ * Returns 0 when there are no more changes.
+ */
+static int
+NextChange(const Line_T *J, Line_T m, Line_T n,
+           Line_T *current1Ptr, Line_T *current2Ptr,
+           Line_T *start1Ptr, Line_T *start2Ptr)
+{
+    Line_T current1 = *current1Ptr, current2 = *current2Ptr;
+
+    /* Do equal chunks first, so scan until a mismatch */
+    while (current1 <= m && J[current1] == current2) {
+        current1++;
+        current2++;
+    }
+    *start1Ptr = current1;
+    *start2Ptr = current2;
+    if (current1 > m && current2 > n) {
+        return 0;
+    }
+
+    /* Scan string 1 until next match */
+    while (current1 <= m && J[current1] == 0) {
+        current1++;
+    }
+    /* Scan string 2 until next match */
+    if (current1 <= m) {
+        current2 = J[current1];
+    } else {
+        current2 = n + 1;
+    }
+    *current1Ptr = current1;
+    *current2Ptr = current2;
+    return 1;
 }
 
 /*
@@ -377,6 +750,8 @@ CompareStringsL(Tcl_Interp *interp,
  * str1sub* concatenated gives string1
  * str2sub* concatenated gives string2
  * str1subN and str2subN are equal when N is odd, not equal when N is even
+ * With -result indices, each substring is given as its first and last
+ * character index instead.
  */
 static void
 CompareStrings3(Tcl_Interp *interp,
@@ -384,199 +759,65 @@ CompareStrings3(Tcl_Interp *interp,
                DiffOptions_T *optsPtr,
                Tcl_Obj **resPtr)
 {
-    Line_T m, n, *J;
-    Tcl_Obj *subPtr, *emptyPtr;
-    Tcl_UniChar c1, c2, c3;
-    int len1, len2;
-    int current1, current2;
-    int startblock1, startblock2;
-    int startchange1, startchange2;
-
-    len1 = Tcl_GetCharLength(str1Ptr);
-    len2 = Tcl_GetCharLength(str2Ptr);
-
-    /* Take care of trivial cases first */
-    if (len1 == 0 || len2 == 0) {
-        *resPtr = Tcl_NewListObj(0, NULL);
-        emptyPtr = Tcl_NewObj();
-        Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-        Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-        if (len1 > 0 || len2 > 0) {
-            Tcl_ListObjAppendElement(interp, *resPtr, str1Ptr);
-            Tcl_ListObjAppendElement(interp, *resPtr, str2Ptr);
-            Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-            Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-        }
-        return;
-    }
-    
-    if ((optsPtr->ignore & (IGNORE_SPACE_CHANGE | IGNORE_ALL_SPACE)) ||
-        optsPtr->wordparse) {
-        /* Do it chunk-wise through list diff */
-        CompareStringsL(interp, str1Ptr, str2Ptr, optsPtr, resPtr);
-        return;
-    }
+    Line_T *J;
+    Tcl_Obj *emptyPtr;
+    int length1, length2;
+    char *string1, *string2;
+    Line_T current1, current2;
+    Line_T startblock1, startblock2;
+    Line_T startchange1, startchange2;
+    Chunks_T chunks1, chunks2;
+    StrPos_T pos1, pos2;
+    const int indices = (optsPtr->resultStyle == Result_Indices);
 
-    /* Char by char will work */
-    CompareStrings1(interp, str1Ptr, str2Ptr, optsPtr, &J, &m, &n);
+    string1 = Tcl_GetStringFromObj(str1Ptr, &length1);
+    string2 = Tcl_GetStringFromObj(str2Ptr, &length2);
+    J = CompareStrings2(interp, string1, length1, string2, length2, optsPtr,
+                        &chunks1, &chunks2);
 
     /*
-     * Now we have a list of matching chars in J.
-     * Generate a list of substrings.
+     * Now we have a list of matching chunks in J.
+     * Generate a list of substrings. They are taken from the strings
+     * in order, so the byte positions can be followed along.
      */
 
     *resPtr = Tcl_NewListObj(0, NULL);
     emptyPtr = Tcl_NewObj();
     Tcl_IncrRefCount(emptyPtr);
+    pos1.bytes = string1;
+    pos2.bytes = string2;
+    pos1.index = pos2.index = 0;
 
-    /* All indexes in startblock etc. starts at 1 for the first char. */
+    /* All indexes in startblock etc. starts at 1 for the first chunk. */
     startblock1 = startblock2 = 1;
     current1 = current2 = 1;
 
-    while (1) {
-        /* Do equal chars first, so scan until a mismatch */
-        while (current1 <= m || current2 <= n) {
-            if (J[current1] == 0) break;
-            if (J[current1] != current2) break;
-            current1++;
-            current2++;
-        }
-
-        /*
-         * Finished?
-         * Since the result should always end with an equal pair
-         * this is the only exit point from the loop.
-         */
-        if (current1 > m && current2 > n) {
-            if (current1 == startblock1) {
-                /* Nothing equal */
-                Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-                Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-            } else {
-                subPtr = Tcl_GetRange(str1Ptr, startblock1 - 1, current1 - 2);
-                Tcl_ListObjAppendElement(interp, *resPtr, subPtr);
-                subPtr = Tcl_GetRange(str2Ptr, startblock2 - 1, current2 - 2);
-                Tcl_ListObjAppendElement(interp, *resPtr, subPtr);
-            }
-            break;
-        }
-
-        /* Do change block */
-        startchange1 = current1;
-        startchange2 = current2;
-
-        scanChangeBlock:
-
-        /* Scan string 1 until next match */
-        while (current1 <= m) {
-            if (J[current1] != 0) break;
-            current1++;
-        }
-        /* Scan string 2 until next match */
-        if (current1 <= m) {
-            current2 = J[current1];
-        } else {
-            current2 = n+1;
-        }
-
-        if (optsPtr->wordparse) {
-            /* FIXA adjust if wordparse */
-            /* Adjust start of change */
-            if (current1 == startchange1) {
-                /* Block 1 is empty, handle the other one */
-                while (startchange2 > startblock2) {
-                    c1 = Tcl_GetUniChar(str2Ptr, startchange2 - 1 - 1);
-                    c2 = Tcl_GetUniChar(str2Ptr, startchange2 - 1);
-                    c3 = Tcl_GetUniChar(str2Ptr, current2 - 1 - 1);
-                    if (Tcl_UniCharIsSpace(c1) || Tcl_UniCharIsSpace(c2))
-                        break;
-                    startchange1--;
-                    startchange2--;
-                    /*
-                     * If the one before the change is equal to the one in
-                     * the end, we move the block.
-                     */
-                    if (c1 == c3) {
-                        current1--;
-                        current2--;
-                    }
-                }
-            } else if (current2 == startchange2) {
-                /* Block 2 is empty, handle the other one */
-                while (startchange1 > startblock1) {
-                    c1 = Tcl_GetUniChar(str1Ptr, startchange1 - 1 - 1);
-                    c2 = Tcl_GetUniChar(str1Ptr, startchange1 - 1);
-                    c3 = Tcl_GetUniChar(str1Ptr, current1 - 1 - 1);
-                    if (Tcl_UniCharIsSpace(c1) || Tcl_UniCharIsSpace(c2))
-                        break;
-                    startchange1--;
-                    startchange2--;
-                    /*
-                     * If the one before the change is equal to the one in
-                     * the end, we move the block.
-                     */
-                    if (c1 == c3) {
-                        current1--;
-                        current2--;
-                    }
-                }
-            } else {
-                /*printf("1: %d %d %d  2: %d %d %d\n",
-                       startblock1, startchange1, current1,
-                       startblock2, startchange2, current2);*/
-                while (startchange1 > startblock1) {
-                    c1 = Tcl_GetUniChar(str1Ptr, startchange1 - 1 - 1);
-                    if (Tcl_UniCharIsSpace(c1)) break;
-                    startchange1--;
-                    startchange2--;
-                }
-            }
-            /* Adjust end of change */
-            while (current1 <= m && current2 <= n) {
-                if (J[current1] == 0 || J[current1] != current2) {
-                    /*
-                     * We encountered a difference before any space could
-                     * be found.  Go back to scanning the change block.
-                     */
-                    goto scanChangeBlock;
-                }
-                c1 = Tcl_GetUniChar(str1Ptr, current1 - 1);
-                if (Tcl_UniCharIsSpace(c1)) break;
-                current1++;
-                current2++;
-            }
-        } /* if wordparse */
-
+    while (NextChange(J, chunks1.n, chunks2.n, &current1, &current2,
+                      &startchange1, &startchange2)) {
         /* Add the equals to the result */
-        if (startchange1 == startblock1) {
-            /* Nothing equal */
-            Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-            Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-        } else {
-            subPtr = Tcl_GetRange(str1Ptr, startblock1 - 1, startchange1 - 2);
-            Tcl_ListObjAppendElement(interp, *resPtr, subPtr);
-            subPtr = Tcl_GetRange(str2Ptr, startblock2 - 1, startchange2 - 2);
-            Tcl_ListObjAppendElement(interp, *resPtr, subPtr);
-        }
+        AppendPart(*resPtr, &pos1, ChunkChar(&chunks1, startblock1),
+                   ChunkChar(&chunks1, startchange1), indices, emptyPtr);
+        AppendPart(*resPtr, &pos2, ChunkChar(&chunks2, startblock2),
+                   ChunkChar(&chunks2, startchange2), indices, emptyPtr);
         /* Add the changes to the result */
-        if (current1 <= startchange1) {
-            Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-        } else {
-            subPtr = Tcl_GetRange(str1Ptr, startchange1 - 1, current1 - 2);
-            Tcl_ListObjAppendElement(interp, *resPtr, subPtr);
-        }
-        if (current2 <= startchange2) {
-            Tcl_ListObjAppendElement(interp, *resPtr, emptyPtr);
-        } else {
-            subPtr = Tcl_GetRange(str2Ptr, startchange2 - 1, current2 - 2);
-            Tcl_ListObjAppendElement(interp, *resPtr, subPtr);
-        }
+        AppendPart(*resPtr, &pos1, ChunkChar(&chunks1, startchange1),
+                   ChunkChar(&chunks1, current1), indices, emptyPtr);
+        AppendPart(*resPtr, &pos2, ChunkChar(&chunks2, startchange2),
+                   ChunkChar(&chunks2, current2), indices, emptyPtr);
 
         startblock1 = current1;
         startblock2 = current2;
     }
 
+    /* The result always ends with an equal pair */
+    AppendPart(*resPtr, &pos1, ChunkChar(&chunks1, startblock1),
+               ChunkChar(&chunks1, startchange1), indices, emptyPtr);
+    AppendPart(*resPtr, &pos2, ChunkChar(&chunks2, startblock2),
+               ChunkChar(&chunks2, startchange2), indices, emptyPtr);
+
     Tcl_DecrRefCount(emptyPtr);
+    FreeChunks(&chunks1);
+    FreeChunks(&chunks2);
     ckfree((char *) J);
 }
 
@@ -590,12 +831,16 @@ DiffStrings2ObjCmd(dummy, interp, objc, objv)
     int index, t, result = TCL_OK;
     Tcl_Obj *res;
     DiffOptions_T opts;
+    Tcl_DString key;
 
     static CONST char *options[] = {
-	"-nocase", "-i", "-b", "-w", "-words", (char *) NULL
+	"-nocase", "-i", "-b", "-w", "-words", "-result", (char *) NULL
     };
     enum options {
-	OPT_NOCASE, OPT_I, OPT_B, OPT_W, OPT_WORDS
+	OPT_NOCASE, OPT_I, OPT_B, OPT_W, OPT_WORDS, OPT_RESULT
+    };
+    static CONST char *resultOptions[] = {
+	"strings", "indices", (char *) NULL
     };
 
     if (objc < 3) {
@@ -624,11 +869,229 @@ DiffStrings2ObjCmd(dummy, interp, objc, objv)
 	  case OPT_WORDS:
 	    opts.wordparse = 1;
 	    break;
+	  case OPT_RESULT:
+	    t++;
+	    if (t >= objc - 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "?opts? line1 line2");
+		return TCL_ERROR;
+	    }
+	    if (Tcl_GetIndexFromObj(interp, objv[t], resultOptions,
+		    "result style", 0, &index) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    opts.resultStyle = index == 1 ? Result_Indices : Result_Diff;
+	    break;
 	}
     }
 
-    CompareStrings3(interp, objv[objc-2], objv[objc-1], &opts, &res);
+    res = StringCacheLookup(interp, "diffStrings2", objc - 1, objv + 1,
+                            &key);
+    if (res == NULL) {
+        CompareStrings3(interp, objv[objc-2], objv[objc-1], &opts, &res);
+        StringCacheStore(interp, &key, res);
+    }
+    Tcl_DStringFree(&key);
 
     Tcl_SetObjResult(interp, res);
     return result;
 }
+
+/*
+ * diffLinePairs compares a block of line pairs, with the work split into
+ * items of this many pairs.
+ */
+#define PAIRS_PER_ITEM 64
+
+typedef struct {
+    Tcl_Obj **elem1Ptrs, **elem2Ptrs; /* Only touched by the calling thread */
+    char **str1, **str2;
+    int *len1, *len2;
+    DiffOptions_T *optsPtr;
+    int nPairs;
+    int **ranges;                     /* Result for each pair, ckalloc:ed */
+    int *nRanges;
+} LinePairs_T;
+
+/*
+ * Add a change to a growing ranges array.
+ */
+static void
+AddRange(int **rangesPtr, int *nPtr, int *allocPtr,
+         int from1, int len1, int from2, int len2)
+{
+    if (*nPtr + 4 > *allocPtr) {
+        *allocPtr = *allocPtr * 2 + 16;
+        *rangesPtr = (int *) ckrealloc((char *) *rangesPtr,
+                                       *allocPtr * sizeof(int));
+    }
+    (*rangesPtr)[(*nPtr)++] = from1;
+    (*rangesPtr)[(*nPtr)++] = len1;
+    (*rangesPtr)[(*nPtr)++] = from2;
+    (*rangesPtr)[(*nPtr)++] = len2;
+}
+
+/*
+ * Compare one pair of lines, giving the changes as character ranges.
+ */
+static void
+LinePairRanges(LinePairs_T *lpPtr, int pair)
+{
+    int *ranges = NULL, nRanges = 0, alloced = 0;
+    Line_T *J, current1, current2, start1, start2;
+    Chunks_T chunks1, chunks2;
+    int from1, from2;
+
+    J = CompareStrings2(NULL, lpPtr->str1[pair], lpPtr->len1[pair],
+                        lpPtr->str2[pair], lpPtr->len2[pair],
+                        lpPtr->optsPtr, &chunks1, &chunks2);
+    current1 = current2 = 1;
+    while (NextChange(J, chunks1.n, chunks2.n, &current1, &current2,
+                      &start1, &start2)) {
+        from1 = ChunkChar(&chunks1, start1);
+        from2 = ChunkChar(&chunks2, start2);
+        AddRange(&ranges, &nRanges, &alloced,
+                 from1, ChunkChar(&chunks1, current1) - from1,
+                 from2, ChunkChar(&chunks2, current2) - from2);
+    }
+    ckfree((char *) J);
+    FreeChunks(&chunks1);
+    FreeChunks(&chunks2);
+    lpPtr->ranges[pair] = ranges;
+    lpPtr->nRanges[pair] = nRanges;
+}
+
+/*
+ * Compare one item of line pairs. This is called from a worker thread,
+ * or from the calling thread when running without workers.
+ */
+static void
+LinePairsItem(ClientData clientData, int index, ClientData *workerDataPtr)
+{
+    LinePairs_T *lpPtr = (LinePairs_T *) clientData;
+    int pair, last;
+
+    last = (index + 1) * PAIRS_PER_ITEM;
+    if (last > lpPtr->nPairs) last = lpPtr->nPairs;
+    for (pair = index * PAIRS_PER_ITEM; pair < last; pair++) {
+        LinePairRanges(lpPtr, pair);
+    }
+}
+
+int
+DiffLinePairsObjCmd(ClientData dummy,
+                    Tcl_Interp *interp,
+                    int objc,
+                    Tcl_Obj *CONST objv[])
+{
+    int index, t, i, pair, nThreads = 1, length2, nItems;
+    Tcl_Obj *resPtr, *pairPtr;
+    DiffOptions_T opts;
+    LinePairs_T lp;
+    Parallel_T par;
+
+    static CONST char *options[] = {
+	"-nocase", "-i", "-b", "-w", "-words", "-threads", (char *) NULL
+    };
+    enum options {
+	OPT_NOCASE, OPT_I, OPT_B, OPT_W, OPT_WORDS, OPT_THREADS
+    };
+
+    if (objc < 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?opts? lines1 lines2");
+	return TCL_ERROR;
+    }
+
+    InitDiffOptions_T(opts);
+
+    for (t = 1; t < objc - 2; t++) {
+	if (Tcl_GetIndexFromObj(interp, objv[t], options, "option", 0,
+		&index) != TCL_OK) {
+	    return TCL_ERROR;
+	}
+	switch (index) {
+          case OPT_NOCASE :
+          case OPT_I :
+            opts.ignore |= IGNORE_CASE;
+            break;
+	  case OPT_B:
+            opts.ignore |= IGNORE_SPACE_CHANGE;
+	    break;
+	  case OPT_W:
+            opts.ignore |= IGNORE_ALL_SPACE;
+	    break;
+	  case OPT_WORDS:
+	    opts.wordparse = 1;
+	    break;
+	  case OPT_THREADS:
+	    if (t == objc - 3) {
+		Tcl_SetResult(interp, "missing value", TCL_STATIC);
+		return TCL_ERROR;
+	    }
+	    t++;
+	    if (Tcl_GetIntFromObj(interp, objv[t], &nThreads) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    if (nThreads < 1) {
+		Tcl_SetResult(interp, "bad -threads value", TCL_STATIC);
+		return TCL_ERROR;
+	    }
+	    break;
+	}
+    }
+
+    memset(&lp, 0, sizeof(lp));
+    if (Tcl_ListObjGetElements(interp, objv[objc-2], &lp.nPairs,
+                               &lp.elem1Ptrs) != TCL_OK ||
+        Tcl_ListObjGetElements(interp, objv[objc-1], &length2,
+                               &lp.elem2Ptrs) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (lp.nPairs != length2) {
+        Tcl_SetResult(interp, "the line lists must have the same length",
+                      TCL_STATIC);
+        return TCL_ERROR;
+    }
+    lp.optsPtr = &opts;
+
+    /* Get the strings in the calling thread */
+    lp.str1 = (char **) ckalloc(2 * lp.nPairs * sizeof(char *) + 1);
+    lp.str2 = lp.str1 + lp.nPairs;
+    lp.len1 = (int *) ckalloc(4 * lp.nPairs * sizeof(int) + 1);
+    lp.len2 = lp.len1 + lp.nPairs;
+    lp.nRanges = lp.len2 + lp.nPairs;
+    lp.ranges = (int **) ckalloc(lp.nPairs * sizeof(int *) + 1);
+    for (pair = 0; pair < lp.nPairs; pair++) {
+        lp.str1[pair] = Tcl_GetStringFromObj(lp.elem1Ptrs[pair],
+                                             &lp.len1[pair]);
+        lp.str2[pair] = Tcl_GetStringFromObj(lp.elem2Ptrs[pair],
+                                             &lp.len2[pair]);
+    }
+
+    nItems = (lp.nPairs + PAIRS_PER_ITEM - 1) / PAIRS_PER_ITEM;
+    ParallelStart(&par, nThreads, nItems, LinePairsItem, NULL,
+                  (ClientData) &lp);
+
+    resPtr = Tcl_NewListObj(0, NULL);
+    for (index = 0; index < nItems; index++) {
+        ParallelWait(&par, index);
+        for (pair = index * PAIRS_PER_ITEM;
+             pair < lp.nPairs && pair < (index + 1) * PAIRS_PER_ITEM; pair++) {
+            pairPtr = Tcl_NewListObj(0, NULL);
+            for (i = 0; i < lp.nRanges[pair]; i++) {
+                Tcl_ListObjAppendElement(NULL, pairPtr,
+                                         Tcl_NewIntObj(lp.ranges[pair][i]));
+            }
+            Tcl_ListObjAppendElement(NULL, resPtr, pairPtr);
+            if (lp.ranges[pair] != NULL) {
+                ckfree((char *) lp.ranges[pair]);
+            }
+        }
+    }
+    ParallelFinish(&par);
+
+    ckfree((char *) lp.str1);
+    ckfree((char *) lp.len1);
+    ckfree((char *) lp.ranges);
+    Tcl_SetObjResult(interp, resPtr);
+    return TCL_OK;
+}
@@ -12,122 +12,294 @@
 #undef  TCL_STORAGE_CLASS
 #define TCL_STORAGE_CLASS DLLEXPORT
 
-typedef int (CompareFun) (CONST Tcl_UniChar *,
-                          CONST Tcl_UniChar *,
-                          unsigned long);
-
-/* 'string first' for unicode string */
+/*
+ * A suffix automaton of a string, used to find common substrings.
+ * The transitions are kept in an open hash table keyed on state and
+ * character, and are also linked per state to be able to clone a state.
+ */
+typedef struct {
+    int *len;             /* Length of the longest string of each state */
+    int *link;            /* Suffix link of each state */
+    int *firstPos;        /* End of the first occurrence of each state */
+    int *firstEdge;       /* List of transitions from each state */
+    int *edgeFrom, *edgeTo, *edgeNext;
+    Tcl_UniChar *edgeChar;
+    int *table;           /* Hash table of transitions, -1 if unused */
+    int mask;
+    int nStates, nEdges, last;
+} Sam_T;
+
+#define SAM_HASH(p, c) (((unsigned) (p) * 0x9E3779B1u) ^ \
+                        ((unsigned) (c) * 0x85EBCA77u))
+
+/* Look up a transition, returns the target state or -1. */
 static int
-UniCharFirst(ustring1, length1, ustring2, length2, nocase)
-    Tcl_UniChar *ustring1;
-    int length1;
-    Tcl_UniChar *ustring2;
-    int length2;
-    int nocase;
+SamTrans(samPtr, p, c)
+    Sam_T *samPtr;
+    int p;
+    Tcl_UniChar c;
 {
-    int match;
-    CompareFun *cmp;
-    Tcl_UniChar first1, c2;
+    unsigned h = SAM_HASH(p, c) & samPtr->mask;
+    int e;
 
-    /*
-     * We are searching string2 for the sequence string1.
-     */
-    
-    match = -1;
-    if (length1 < 0)
-	length1 = Tcl_UniCharLen(ustring1);
-    if (length2 < 0)
-	length2 = Tcl_UniCharLen(ustring2);
-
-    if (nocase) {
-        cmp = Tcl_UniCharNcasecmp;
-    } else {
-        cmp = Tcl_UniCharNcmp;
+    while ((e = samPtr->table[h]) != -1) {
+        if (samPtr->edgeFrom[e] == p && samPtr->edgeChar[e] == c) {
+            return samPtr->edgeTo[e];
+        }
+        h = (h + 1) & samPtr->mask;
     }
+    return -1;
+}
 
-    if (length1 > 0) {
-	register Tcl_UniChar *p, *end;
-        if (nocase) {
-            first1 = Tcl_UniCharToLower(*ustring1);
-        } else {
-            first1 = *ustring1;
+/* Add or change a transition */
+static void
+SamSetTrans(samPtr, p, c, q)
+    Sam_T *samPtr;
+    int p;
+    Tcl_UniChar c;
+    int q;
+{
+    unsigned h = SAM_HASH(p, c) & samPtr->mask;
+    int e;
+
+    while ((e = samPtr->table[h]) != -1) {
+        if (samPtr->edgeFrom[e] == p && samPtr->edgeChar[e] == c) {
+            samPtr->edgeTo[e] = q;
+            return;
         }
-	end = ustring2 + length2 - length1 + 1;
-	for (p = ustring2;  p < end;  p++) {
-	    /*
-	     * Scan forward to find the first character.
-	     */
-            if (nocase) {
-                c2 = Tcl_UniCharToLower(*p);
-            } else {
-                c2 = *p;
+        h = (h + 1) & samPtr->mask;
+    }
+    e = samPtr->nEdges++;
+    samPtr->edgeFrom[e] = p;
+    samPtr->edgeChar[e] = c;
+    samPtr->edgeTo[e] = q;
+    samPtr->edgeNext[e] = samPtr->firstEdge[p];
+    samPtr->firstEdge[p] = e;
+    samPtr->table[h] = e;
+}
+
+static int
+SamNewState(samPtr, len, link, firstPos)
+    Sam_T *samPtr;
+    int len, link, firstPos;
+{
+    int s = samPtr->nStates++;
+
+    samPtr->len[s] = len;
+    samPtr->link[s] = link;
+    samPtr->firstPos[s] = firstPos;
+    samPtr->firstEdge[s] = -1;
+    return s;
+}
+
+/* Add the character at position pos to the automaton */
+static void
+SamExtend(samPtr, c, pos)
+    Sam_T *samPtr;
+    Tcl_UniChar c;
+    int pos;
+{
+    int cur, p, q, clone, e;
+
+    cur = SamNewState(samPtr, samPtr->len[samPtr->last] + 1, 0, pos);
+    for (p = samPtr->last; p != -1 && SamTrans(samPtr, p, c) == -1;
+         p = samPtr->link[p]) {
+        SamSetTrans(samPtr, p, c, cur);
+    }
+    if (p != -1) {
+        q = SamTrans(samPtr, p, c);
+        if (samPtr->len[p] + 1 == samPtr->len[q]) {
+            samPtr->link[cur] = q;
+        } else {
+            clone = SamNewState(samPtr, samPtr->len[p] + 1, samPtr->link[q],
+                                samPtr->firstPos[q]);
+            for (e = samPtr->firstEdge[q]; e != -1; e = samPtr->edgeNext[e]) {
+                SamSetTrans(samPtr, clone, samPtr->edgeChar[e],
+                            samPtr->edgeTo[e]);
             }
-	    if ((c2 == first1) &&
-                (cmp(ustring1, p, (unsigned long) length1) == 0)) {
-		match = p - ustring2;
-		break;
-	    }
-	}
+            for (; p != -1 && SamTrans(samPtr, p, c) == q;
+                 p = samPtr->link[p]) {
+                SamSetTrans(samPtr, p, c, clone);
+            }
+            samPtr->link[q] = clone;
+            samPtr->link[cur] = clone;
+        }
     }
+    samPtr->last = cur;
+}
 
-    return match;
+/* Build the suffix automaton of a string */
+static void
+SamBuild(samPtr, str, len)
+    Sam_T *samPtr;
+    Tcl_UniChar *str;
+    int len;
+{
+    int maxStates = 2 * len + 1, maxEdges = 3 * len + 3, size, i;
+
+    for (size = 16; size < 2 * maxEdges; size *= 2);
+    samPtr->len = (int *) ckalloc(4 * maxStates * sizeof(int));
+    samPtr->link = samPtr->len + maxStates;
+    samPtr->firstPos = samPtr->link + maxStates;
+    samPtr->firstEdge = samPtr->firstPos + maxStates;
+    samPtr->edgeFrom = (int *) ckalloc(3 * maxEdges * sizeof(int));
+    samPtr->edgeTo = samPtr->edgeFrom + maxEdges;
+    samPtr->edgeNext = samPtr->edgeTo + maxEdges;
+    samPtr->edgeChar = (Tcl_UniChar *)
+            ckalloc(maxEdges * sizeof(Tcl_UniChar));
+    samPtr->table = (int *) ckalloc(size * sizeof(int));
+    for (i = 0; i < size; i++) {
+        samPtr->table[i] = -1;
+    }
+    samPtr->mask = size - 1;
+    samPtr->nStates = 0;
+    samPtr->nEdges = 0;
+    samPtr->last = SamNewState(samPtr, 0, -1, -1);
+    for (i = 0; i < len; i++) {
+        SamExtend(samPtr, str[i], i);
+    }
+}
+
+static void
+SamFree(samPtr)
+    Sam_T *samPtr;
+{
+    ckfree((char *) samPtr->len);
+    ckfree((char *) samPtr->edgeFrom);
+    ckfree((char *) samPtr->edgeChar);
+    ckfree((char *) samPtr->table);
+}
+
+/*
+ * For each end position e in str1, find the longest string ending there
+ * that is also in str2. Its length is stored in lenPtr[e] and the start
+ * of its first occurrence in str2 in posPtr[e].
+ */
+static void
+MatchStatistics(cmp1, len1, cmp2, len2, lenPtr, posPtr)
+    Tcl_UniChar *cmp1;
+    int len1;
+    Tcl_UniChar *cmp2;
+    int len2;
+    int *lenPtr, *posPtr;
+{
+    Sam_T sam;
+    int e, v, l, next;
+
+    SamBuild(&sam, cmp2, len2);
+    v = 0;
+    l = 0;
+    for (e = 0; e < len1; e++) {
+        while (v != 0 && SamTrans(&sam, v, cmp1[e]) == -1) {
+            v = sam.link[v];
+            l = sam.len[v];
+        }
+        next = SamTrans(&sam, v, cmp1[e]);
+        if (next != -1) {
+            v = next;
+            l++;
+        }
+        lenPtr[e] = l;
+        posPtr[e] = l > 0 ? sam.firstPos[v] - l + 1 : 0;
+    }
+    SamFree(&sam);
+}
+
+/*
+ * Make a result element for a part of a string. With a base pointer,
+ * the element is the first and last index of the part instead.
+ */
+static Tcl_Obj *
+NewPart(base, str, len)
+    Tcl_UniChar *base;
+    Tcl_UniChar *str;
+    int len;
+{
+    Tcl_Obj *objv[2];
+
+    if (base == NULL) {
+        return Tcl_NewUnicodeObj(str, len);
+    }
+    objv[0] = Tcl_NewIntObj(str - base);
+    objv[1] = Tcl_NewIntObj(str - base + len - 1);
+    return Tcl_NewListObj(2, objv);
 }
 
 /* Recursively look for common substrings in strings str1 and str2
  * res should point to list object where the result
- * will be appended. */
+ * will be appended.
+ * cmp1 and cmp2 are the strings to compare, which are str1 and str2
+ * possibly folded to lower case.
+ * With base pointers, indices relative to them are returned. */
 static void
-CompareMidString(interp, obj1, obj2, res, wordparse, nocase)
+CompareMidString(interp, str1, cmp1, len1, str2, cmp2, len2, res,
+                 wordparse, base1, base2)
     Tcl_Interp *interp;
-    Tcl_Obj *obj1, *obj2;
+    Tcl_UniChar *str1, *cmp1;
+    int len1;
+    Tcl_UniChar *str2, *cmp2;
+    int len2;
     Tcl_Obj *res;
     int wordparse;
-    int nocase;
+    Tcl_UniChar *base1, *base2;
 {
-    Tcl_UniChar *str1, *str2;
-    int len1, len2, t, u, i, newt, newp1;
+    int t, e, i, newt, newp1;
     int p1, p2, found1 = 0, found2 = 0, foundlen, minlen;
-    Tcl_Obj *apa1, *apa2;
+    int *matchLen, *matchPos;
 
-    str1 = Tcl_GetUnicodeFromObj(obj1, &len1);
-    str2 = Tcl_GetUnicodeFromObj(obj2, &len2);
+    if (len1 == 0 || len2 == 0) {
+	Tcl_ListObjAppendElement(interp, res, NewPart(base1, str1, len1));
+	Tcl_ListObjAppendElement(interp, res, NewPart(base2, str2, len2));
+        return;
+    }
+
+    matchLen = (int *) ckalloc(2 * len1 * sizeof(int));
+    matchPos = matchLen + len1;
+    MatchStatistics(cmp1, len1, cmp2, len2, matchLen, matchPos);
 
     /* Is str1 a substring of str2 ?*/
-    if (len1 < len2) {
-	if ((t = UniCharFirst(str1, len1, str2, len2, nocase)) != -1) {
-	    Tcl_ListObjAppendElement(interp, res, Tcl_NewObj());
-	    Tcl_ListObjAppendElement(interp, res,
-		    Tcl_NewUnicodeObj(str2, t));
-	    Tcl_ListObjAppendElement(interp, res, obj1);
-	    Tcl_ListObjAppendElement(interp, res,
-		    Tcl_NewUnicodeObj(str2 + t, len1));
-	    Tcl_ListObjAppendElement(interp, res, Tcl_NewObj());
-	    Tcl_ListObjAppendElement(interp, res,
-		    Tcl_NewUnicodeObj(str2 + t + len1, -1));
-	    return;
-	}
+    if (len1 < len2 && matchLen[len1 - 1] == len1) {
+        t = matchPos[len1 - 1];
+        ckfree((char *) matchLen);
+        Tcl_ListObjAppendElement(interp, res, NewPart(base1, str1, 0));
+        Tcl_ListObjAppendElement(interp, res, NewPart(base2, str2, t));
+        Tcl_ListObjAppendElement(interp, res, NewPart(base1, str1, len1));
+        Tcl_ListObjAppendElement(interp, res,
+                NewPart(base2, str2 + t, len1));
+        Tcl_ListObjAppendElement(interp, res, NewPart(base1, str1 + len1, 0));
+        Tcl_ListObjAppendElement(interp, res,
+                NewPart(base2, str2 + t + len1, len2 - t - len1));
+        return;
     }
 
     /* Is str2 a substring of str1 ?*/
     if (len2 < len1) {
-	if ((t = UniCharFirst(str2, len2, str1, len1, nocase)) != -1) {
-	    Tcl_ListObjAppendElement(interp, res,
-		    Tcl_NewUnicodeObj(str1, t));
-	    Tcl_ListObjAppendElement(interp, res, Tcl_NewObj());
-	    Tcl_ListObjAppendElement(interp, res,
-		    Tcl_NewUnicodeObj(str1 + t, len2));
-	    Tcl_ListObjAppendElement(interp, res, obj2);
-	    Tcl_ListObjAppendElement(interp, res,
-		    Tcl_NewUnicodeObj(str1 + t + len2, -1));
-	    Tcl_ListObjAppendElement(interp, res, Tcl_NewObj());
-	    return;
-	}
+        for (e = len2 - 1; e < len1; e++) {
+            if (matchLen[e] == len2) break;
+        }
+        if (e < len1) {
+            t = e - len2 + 1;
+            ckfree((char *) matchLen);
+            Tcl_ListObjAppendElement(interp, res,
+                    NewPart(base1, str1, t));
+            Tcl_ListObjAppendElement(interp, res, NewPart(base2, str2, 0));
+            Tcl_ListObjAppendElement(interp, res,
+                    NewPart(base1, str1 + t, len2));
+            Tcl_ListObjAppendElement(interp, res,
+                    NewPart(base2, str2, len2));
+            Tcl_ListObjAppendElement(interp, res,
+                    NewPart(base1, str1 + t + len2, len1 - t - len2));
+            Tcl_ListObjAppendElement(interp, res,
+                    NewPart(base2, str2 + len2, 0));
+            return;
+        }
     }
 
     /* Are they too short to be considered ? */
     if (len1 < 4 || len2 < 4) {
-	Tcl_ListObjAppendElement(interp, res, obj1);
-	Tcl_ListObjAppendElement(interp, res, obj2);
+        ckfree((char *) matchLen);
+	Tcl_ListObjAppendElement(interp, res, NewPart(base1, str1, len1));
+	Tcl_ListObjAppendElement(interp, res, NewPart(base2, str2, len2));
         return;
     }
 
@@ -136,83 +308,72 @@ CompareMidString(interp, obj1, obj2, res, wordparse, nocase)
     foundlen = -1;
     minlen = 2; /* The shortest common substring we detect is 3 chars*/
 
-    for (t = 0, u = minlen; u < len1; t++, u++) {
-        i = UniCharFirst(str1 + t, u - t + 1, str2, len2, nocase);
-        if (i >= 0) {
-            for (p1 = u + 1, p2 = i + minlen + 1; p1 < len1 && p2 < len2;
-		 p1++, p2++) {
-                if (nocase) {
-                    if (Tcl_UniCharToLower(str1[p1]) !=
-                        Tcl_UniCharToLower(str2[p2])) break;
-                } else {
-                    if (str1[p1] != str2[p2]) break;
-                }
-	    }
-            if (wordparse) {
-                newt = t;
-                if ((t > 0 && !Tcl_UniCharIsSpace(str1[t-1])) ||
-			(i > 0 && !Tcl_UniCharIsSpace(str2[i-1]))) {
-                    for (; newt < p1; newt++) {
-                        if (Tcl_UniCharIsSpace(str1[newt])) break;
-                    }
+    /*
+     * Each common string that can not be extended to the right is a
+     * candidate, and the first longest one is used.
+     */
+    for (e = 0; e < len1; e++) {
+        if (matchLen[e] <= minlen ||
+            (e + 1 < len1 && matchLen[e + 1] > matchLen[e])) continue;
+        t = e - matchLen[e] + 1;
+        i = matchPos[e];
+        p1 = e + 1;
+        p2 = i + matchLen[e];
+        if (wordparse) {
+            newt = t;
+            if ((t > 0 && !Tcl_UniCharIsSpace(str1[t-1])) ||
+                    (i > 0 && !Tcl_UniCharIsSpace(str2[i-1]))) {
+                for (; newt < p1; newt++) {
+                    if (Tcl_UniCharIsSpace(str1[newt])) break;
                 }
+            }
 
-                newp1 = p1 - 1;
-                if ((p1 < len1 && !Tcl_UniCharIsSpace(str1[p1])) ||
-			(p2 < len2 && !Tcl_UniCharIsSpace(str2[p2]))) {
-                    for (; newp1 > newt; newp1--) {
-                        if (Tcl_UniCharIsSpace(str1[newp1])) break;
-                    }
-                }
-                newp1++;
-
-                if (newp1 - newt > minlen) {
-                    foundlen = newp1 - newt;
-                    found1 = newt;
-                    found2 = i + newt - t;
-                    minlen = foundlen;
-                    u = t + minlen;
+            newp1 = p1 - 1;
+            if ((p1 < len1 && !Tcl_UniCharIsSpace(str1[p1])) ||
+                    (p2 < len2 && !Tcl_UniCharIsSpace(str2[p2]))) {
+                for (; newp1 > newt; newp1--) {
+                    if (Tcl_UniCharIsSpace(str1[newp1])) break;
                 }
-            } else {
-                foundlen = p1 - t;
-                found1 = t;
-                found2 = i;
+            }
+            newp1++;
+
+            if (newp1 - newt > minlen) {
+                foundlen = newp1 - newt;
+                found1 = newt;
+                found2 = i + newt - t;
                 minlen = foundlen;
-                u = t + minlen;
             }
+        } else {
+            foundlen = p1 - t;
+            found1 = t;
+            found2 = i;
+            minlen = foundlen;
         }
     }
+    ckfree((char *) matchLen);
 
     if (foundlen < 0) {
-      /* No common string found */
-	Tcl_ListObjAppendElement(interp, res, obj1);
-	Tcl_ListObjAppendElement(interp, res, obj2);
+        /* No common string found */
+	Tcl_ListObjAppendElement(interp, res, NewPart(base1, str1, len1));
+	Tcl_ListObjAppendElement(interp, res, NewPart(base2, str2, len2));
         return;
     }
 
     /* Handle left part, recursively */
-    apa1 = Tcl_NewUnicodeObj(str1, found1);
-    apa2 = Tcl_NewUnicodeObj(str2, found2);
-    Tcl_IncrRefCount(apa1);
-    Tcl_IncrRefCount(apa2);
-    CompareMidString(interp, apa1, apa2, res, wordparse, nocase);
-    Tcl_DecrRefCount(apa1);
-    Tcl_DecrRefCount(apa2);
+    CompareMidString(interp, str1, cmp1, found1, str2, cmp2, found2, res,
+                     wordparse, base1, base2);
 
     /* Handle middle (common) part*/
     Tcl_ListObjAppendElement(interp, res,
-	    Tcl_NewUnicodeObj(str1 + found1, foundlen));
+	    NewPart(base1, str1 + found1, foundlen));
     Tcl_ListObjAppendElement(interp, res,
-	    Tcl_NewUnicodeObj(str2 + found2, foundlen));
-    
+	    NewPart(base2, str2 + found2, foundlen));
+
     /* Handle right part, recursively*/
-    apa1 = Tcl_NewUnicodeObj(str1 + found1 + foundlen, -1);
-    apa2 = Tcl_NewUnicodeObj(str2 + found2 + foundlen, -1);
-    Tcl_IncrRefCount(apa1);
-    Tcl_IncrRefCount(apa2);
-    CompareMidString(interp, apa1, apa2, res, wordparse, nocase);
-    Tcl_DecrRefCount(apa1);
-    Tcl_DecrRefCount(apa2);
+    t = found1 + foundlen;
+    i = found2 + foundlen;
+    CompareMidString(interp, str1 + t, cmp1 + t, len1 - t,
+                     str2 + i, cmp2 + i, len2 - i, res, wordparse, base1, base2);
 }
 
 int
@@ -223,20 +384,25 @@ DiffStringsObjCmd(dummy, interp, objc, objv)
     Tcl_Obj *CONST objv[];	/* Argument objects. */
 {
     int index, t, result = TCL_OK;
-    int nocase = 0;
+    int nocase = 0, indices = 0;
     int ignore = 0, wordparse = 0;
     int len1, len2;
     Tcl_UniChar *line1, *line2, *s1, *s2, *e1, *e2;
     /*char *line1, *line2, *s1, *s2, *e1, *e2, *prev, *prev2;*/
-    Tcl_UniChar *word1, *word2;
+    Tcl_UniChar *word1, *word2, *base1, *base2;
     int wordflag;
-    Tcl_Obj *res, *mid1, *mid2;
+    Tcl_UniChar *cmp1, *cmp2;
+    Tcl_Obj *res;
+    Tcl_DString key;
     static CONST char *options[] = {
-	"-nocase", "-i", "-b", "-w", "-words", (char *) NULL
+	"-nocase", "-i", "-b", "-w", "-words", "-result", (char *) NULL
     };
     enum options {
-	OPT_NOCASE, OPT_I, OPT_B, OPT_W, OPT_WORDS
+	OPT_NOCASE, OPT_I, OPT_B, OPT_W, OPT_WORDS, OPT_RESULT
     };	  
+    static CONST char *resultOptions[] = {
+	"strings", "indices", (char *) NULL
+    };
 
     if (objc < 3) {
         Tcl_WrongNumArgs(interp, 1, objv, "?opts? line1 line2");
@@ -262,11 +428,35 @@ DiffStringsObjCmd(dummy, interp, objc, objv)
 	  case OPT_WORDS:
 	    wordparse = 1;
 	    break;
+	  case OPT_RESULT:
+	    t++;
+	    if (t >= objc - 2) {
+		Tcl_WrongNumArgs(interp, 1, objv, "?opts? line1 line2");
+		return TCL_ERROR;
+	    }
+	    if (Tcl_GetIndexFromObj(interp, objv[t], resultOptions,
+		    "result style", 0, &indices) != TCL_OK) {
+		return TCL_ERROR;
+	    }
+	    break;
 	}
     }
 
+    res = StringCacheLookup(interp, "diffStrings", objc - 1, objv + 1, &key);
+    if (res != NULL) {
+	Tcl_DStringFree(&key);
+	Tcl_SetObjResult(interp, res);
+	return TCL_OK;
+    }
+
     line1 = Tcl_GetUnicodeFromObj(objv[objc-2], &len1);
     line2 = Tcl_GetUnicodeFromObj(objv[objc-1], &len2);
+    if (indices) {
+	base1 = line1;
+	base2 = line2;
+    } else {
+	base1 = base2 = NULL;
+    }
     
     s1 = line1;
     s2 = line2;
@@ -348,30 +538,47 @@ DiffStringsObjCmd(dummy, interp, objc, objv)
     if (e1 == s1 && e2 == s2) {
 	/* Entire line was equal */
 	Tcl_ListObjAppendElement(interp, res,
-		Tcl_NewUnicodeObj(line1, len1));
+		NewPart(base1, line1, len1));
 	Tcl_ListObjAppendElement(interp, res,
-		Tcl_NewUnicodeObj(line2, len2));
+		NewPart(base2, line2, len2));
     } else {
 	/* Cut out the first equal part */
 	Tcl_ListObjAppendElement(interp, res,
-		Tcl_NewUnicodeObj(line1, s1-line1));
+		NewPart(base1, line1, s1-line1));
 	Tcl_ListObjAppendElement(interp, res,
-		Tcl_NewUnicodeObj(line2, s2-line2));
+		NewPart(base2, line2, s2-line2));
     }
 
     if (e1 > s1 || e2 > s2) {
-	mid1 = Tcl_NewUnicodeObj(s1, e1 - s1);
-	mid2 = Tcl_NewUnicodeObj(s2, e2 - s2);
-	Tcl_IncrRefCount(mid1);
-	Tcl_IncrRefCount(mid2);
-	CompareMidString(interp, mid1, mid2, res, wordparse, nocase);
-	Tcl_DecrRefCount(mid1);
-	Tcl_DecrRefCount(mid2);
-
-	Tcl_ListObjAppendElement(interp, res, Tcl_NewUnicodeObj(e1, -1));
-	Tcl_ListObjAppendElement(interp, res, Tcl_NewUnicodeObj(e2, -1));
+	if (nocase) {
+	    /* Compare lower case copies */
+	    cmp1 = (Tcl_UniChar *) ckalloc(((e1 - s1) + (e2 - s2) + 1) *
+		    sizeof(Tcl_UniChar));
+	    cmp2 = cmp1 + (e1 - s1);
+	    for (t = 0; t < e1 - s1; t++) {
+		cmp1[t] = Tcl_UniCharToLower(s1[t]);
+	    }
+	    for (t = 0; t < e2 - s2; t++) {
+		cmp2[t] = Tcl_UniCharToLower(s2[t]);
+	    }
+	} else {
+	    cmp1 = s1;
+	    cmp2 = s2;
+	}
+	CompareMidString(interp, s1, cmp1, e1 - s1, s2, cmp2, e2 - s2, res,
+		wordparse, base1, base2);
+	if (nocase) {
+	    ckfree((char *) cmp1);
+	}
+
+	Tcl_ListObjAppendElement(interp, res,
+		NewPart(base1, e1, line1 + len1 - e1));
+	Tcl_ListObjAppendElement(interp, res,
+		NewPart(base2, e2, line2 + len2 - e2));
     }
 
+    StringCacheStore(interp, &key, res);
+    Tcl_DStringFree(&key);
     Tcl_SetObjResult(interp, res);
     Tcl_DecrRefCount(res);
     return result;
@@ -394,12 +601,22 @@ Diffutil_Init(Tcl_Interp *interp)
 	return TCL_ERROR;
     }
 
+    TCOC("DiffUtil::compareDirs", CompareDirsObjCmd);
     TCOC("DiffUtil::compareFiles", CompareFilesObjCmd);
     TCOC("DiffUtil::compareStreams", CompareStreamsObjCmd);
     TCOC("DiffUtil::diffFiles", DiffFilesObjCmd);
+    TCOC("DiffUtil::diffFilesAsync", DiffFilesAsyncObjCmd);
+    TCOC("DiffUtil::diffFileSet", DiffFileSetObjCmd);
+    TCOC("DiffUtil::diffLinePairs", DiffLinePairsObjCmd);
     TCOC("DiffUtil::diffLists", DiffListsObjCmd);
+    TCOC("DiffUtil::diffStreams", DiffStreamsObjCmd);
+    TCOC("DiffUtil::diffText", DiffTextObjCmd);
     TCOC("DiffUtil::diffStrings", DiffStringsObjCmd);
     TCOC("DiffUtil::diffStrings2", DiffStrings2ObjCmd);
+    TCOC("DiffUtil::fileCache", FileCacheObjCmd);
+    TCOC("DiffUtil::prepare", PrepareObjCmd);
+    TCOC("DiffUtil::session", SessionObjCmd);
+    TCOC("DiffUtil::stringCache", StringCacheObjCmd);
     Tcl_SetVar(interp, "DiffUtil::version", PACKAGE_VERSION, TCL_GLOBAL_ONLY);
     Tcl_SetVar(interp, "DiffUtil::implementation", "c", TCL_GLOBAL_ONLY);
 
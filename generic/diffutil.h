@@ -17,9 +17,16 @@ typedef unsigned long Line_T;
 
 /* A type for selecting result style of diff functions */
 typedef enum {
-    Result_Diff, Result_Match
+    Result_Diff, Result_Match, Result_Indices
 } Result_T;
 
+/* How lines are matched */
+typedef enum {
+    Mode_Lcs,         /* Longest common subsequence, the default */
+    Mode_Sorted,      /* Merge of sorted input, see -sorted */
+    Mode_Unordered    /* Hash join regardless of order, see -unordered */
+} DiffMode_T;
+
 /* Hold all options for diffing in a common struct */
 #define STATIC_ALIGN 10
 typedef struct {
@@ -107,11 +114,176 @@ typedef struct {
     int    forbidden; /* True if this element cannot match initially. */
 } P_T;
 
+/*
+ * A type to keep the lines of a file in memory.
+ * All line data is kept in one buffer, each line terminated by a NUL.
+ * Line i, counting from 1, starts at data + start[i] and its length
+ * is start[i+1] - start[i] - 1.
+ * This does not involve any Tcl_Obj and can be filled and used by
+ * any thread.
+ */
+typedef struct {
+    char *data;
+    unsigned long used, alloced;
+    unsigned long *start;
+    Line_T n, allocedLines;
+} LineStore_T;
+
+#define LineStoreLine(storePtr, i) ((storePtr)->data + (storePtr)->start[i])
+#define LineStoreLength(storePtr, i) \
+    ((int) ((storePtr)->start[(i) + 1] - (storePtr)->start[i] - 1))
+
+/* Options for comparing files */
+typedef struct {
+    int ignoreKey;
+    int noCase;
+    int binary;
+    const char *encoding;     /* Channel options, or NULL */
+    const char *translation;
+    int threads;              /* Threads for comparing large files */
+    const DiffOptions_T *lineOptsPtr; /* Compare line by line, or NULL */
+} CmpOptions_T;
+
+/* Helper to get a filled in CmpOptions_T */
+#define InitCmpOptions_T(opts) {opts.ignoreKey = 0; opts.noCase = 0; opts.binary = 0; opts.encoding = NULL; opts.translation = NULL; opts.threads = 1; opts.lineOptsPtr = NULL;}
+
+/* A file or list prepared for diffing, see prepare.c */
+typedef struct {
+    Tcl_Command token;        /* The handle's command */
+    int isList;               /* Prepared for diffLists */
+    LineStore_T store;        /* All lines, or list elements */
+    Hash_T *hashes;           /* Hash and real hash for lines 1 to n,
+                               * at index 2*i and 2*i+1 */
+    V_T *V;                   /* Sorted V vector */
+    E_T *E;                   /* E vector built from V */
+    Tcl_Obj *optionsPtr;      /* Options that affect the hashes */
+} Prepared_T;
+
+/* A cached file, see filecache.c */
+typedef struct {
+    Tcl_WideUInt size;        /* File status when cached */
+    Tcl_WideInt mtime;
+    Tcl_WideUInt device, inode;
+    Line_T n;                 /* Number of lines */
+    Hash_T *hashes;           /* Hash and real hash for lines 1 to n,
+                               * at index 2*i and 2*i+1, or NULL */
+    Tcl_WideUInt fingerprint; /* Hash of the raw contents */
+    Tcl_WideInt *offsets;     /* Line index, where every LINE_INDEX_STEP
+                               * line starts, or NULL */
+    Line_T nOffsets, allocedOffsets;
+} FileCacheEntry_T;
+
+/* How far apart lines are in the line index of a cached file */
+#define LINE_INDEX_STEP 1024
+
+/* What ends a line when scanning raw bytes for lines */
+#define LINE_END_LF   0       /* \n */
+#define LINE_END_CR   1       /* \r */
+#define LINE_END_CRLF 2       /* \r\n */
+#define LINE_END_AUTO 3       /* Any of \n, \r and \r\n */
+
+/* What a cache lookup saw, to be used when storing */
+typedef struct {
+    char *key;
+    Tcl_WideUInt size;
+    Tcl_WideInt mtime;
+    Tcl_WideUInt device, inode;
+} FileCacheKey_T;
+
+/* A diff result being built from matches found in order, see diff.c */
+typedef struct {
+    Tcl_Obj *resPtr;
+    Tcl_Obj *leftPtr, *rightPtr;      /* For the match style */
+    Line_T startBlock1, startBlock2;  /* For the diff style */
+} ResultBuilder_T;
+
+/*
+ * One side of an unordered diff, see unordered.c.
+ * All arrays are indexed by line number, counting from 1.
+ */
+typedef struct {
+    Line_T n;
+    const char **strings;     /* The lines, with regsub applied */
+    int *lengths;
+    Hash_T *hashes;
+    Line_T *match;            /* Matching line on the other side, or 0 */
+    Line_T *count;            /* Number of unmatched copies of a line,
+                               * kept at the first of them, or 0 */
+    Tcl_Obj **objs;           /* Objects holding the strings, or NULL */
+} Unordered_T;
+
+/* Result styles for comparing files */
+#define CMP_RESULT_BOOL   0
+#define CMP_RESULT_OFFSET 1
+#define CMP_RESULT_LINE   2
+
+/* Where the first difference was found when comparing files */
+typedef struct {
+    int style;                /* What to keep track of, CMP_RESULT_* */
+    Tcl_WideUInt offset;      /* Characters, or bytes in binary mode */
+    Tcl_WideUInt line;        /* Line, counting from 1 */
+    Tcl_WideUInt column;      /* Column, counting from 0 */
+} CmpPosition_T;
+
+/* Helper to get a filled in CmpPosition_T */
+#define InitCmpPosition_T(pos, style_) {pos.style = (style_); pos.offset = 0; pos.line = 1; pos.column = 0;}
+
+/*
+ * A pool of worker threads, see parallel.c
+ */
+typedef void (ParallelProc)(ClientData clientData, int index,
+                            ClientData *workerDataPtr);
+typedef void (ParallelCleanupProc)(ClientData clientData,
+                                   ClientData workerData);
+
+typedef struct {
+    ParallelProc *proc;
+    ParallelCleanupProc *cleanupProc;
+    ClientData clientData;
+    int count;                /* Number of items */
+    int next;                 /* Next item to start */
+    int stop;                 /* Set when aborted */
+    char *done;               /* Flag per item */
+    int nThreads;
+    Tcl_ThreadId *threads;
+    ClientData localData;     /* Worker data when run without threads */
+    Tcl_Mutex mutex;
+    Tcl_Condition cond;
+} Parallel_T;
+
+/* Options for how to read files */
+typedef struct {
+    Tcl_Obj *encodingPtr;
+    Tcl_Obj *translationPtr;
+    int     gzip;
+    Tcl_Obj *lines1Ptr;
+    Tcl_Obj *lines2Ptr;
+} FileOptions_T;
+
+/* Helper to get a filled in FileOptions_T */
+#define InitFileOptions_T(opts) {opts.encodingPtr = NULL; opts.translationPtr = NULL; opts.gzip = 0; opts.lines1Ptr = NULL; opts.lines2Ptr = NULL;}
+
+/*
+ * Options in a form that can be passed to another thread.
+ * Tcl_Obj:s are kept as strings, and SharedOptionsGet gives a
+ * DiffOptions_T with objects owned by the calling thread.
+ */
+typedef struct {
+    DiffOptions_T opts;          /* Without regsub objects */
+    char *regsubLeft;            /* Regsub lists, as strings */
+    char *regsubRight;
+    char *encoding;
+    char *translation;
+    int gzip;
+} SharedOptions_T;
+
 
 extern void      AppendChunk(Tcl_Interp *interp, Tcl_Obj *listPtr,
 			DiffOptions_T const *optsPtr,
                         Line_T start1, Line_T n1,
 			Line_T start2, Line_T n2);
+extern Tcl_Obj * ApplyRegsub(Tcl_Obj *objPtr,
+                        const DiffOptions_T *optsPtr, int left);
 extern Line_T    BSearchVVector(const V_T *V, Line_T n, Hash_T h,
                         const DiffOptions_T *optsPtr);
 extern E_T *     BuildEVector(V_T const *V, Line_T n,
@@ -119,6 +291,12 @@ extern E_T *     BuildEVector(V_T const *V, Line_T n,
 extern Tcl_Obj * BuildResultFromJ(Tcl_Interp *interp,
                         DiffOptions_T const *optsPtr,
 			Line_T m, Line_T n, Line_T const *J);
+extern int       CompareFileNames(Tcl_Interp *interp, Tcl_Obj *file1Ptr,
+                        Tcl_Obj *file2Ptr, CmpOptions_T *cmpOptionsPtr,
+                        CmpPosition_T *posPtr, int *equalPtr);
+extern int       CompareLines(const char *string1, int length1,
+			const char *string2, int length2,
+			DiffOptions_T const *optsPtr);
 extern int       CompareObjects(Tcl_Obj *obj1Ptr, Tcl_Obj *obj2Ptr,
 			DiffOptions_T const *optsPtr);
 extern int       CompareLists(Tcl_Interp *interp,
@@ -126,19 +304,135 @@ extern int       CompareLists(Tcl_Interp *interp,
                               Tcl_Obj *list2Ptr,
                               DiffOptions_T *optsPtr,
                               Tcl_Obj **resPtr);
+extern int       CompareStoreLines(const LineStore_T *store1Ptr, Line_T i,
+                        const LineStore_T *store2Ptr, Line_T j,
+                        const DiffOptions_T *optsPtr);
+extern void      CloseReadChannel(Tcl_Interp *interp, Tcl_Channel ch);
+extern void      CopyDiffOptions(DiffOptions_T *dstPtr,
+			DiffOptions_T const *srcPtr);
+extern char *    CopyString(const char *str);
+extern Line_T *  DiffHashWindow(Tcl_Interp *interp, const Hash_T *hashes1,
+                        Line_T i0, Line_T m, const Hash_T *hashes2,
+                        Line_T j0, Line_T n, const DiffOptions_T *optsPtr);
+extern Line_T *  DiffLineStores(Tcl_Interp *interp, LineStore_T *store1Ptr,
+			LineStore_T *store2Ptr, DiffOptions_T const *optsPtr,
+			Line_T *mPtr, Line_T *nPtr);
+extern Line_T *  DiffPrepared(Tcl_Interp *interp, LineStore_T *store1Ptr,
+                        const Prepared_T *prep1Ptr, LineStore_T *store2Ptr,
+                        const Prepared_T *prep2Ptr,
+                        const DiffOptions_T *optsPtr,
+                        Line_T *mPtr, Line_T *nPtr);
+extern int       FileCacheCompare(Tcl_Interp *interp, Tcl_Obj *file1Ptr,
+                        Tcl_Obj *file2Ptr, int readFiles, int *equalPtr);
+extern int       FileCacheEnabled(Tcl_Interp *interp);
+extern int       FileCacheLineOffset(Tcl_Interp *interp, Tcl_Obj *namePtr,
+                        int lineEnd, Line_T line, Tcl_WideInt *offsetPtr);
+extern FileCacheEntry_T * FileCacheLookup(Tcl_Interp *interp,
+                        Tcl_Obj *namePtr, const char *options,
+                        FileCacheKey_T *keyPtr);
+extern void      FileCacheRelease(FileCacheKey_T *keyPtr);
+extern void      FileCacheStore(Tcl_Interp *interp, FileCacheKey_T *keyPtr,
+                        Line_T n, Hash_T *hashes, Tcl_WideUInt fingerprint);
+extern Tcl_Obj * StringCacheLookup(Tcl_Interp *interp, const char *cmd,
+                        int objc, Tcl_Obj *CONST objv[], Tcl_DString *keyPtr);
+extern void      StringCacheStore(Tcl_Interp *interp, Tcl_DString *keyPtr,
+                        Tcl_Obj *resPtr);
+extern void      FreeDiffFilesOptions(DiffOptions_T *optsPtr,
+			FileOptions_T *fileOptsPtr);
+extern void      FreeLineStore(LineStore_T *storePtr);
+extern void      FreeSharedOptions(SharedOptions_T *sharedPtr);
+extern void      FreeUnordered(Unordered_T *sidePtr);
+extern Prepared_T * GetPrepared(Tcl_Interp *interp, Tcl_Obj *objPtr,
+                        int isList);
 extern void      Hash(Tcl_Obj *objPtr,
                         DiffOptions_T const *optsPtr, int left,
                         Hash_T *result, Hash_T *real);
+extern void      HashLine(const char *string, int length,
+			DiffOptions_T const *optsPtr,
+			Hash_T *result, Hash_T *real);
+extern void      HashStoreLine(const LineStore_T *storePtr, Line_T i,
+                        const DiffOptions_T *optsPtr, int left,
+                        Hash_T *result, Hash_T *real);
+extern void      InitLineStore(LineStore_T *storePtr);
+extern void      InitSharedOptions(SharedOptions_T *sharedPtr,
+                        const DiffOptions_T *optsPtr,
+                        const FileOptions_T *fileOptsPtr);
+extern void      InitUnordered(Unordered_T *sidePtr, Line_T n);
 extern Line_T *  LcsCore(Tcl_Interp *interp, Line_T m, Line_T n, P_T *P,
 			E_T *E, DiffOptions_T const *optsPtr);
+extern void      LineStoreAppend(LineStore_T *storePtr,
+			const char *line, int length);
+extern void      LineStoreHash(const LineStore_T *storePtr,
+                        const DiffOptions_T *optsPtr, int left,
+                        Hash_T *hashes);
+extern char *    LineStorePath(Tcl_Obj *namePtr);
+extern Line_T    LineStoreReadChannel(LineStore_T *storePtr,
+			Tcl_Channel ch, Line_T first, Line_T last);
+extern char *    LineStoreReadFile(LineStore_T *storePtr, const char *path,
+                        const SharedOptions_T *sharedPtr,
+                        Line_T first, Line_T last);
+extern void      LineStoreToList(const LineStore_T *storePtr,
+                        Tcl_Obj *listPtr);
+extern void      LineStoreView(LineStore_T *storePtr, const char *data,
+                        int length);
+extern int       OrderLines(const char *string1, int length1,
+			const char *string2, int length2,
+			DiffOptions_T const *optsPtr);
+extern int       OrderObjects(Tcl_Obj *obj1Ptr, int left1,
+			Tcl_Obj *obj2Ptr, int left2,
+			DiffOptions_T const *optsPtr);
+extern Tcl_Obj * ResultBuilderFinish(Tcl_Interp *interp,
+			DiffOptions_T const *optsPtr,
+			ResultBuilder_T *rbPtr, Line_T m, Line_T n);
+extern void      ResultBuilderInit(Tcl_Interp *interp,
+			DiffOptions_T const *optsPtr, ResultBuilder_T *rbPtr);
+extern void      ResultBuilderMatch(Tcl_Interp *interp,
+			DiffOptions_T const *optsPtr,
+			ResultBuilder_T *rbPtr, Line_T i, Line_T j);
 extern Tcl_Obj * NewChunk(Tcl_Interp *interp, DiffOptions_T const *optsPtr,
 			Line_T start1, Line_T n1, Line_T start2, Line_T n2);
 extern void      NormaliseOpts(DiffOptions_T *optsPtr);
+extern Tcl_Channel OpenReadChannel(Tcl_Interp *interp, Tcl_Obj *namePtr,
+                                  FileOptions_T *fileOptsPtr);
+extern void      ParallelAbort(Parallel_T *parPtr);
+extern int       ParallelDefaultThreads(void);
+extern void      ParallelFinish(Parallel_T *parPtr);
+extern void      ParallelStart(Parallel_T *parPtr, int nThreads, int count,
+                        ParallelProc *proc, ParallelCleanupProc *cleanupProc,
+                        ClientData clientData);
+extern int       ParallelWait(Parallel_T *parPtr, int index);
+extern int       ParseDiffFilesOptions(Tcl_Interp *interp, int objc,
+			Tcl_Obj *CONST objv[], int first, int last,
+			const char *usage, DiffOptions_T *optsPtr,
+			FileOptions_T *fileOptsPtr, Tcl_Obj **linesVarObjPtr,
+			int *threadsPtr, Tcl_Obj **commandPtrPtr,
+			DiffMode_T *modePtr);
+extern int       PreparedDiff(Tcl_Interp *interp, Tcl_Obj *obj1Ptr,
+                        Tcl_Obj *obj2Ptr, Prepared_T *prep1Ptr,
+                        Prepared_T *prep2Ptr, DiffOptions_T *optsPtr,
+                        FileOptions_T *fileOptsPtr, Tcl_Obj **resPtr);
+extern Tcl_Obj * PreparedOptions(const DiffOptions_T *optsPtr,
+                        const FileOptions_T *fileOptsPtr, int left);
+extern Tcl_Channel PushGunzip(Tcl_Interp *interp, Tcl_Channel ch);
+extern void      ResetLineStore(LineStore_T *storePtr);
 extern int       SetOptsRange(Tcl_Interp *interp, Tcl_Obj *rangePtr, int first,
 			DiffOptions_T *optsPtr);
 extern int       SetOptsAlign(Tcl_Interp *interp, Tcl_Obj *alignPtr, int first,
 			DiffOptions_T *optsPtr);
+extern void      SharedOptionsGet(const SharedOptions_T *sharedPtr,
+                        DiffOptions_T *optsPtr);
 extern void      SortV(V_T *V, Line_T n, const DiffOptions_T *optsPtr);
+extern void      UnorderedFromStore(Unordered_T *sidePtr,
+                        const LineStore_T *storePtr,
+                        const DiffOptions_T *optsPtr, int left,
+                        int nThreads);
+extern void      UnorderedHash(Unordered_T *sidePtr,
+                        const DiffOptions_T *optsPtr, int nThreads);
+extern void      UnorderedJoin(Unordered_T *side1Ptr, Unordered_T *side2Ptr,
+                        const DiffOptions_T *optsPtr, int nThreads);
+extern Tcl_Obj * UnorderedResult(const Unordered_T *side1Ptr,
+                        const Unordered_T *side2Ptr,
+                        const DiffOptions_T *optsPtr);
 
 
 extern int
@@ -147,6 +441,11 @@ CompareFilesObjCmd(ClientData dummy,
                 int objc,
                 Tcl_Obj *CONST objv[]);
 extern int
+CompareDirsObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+extern int
 CompareStreamsObjCmd(ClientData dummy,
                 Tcl_Interp *interp,
                 int objc,
@@ -158,6 +457,54 @@ DiffFilesObjCmd(ClientData dummy,
                 int objc,
                 Tcl_Obj *CONST objv[]);
 
+extern int
+DiffStreamsObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+
+extern int
+DiffTextObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+
+extern int
+DiffFilesAsyncObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+
+extern int
+DiffFileSetObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+
+extern int
+FileCacheObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+
+extern int
+StringCacheObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+
+extern int
+PrepareObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+
+extern int
+SessionObjCmd(ClientData dummy,
+                Tcl_Interp *interp,
+                int objc,
+                Tcl_Obj *CONST objv[]);
+
 extern int
 DiffListsObjCmd(ClientData dummy,
                 Tcl_Interp *interp,
@@ -175,3 +522,9 @@ DiffStrings2ObjCmd(ClientData dummy,
                    Tcl_Interp *interp,
                    int objc,
                    Tcl_Obj *CONST objv[]);
+
+extern int
+DiffLinePairsObjCmd(ClientData dummy,
+                    Tcl_Interp *interp,
+                    int objc,
+                    Tcl_Obj *CONST objv[]);
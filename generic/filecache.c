@@ -0,0 +1,617 @@
+/***********************************************************************
+ *
+ * This file implements a per-interpreter cache of file contents in
+ * hashed form, used by diffFiles and compareFiles to avoid reading
+ * and hashing unchanged files again.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "diffutil.h"
+
+#define FILE_CACHE_ASSOC "DiffUtilFileCache"
+#define FINGERPRINT_BLOCK 65536
+#define FINGERPRINT_START (((Tcl_WideUInt) 0xcbf29ce4 << 32) | 0x84222325)
+
+typedef struct {
+    int enabled;
+    Tcl_WideInt hits, misses;
+    Tcl_HashTable table;        /* Key is "options\npath" */
+} FileCache_T;
+
+static void
+ClearFileCache(FileCache_T *cachePtr)
+{
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    FileCacheEntry_T *entryPtr;
+
+    for (hPtr = Tcl_FirstHashEntry(&cachePtr->table, &search);
+         hPtr != NULL; hPtr = Tcl_NextHashEntry(&search)) {
+        entryPtr = (FileCacheEntry_T *) Tcl_GetHashValue(hPtr);
+        if (entryPtr->hashes != NULL) ckfree((char *) entryPtr->hashes);
+        if (entryPtr->offsets != NULL) ckfree((char *) entryPtr->offsets);
+        ckfree((char *) entryPtr);
+    }
+    Tcl_DeleteHashTable(&cachePtr->table);
+    Tcl_InitHashTable(&cachePtr->table, TCL_STRING_KEYS);
+    cachePtr->hits = cachePtr->misses = 0;
+}
+
+static void
+DeleteFileCache(ClientData clientData, Tcl_Interp *interp)
+{
+    FileCache_T *cachePtr = (FileCache_T *) clientData;
+
+    ClearFileCache(cachePtr);
+    Tcl_DeleteHashTable(&cachePtr->table);
+    ckfree((char *) cachePtr);
+}
+
+static FileCache_T *
+GetFileCache(Tcl_Interp *interp)
+{
+    FileCache_T *cachePtr;
+
+    cachePtr = (FileCache_T *) Tcl_GetAssocData(interp, FILE_CACHE_ASSOC,
+                                                NULL);
+    if (cachePtr == NULL) {
+        cachePtr = (FileCache_T *) ckalloc(sizeof(FileCache_T));
+        cachePtr->enabled = 0;
+        cachePtr->hits = cachePtr->misses = 0;
+        Tcl_InitHashTable(&cachePtr->table, TCL_STRING_KEYS);
+        Tcl_SetAssocData(interp, FILE_CACHE_ASSOC, DeleteFileCache,
+                         (ClientData) cachePtr);
+    }
+    return cachePtr;
+}
+
+/*
+ * Is the cache in use for this interpreter?
+ */
+int
+FileCacheEnabled(Tcl_Interp *interp)
+{
+    FileCache_T *cachePtr;
+
+    cachePtr = (FileCache_T *) Tcl_GetAssocData(interp, FILE_CACHE_ASSOC,
+                                                NULL);
+    return cachePtr != NULL && cachePtr->enabled;
+}
+
+/*
+ * Look up a file in the cache. The options string tells what kind of
+ * data is wanted, and must cover everything that affects it.
+ * An entry is only valid if the file's size, modification time and
+ * inode are unchanged.  The key is filled in to be used for a
+ * following FileCacheStore, and must be released with
+ * FileCacheRelease.  Returns NULL on a miss.
+ */
+FileCacheEntry_T *
+FileCacheLookup(
+    Tcl_Interp *interp,
+    Tcl_Obj *namePtr,
+    const char *options,
+    FileCacheKey_T *keyPtr)
+{
+    FileCache_T *cachePtr;
+    Tcl_Obj *normPtr;
+    Tcl_StatBuf *statBuf;
+    Tcl_HashEntry *hPtr;
+    FileCacheEntry_T *entryPtr;
+    const char *path;
+    Tcl_Time now;
+
+    keyPtr->key = NULL;
+    if (!FileCacheEnabled(interp)) {
+        return NULL;
+    }
+    cachePtr = GetFileCache(interp);
+    normPtr = Tcl_FSGetNormalizedPath(interp, namePtr);
+    statBuf = Tcl_AllocStatBuf();
+    if (normPtr == NULL || Tcl_FSStat(namePtr, statBuf) != 0) {
+        ckfree((char *) statBuf);
+        return NULL;
+    }
+    keyPtr->size   = Tcl_GetSizeFromStat(statBuf);
+    keyPtr->mtime  = Tcl_GetModificationTimeFromStat(statBuf);
+    /* The Tcl_GetFS*FromStat accessors truncate to unsigned int */
+    keyPtr->device = (Tcl_WideUInt) statBuf->st_dev;
+    keyPtr->inode  = (Tcl_WideUInt) statBuf->st_ino;
+    ckfree((char *) statBuf);
+
+    /*
+     * The mtime only has a resolution of seconds, so a file modified
+     * within the last second may change again without the status
+     * showing it. Such a file is neither looked up nor stored.
+     */
+    Tcl_GetTime(&now);
+    if (keyPtr->mtime >= (Tcl_WideInt) now.sec - 1) {
+        cachePtr->misses++;
+        return NULL;
+    }
+
+    path = Tcl_GetString(normPtr);
+    keyPtr->key = ckalloc(strlen(options) + strlen(path) + 2);
+    sprintf(keyPtr->key, "%s\n%s", options, path);
+
+    hPtr = Tcl_FindHashEntry(&cachePtr->table, keyPtr->key);
+    if (hPtr != NULL) {
+        entryPtr = (FileCacheEntry_T *) Tcl_GetHashValue(hPtr);
+        if (entryPtr->size == keyPtr->size &&
+                entryPtr->mtime == keyPtr->mtime &&
+                entryPtr->device == keyPtr->device &&
+                entryPtr->inode == keyPtr->inode) {
+            cachePtr->hits++;
+            return entryPtr;
+        }
+    }
+    cachePtr->misses++;
+    return NULL;
+}
+
+/*
+ * Store data for a file that was looked up and missed.  The file
+ * status is the one seen by the lookup, before the file was read,
+ * so a file changed while reading will not get a valid entry.
+ * Ownership of the hashes is passed to the cache.
+ */
+static FileCacheEntry_T *
+StoreEntry(
+    Tcl_Interp *interp,
+    FileCacheKey_T *keyPtr,
+    Line_T n,
+    Hash_T *hashes,
+    Tcl_WideUInt fingerprint)
+{
+    FileCache_T *cachePtr;
+    Tcl_HashEntry *hPtr;
+    FileCacheEntry_T *entryPtr;
+    int isNew;
+
+    if (keyPtr->key == NULL || !FileCacheEnabled(interp)) {
+        if (hashes != NULL) ckfree((char *) hashes);
+        return NULL;
+    }
+    cachePtr = GetFileCache(interp);
+    hPtr = Tcl_CreateHashEntry(&cachePtr->table, keyPtr->key, &isNew);
+    if (isNew) {
+        entryPtr = (FileCacheEntry_T *) ckalloc(sizeof(FileCacheEntry_T));
+        Tcl_SetHashValue(hPtr, (ClientData) entryPtr);
+    } else {
+        entryPtr = (FileCacheEntry_T *) Tcl_GetHashValue(hPtr);
+        if (entryPtr->hashes != NULL) ckfree((char *) entryPtr->hashes);
+        if (entryPtr->offsets != NULL) ckfree((char *) entryPtr->offsets);
+    }
+    entryPtr->offsets = NULL;
+    entryPtr->nOffsets = entryPtr->allocedOffsets = 0;
+    entryPtr->size   = keyPtr->size;
+    entryPtr->mtime  = keyPtr->mtime;
+    entryPtr->device = keyPtr->device;
+    entryPtr->inode  = keyPtr->inode;
+    entryPtr->n      = n;
+    entryPtr->hashes = hashes;
+    entryPtr->fingerprint = fingerprint;
+    return entryPtr;
+}
+
+void
+FileCacheStore(
+    Tcl_Interp *interp,
+    FileCacheKey_T *keyPtr,
+    Line_T n,
+    Hash_T *hashes,
+    Tcl_WideUInt fingerprint)
+{
+    StoreEntry(interp, keyPtr, n, hashes, fingerprint);
+}
+
+void
+FileCacheRelease(FileCacheKey_T *keyPtr)
+{
+    if (keyPtr->key != NULL) {
+        ckfree(keyPtr->key);
+        keyPtr->key = NULL;
+    }
+}
+
+/*
+ * Add bytes to a fingerprint of raw contents, a 64 bit FNV-1a hash.
+ */
+static Tcl_WideUInt
+FingerprintBytes(Tcl_WideUInt h, const unsigned char *buf, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        h ^= buf[i];
+        h *= ((Tcl_WideUInt) 1 << 40) + 0x1b3;
+    }
+    return h;
+}
+
+/*
+ * Compare two files in binary using fingerprints of their raw contents.
+ * Equal fingerprints do not prove equal files, but different ones prove
+ * different files.
+ *
+ * If both fingerprints are cached, different ones settle it. Otherwise,
+ * with readFiles set, the files are compared block by block while their
+ * fingerprints are made, and they are stored if both files are read to
+ * the end. A difference stops the reading, so this is never slower than
+ * a plain comparison apart from the hashing.
+ * Returns 1 if *equalPtr was set, or 0 if a normal comparison is needed.
+ */
+int
+FileCacheCompare(
+    Tcl_Interp *interp,
+    Tcl_Obj *file1Ptr,
+    Tcl_Obj *file2Ptr,
+    int readFiles,
+    int *equalPtr)
+{
+    FileCacheKey_T key1, key2;
+    FileCacheEntry_T *entry1Ptr, *entry2Ptr;
+    Tcl_Channel ch1 = NULL, ch2 = NULL;
+    Tcl_WideUInt h1, h2;
+    unsigned char *buf1, *buf2;
+    int read1, read2, decided = 0;
+
+    entry1Ptr = FileCacheLookup(interp, file1Ptr, "fingerprint", &key1);
+    entry2Ptr = FileCacheLookup(interp, file2Ptr, "fingerprint", &key2);
+    if (entry1Ptr != NULL && entry2Ptr != NULL) {
+        if (entry1Ptr->fingerprint != entry2Ptr->fingerprint) {
+            *equalPtr = 0;
+            decided = 1;
+        }
+        goto done;
+    }
+    if (!readFiles) {
+        goto done;
+    }
+
+    ch1 = Tcl_FSOpenFileChannel(NULL, file1Ptr, "r", 0);
+    ch2 = Tcl_FSOpenFileChannel(NULL, file2Ptr, "r", 0);
+    if (ch1 == NULL || ch2 == NULL) {
+        /* Let the normal comparison report it */
+        goto done;
+    }
+    Tcl_SetChannelOption(NULL, ch1, "-translation", "binary");
+    Tcl_SetChannelOption(NULL, ch2, "-translation", "binary");
+    h1 = h2 = FINGERPRINT_START;
+    buf1 = (unsigned char *) ckalloc(FINGERPRINT_BLOCK);
+    buf2 = (unsigned char *) ckalloc(FINGERPRINT_BLOCK);
+    while (1) {
+        read1 = Tcl_Read(ch1, (char *) buf1, FINGERPRINT_BLOCK);
+        read2 = Tcl_Read(ch2, (char *) buf2, FINGERPRINT_BLOCK);
+        if (read1 < 0 || read2 < 0) {
+            break;
+        }
+        if (read1 != read2 || memcmp(buf1, buf2, read1) != 0) {
+            *equalPtr = 0;
+            decided = 1;
+            break;
+        }
+        if (read1 == 0) {
+            /* Both files were read to the end */
+            if (entry1Ptr == NULL) {
+                FileCacheStore(interp, &key1, 0, NULL, h1);
+            }
+            if (entry2Ptr == NULL) {
+                FileCacheStore(interp, &key2, 0, NULL, h2);
+            }
+            *equalPtr = 1;
+            decided = 1;
+            break;
+        }
+        h1 = FingerprintBytes(h1, buf1, read1);
+        h2 = FingerprintBytes(h2, buf2, read2);
+    }
+    ckfree((char *) buf1);
+    ckfree((char *) buf2);
+
+    done:
+    if (ch1 != NULL) Tcl_Close(NULL, ch1);
+    if (ch2 != NULL) Tcl_Close(NULL, ch2);
+    FileCacheRelease(&key1);
+    FileCacheRelease(&key2);
+    return decided;
+}
+
+/*
+ * Scan raw bytes from a channel, positioned at "pos" which is where
+ * "line" starts, to find where line "target" starts.  Line starts found
+ * on the way are added to the line index of the cache entry, if any.
+ * Returns -1 if the file ends before line "target".
+ */
+static Tcl_WideInt
+ScanLines(
+    Tcl_Channel ch,
+    int lineEnd,
+    Tcl_WideInt pos,
+    Line_T line,
+    Line_T target,
+    FileCacheEntry_T *entryPtr)
+{
+    char *buf, *p, *end, *nl, *cr, *q;
+    char prevByte = 0;
+    int n, prevCR = 0, atStart = 1;
+
+    buf = ckalloc(FINGERPRINT_BLOCK);
+    while ((n = Tcl_Read(ch, buf, FINGERPRINT_BLOCK)) > 0) {
+        p = buf;
+        end = buf + n;
+        nl = cr = NULL;
+        while (p < end) {
+            if (prevCR) {
+                /* The \n of a \r\n ends the same line as the \r */
+                prevCR = 0;
+                if (*p == '\n') {
+                    p++;
+                    continue;
+                }
+            }
+            if (atStart) {
+                atStart = 0;
+                if (entryPtr != NULL && (line - 1) % LINE_INDEX_STEP == 0 &&
+                        (line - 1) / LINE_INDEX_STEP == entryPtr->nOffsets) {
+                    if (entryPtr->nOffsets >= entryPtr->allocedOffsets) {
+                        entryPtr->allocedOffsets =
+                                entryPtr->allocedOffsets * 2 + 16;
+                        entryPtr->offsets = (Tcl_WideInt *) ckrealloc(
+                                (char *) entryPtr->offsets,
+                                entryPtr->allocedOffsets * sizeof(Tcl_WideInt));
+                    }
+                    entryPtr->offsets[entryPtr->nOffsets++] = pos + (p - buf);
+                }
+                if (line == target) {
+                    ckfree(buf);
+                    return pos + (p - buf);
+                }
+            }
+            /* Find the end of this line */
+            if (lineEnd == LINE_END_AUTO) {
+                /* Remember each search, to not repeat it for every line */
+                if (nl == NULL || nl < p) {
+                    nl = memchr(p, '\n', end - p);
+                    if (nl == NULL) nl = end;
+                }
+                if (cr == NULL || cr < p) {
+                    cr = memchr(p, '\r', end - p);
+                    if (cr == NULL) cr = end;
+                }
+                q = cr < nl ? cr : nl;
+                if (q == end) q = NULL;
+            } else {
+                q = memchr(p, lineEnd == LINE_END_CR ? '\r' : '\n', end - p);
+            }
+            if (q == NULL) break;
+            p = q + 1;
+            if (lineEnd == LINE_END_CRLF &&
+                    (q > buf ? q[-1] : prevByte) != '\r') {
+                /* A lone \n is part of the line */
+                continue;
+            }
+            if (*q == '\r' && lineEnd == LINE_END_AUTO) {
+                prevCR = 1;
+            }
+            line++;
+            atStart = 1;
+        }
+        prevByte = buf[n - 1];
+        pos += n;
+    }
+    ckfree(buf);
+    return -1;
+}
+
+/*
+ * Find the byte offset where a line starts in a file, when line ends
+ * can be found as plain bytes.  With the cache in use, a line index is
+ * kept for the file, so only the lines after the nearest indexed line
+ * need to be scanned.  Returns TCL_ERROR if the file cannot be scanned
+ * or ends before the line.
+ */
+int
+FileCacheLineOffset(
+    Tcl_Interp *interp,
+    Tcl_Obj *namePtr,
+    int lineEnd,              /* LINE_END_* */
+    Line_T line,
+    Tcl_WideInt *offsetPtr)
+{
+    FileCacheKey_T key;
+    FileCacheEntry_T *entryPtr;
+    Tcl_Channel ch;
+    Tcl_DString ds;
+    Tcl_WideInt pos = 0;
+    Line_T first = 1, k;
+    char options[30];
+
+    ch = Tcl_FSOpenFileChannel(NULL, namePtr, "r", 0);
+    if (ch == NULL) {
+        return TCL_ERROR;
+    }
+    /* An end of file character would stop reading before the real end */
+    Tcl_DStringInit(&ds);
+    Tcl_GetChannelOption(NULL, ch, "-eofchar", &ds);
+    if (strchr(Tcl_DStringValue(&ds), '\x1a') != NULL) {
+        Tcl_DStringFree(&ds);
+        Tcl_Close(NULL, ch);
+        return TCL_ERROR;
+    }
+    Tcl_DStringFree(&ds);
+    Tcl_SetChannelOption(NULL, ch, "-translation", "binary");
+
+    sprintf(options, "lineindex %d", lineEnd);
+    entryPtr = FileCacheLookup(interp, namePtr, options, &key);
+    if (entryPtr == NULL) {
+        /* An empty index, filled in while scanning */
+        entryPtr = StoreEntry(interp, &key, 0, NULL, 0);
+    }
+    FileCacheRelease(&key);
+
+    if (entryPtr != NULL && entryPtr->nOffsets > 0) {
+        /* Start from the nearest indexed line */
+        k = (line - 1) / LINE_INDEX_STEP;
+        if (k >= entryPtr->nOffsets) {
+            k = entryPtr->nOffsets - 1;
+        }
+        first = k * LINE_INDEX_STEP + 1;
+        pos = entryPtr->offsets[k];
+        if (Tcl_Seek(ch, pos, SEEK_SET) < 0) {
+            Tcl_Close(NULL, ch);
+            return TCL_ERROR;
+        }
+    }
+    *offsetPtr = ScanLines(ch, lineEnd, pos, first, line, entryPtr);
+    Tcl_Close(NULL, ch);
+    return *offsetPtr < 0 ? TCL_ERROR : TCL_OK;
+}
+
+/*
+ * DiffUtil::fileCache subcommand ?args?
+ */
+int
+FileCacheObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int index, enabled;
+    FileCache_T *cachePtr;
+    Tcl_Obj *resPtr, *itemPtr;
+    Tcl_HashEntry *hPtr;
+    Tcl_HashSearch search;
+    FileCacheEntry_T *entryPtr;
+    const char *key, *path;
+
+    static CONST char *subCommands[] = {
+        "clear", "enable", "inspect", "stats", (char *) NULL
+    };
+    enum subCommands {
+        SUB_CLEAR, SUB_ENABLE, SUB_INSPECT, SUB_STATS
+    };
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "subcommand ?arg?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], subCommands, "subcommand", 0,
+                            &index) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    cachePtr = GetFileCache(interp);
+
+    switch (index) {
+      case SUB_CLEAR:
+          if (objc != 2) {
+              Tcl_WrongNumArgs(interp, 2, objv, NULL);
+              return TCL_ERROR;
+          }
+          ClearFileCache(cachePtr);
+          break;
+      case SUB_ENABLE:
+          if (objc > 3) {
+              Tcl_WrongNumArgs(interp, 2, objv, "?boolean?");
+              return TCL_ERROR;
+          }
+          if (objc == 3) {
+              if (Tcl_GetBooleanFromObj(interp, objv[2], &enabled)
+                      != TCL_OK) {
+                  return TCL_ERROR;
+              }
+              cachePtr->enabled = enabled;
+              if (!enabled) {
+                  ClearFileCache(cachePtr);
+              }
+          }
+          Tcl_SetObjResult(interp, Tcl_NewBooleanObj(cachePtr->enabled));
+          break;
+      case SUB_INSPECT:
+          if (objc != 2) {
+              Tcl_WrongNumArgs(interp, 2, objv, NULL);
+              return TCL_ERROR;
+          }
+          resPtr = Tcl_NewListObj(0, NULL);
+          for (hPtr = Tcl_FirstHashEntry(&cachePtr->table, &search);
+               hPtr != NULL; hPtr = Tcl_NextHashEntry(&search)) {
+              entryPtr = (FileCacheEntry_T *) Tcl_GetHashValue(hPtr);
+              key = (const char *) Tcl_GetHashKey(&cachePtr->table, hPtr);
+              path = strchr(key, '\n') + 1;
+              itemPtr = Tcl_NewListObj(0, NULL);
+              Tcl_ListObjAppendElement(NULL, itemPtr,
+                      Tcl_NewStringObj("path", -1));
+              Tcl_ListObjAppendElement(NULL, itemPtr,
+                      Tcl_NewStringObj(path, -1));
+              Tcl_ListObjAppendElement(NULL, itemPtr,
+                      Tcl_NewStringObj("options", -1));
+              Tcl_ListObjAppendElement(NULL, itemPtr,
+                      Tcl_NewStringObj(key, path - key - 1));
+              Tcl_ListObjAppendElement(NULL, itemPtr,
+                      Tcl_NewStringObj("size", -1));
+              Tcl_ListObjAppendElement(NULL, itemPtr,
+                      Tcl_NewWideIntObj((Tcl_WideInt) entryPtr->size));
+              Tcl_ListObjAppendElement(NULL, itemPtr,
+                      Tcl_NewStringObj("mtime", -1));
+              Tcl_ListObjAppendElement(NULL, itemPtr,
+                      Tcl_NewWideIntObj(entryPtr->mtime));
+              if (entryPtr->hashes != NULL) {
+                  Tcl_ListObjAppendElement(NULL, itemPtr,
+                          Tcl_NewStringObj("lines", -1));
+                  Tcl_ListObjAppendElement(NULL, itemPtr,
+                          Tcl_NewLongObj((long) entryPtr->n));
+              }
+              if (entryPtr->offsets != NULL) {
+                  Tcl_ListObjAppendElement(NULL, itemPtr,
+                          Tcl_NewStringObj("indexed", -1));
+                  Tcl_ListObjAppendElement(NULL, itemPtr, Tcl_NewLongObj(
+                          (long) ((entryPtr->nOffsets - 1) * LINE_INDEX_STEP
+                                  + 1)));
+              }
+              Tcl_ListObjAppendElement(NULL, resPtr, itemPtr);
+          }
+          Tcl_SetObjResult(interp, resPtr);
+          break;
+      case SUB_STATS:
+          if (objc != 2) {
+              Tcl_WrongNumArgs(interp, 2, objv, NULL);
+              return TCL_ERROR;
+          }
+          resPtr = Tcl_NewListObj(0, NULL);
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("enabled", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewBooleanObj(cachePtr->enabled));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("entries", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewIntObj(cachePtr->table.numEntries));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("hits", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewWideIntObj(cachePtr->hits));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("misses", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewWideIntObj(cachePtr->misses));
+          Tcl_SetObjResult(interp, resPtr);
+          break;
+    }
+    return TCL_OK;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
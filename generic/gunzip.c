@@ -0,0 +1,189 @@
+/***********************************************************************
+ *
+ * This file implements gunzip as a channel transform, done with Tcl's
+ * zlib streams. It is like "zlib push gunzip", but needs no interpreter,
+ * which allows compressed files to be read by any thread.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "diffutil.h"
+
+#ifdef TCL_ZLIB_STREAM_INFLATE
+
+/* How much compressed data to read at a time */
+#define GUNZIP_BUFSIZE 65536
+
+typedef struct {
+    Tcl_Channel parent;       /* The channel below */
+    Tcl_ZlibStream zs;
+    Tcl_Obj *inPtr;           /* Buffers for compressed and */
+    Tcl_Obj *outPtr;          /* decompressed data */
+    int finished;             /* The parent is at end of file */
+} Gunzip_T;
+
+static int
+GunzipClose(ClientData instanceData, Tcl_Interp *interp)
+{
+    Gunzip_T *gzPtr = (Gunzip_T *) instanceData;
+
+    Tcl_ZlibStreamClose(gzPtr->zs);
+    Tcl_DecrRefCount(gzPtr->inPtr);
+    Tcl_DecrRefCount(gzPtr->outPtr);
+    ckfree((char *) gzPtr);
+    return 0;
+}
+
+static int
+GunzipInput(ClientData instanceData, char *buf, int toRead, int *errorCodePtr)
+{
+    Gunzip_T *gzPtr = (Gunzip_T *) instanceData;
+    unsigned char *bytes;
+    int length;
+
+    while (1) {
+        Tcl_SetByteArrayLength(gzPtr->outPtr, 0);
+        if (Tcl_ZlibStreamGet(gzPtr->zs, gzPtr->outPtr, toRead) != TCL_OK) {
+            *errorCodePtr = EINVAL;
+            return -1;
+        }
+        bytes = Tcl_GetByteArrayFromObj(gzPtr->outPtr, &length);
+        if (length > 0) {
+            memcpy(buf, bytes, length);
+            return length;
+        }
+        if (gzPtr->finished || Tcl_ZlibStreamEof(gzPtr->zs)) {
+            return 0;
+        }
+
+        /* Feed more compressed data */
+        bytes = Tcl_SetByteArrayLength(gzPtr->inPtr, GUNZIP_BUFSIZE);
+        length = Tcl_ReadRaw(gzPtr->parent, (char *) bytes, GUNZIP_BUFSIZE);
+        if (length < 0) {
+            *errorCodePtr = Tcl_GetErrno();
+            return -1;
+        }
+        Tcl_SetByteArrayLength(gzPtr->inPtr, length);
+        if (length == 0) {
+            gzPtr->finished = 1;
+        }
+        if (Tcl_ZlibStreamPut(gzPtr->zs, gzPtr->inPtr, gzPtr->finished ?
+                              TCL_ZLIB_FINALIZE : TCL_ZLIB_NO_FLUSH)
+                != TCL_OK) {
+            *errorCodePtr = EINVAL;
+            return -1;
+        }
+    }
+}
+
+static int
+GunzipOutput(ClientData instanceData, const char *buf, int toWrite,
+             int *errorCodePtr)
+{
+    *errorCodePtr = EINVAL;
+    return -1;
+}
+
+static void
+GunzipWatch(ClientData instanceData, int mask)
+{
+    /* Only blocking reads are done, nothing to watch */
+}
+
+static int
+GunzipGetHandle(ClientData instanceData, int direction,
+                ClientData *handlePtr)
+{
+    Gunzip_T *gzPtr = (Gunzip_T *) instanceData;
+
+    return Tcl_GetChannelHandle(gzPtr->parent, direction, handlePtr);
+}
+
+static int
+GunzipBlockMode(ClientData instanceData, int mode)
+{
+    return 0;
+}
+
+static Tcl_ChannelType gunzipChannelType = {
+    "diffutil-gunzip",
+    TCL_CHANNEL_VERSION_5,
+    GunzipClose,
+    GunzipInput,
+    GunzipOutput,
+    NULL,                     /* seekProc */
+    NULL,                     /* setOptionProc */
+    NULL,                     /* getOptionProc */
+    GunzipWatch,
+    GunzipGetHandle,
+    NULL,                     /* close2Proc */
+    GunzipBlockMode,
+    NULL,                     /* flushProc */
+    NULL,                     /* handlerProc */
+    NULL,                     /* wideSeekProc */
+    NULL,                     /* threadActionProc */
+    NULL                      /* truncateProc */
+};
+
+#endif /* TCL_ZLIB_STREAM_INFLATE */
+
+/*
+ * Stack a gunzip transform on a channel opened for reading.
+ * The interpreter is only used for error messages, and may be NULL.
+ *
+ * Returns the new top channel, or NULL on error.
+ */
+Tcl_Channel
+PushGunzip(Tcl_Interp *interp, Tcl_Channel ch)
+{
+#ifdef TCL_ZLIB_STREAM_INFLATE
+    Gunzip_T *gzPtr;
+    Tcl_Channel top;
+
+    gzPtr = (Gunzip_T *) ckalloc(sizeof(Gunzip_T));
+    memset(gzPtr, 0, sizeof(Gunzip_T));
+    /* No interpreter, a stream made with one also gets a command */
+    if (Tcl_ZlibStreamInit(NULL, TCL_ZLIB_STREAM_INFLATE,
+                           TCL_ZLIB_FORMAT_GZIP, 0, NULL, &gzPtr->zs)
+            != TCL_OK) {
+        ckfree((char *) gzPtr);
+        if (interp != NULL) {
+            Tcl_SetResult(interp, "could not set up decompression",
+                          TCL_STATIC);
+        }
+        return NULL;
+    }
+    gzPtr->parent = ch;
+    gzPtr->inPtr = Tcl_NewByteArrayObj(NULL, 0);
+    Tcl_IncrRefCount(gzPtr->inPtr);
+    gzPtr->outPtr = Tcl_NewByteArrayObj(NULL, 0);
+    Tcl_IncrRefCount(gzPtr->outPtr);
+
+    top = Tcl_StackChannel(interp, &gunzipChannelType, (ClientData) gzPtr,
+                           TCL_READABLE, ch);
+    if (top == NULL) {
+        GunzipClose((ClientData) gzPtr, NULL);
+        return NULL;
+    }
+    return top;
+#else
+    if (interp != NULL) {
+        Tcl_SetResult(interp, "-gz needs Tcl 8.6", TCL_STATIC);
+    }
+    return NULL;
+#endif
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,635 @@
+/***********************************************************************
+ *
+ * This file implements keeping lines in memory, and the diff of such
+ * lines.  Nothing here depends on an interpreter, which allows it to
+ * be used from any thread.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "diffutil.h"
+
+void
+InitLineStore(LineStore_T *storePtr)
+{
+    storePtr->alloced = 4096;
+    storePtr->data = ckalloc(storePtr->alloced);
+    storePtr->used = 0;
+    storePtr->allocedLines = 1000;
+    storePtr->start = (unsigned long *)
+            ckalloc(storePtr->allocedLines * sizeof(unsigned long));
+    storePtr->n = 0;
+    /* Line 1 starts at the beginning. Index 0 is not used. */
+    storePtr->start[0] = 0;
+    storePtr->start[1] = 0;
+}
+
+void
+FreeLineStore(LineStore_T *storePtr)
+{
+    /* A view does not own its data */
+    if (storePtr->data != NULL && storePtr->alloced > 0) {
+        ckfree(storePtr->data);
+    }
+    if (storePtr->start != NULL) {
+        ckfree((char *) storePtr->start);
+    }
+    storePtr->data = NULL;
+    storePtr->start = NULL;
+    storePtr->n = 0;
+}
+
+/*
+ * Empty a line store, keeping its buffers for reuse.
+ */
+void
+ResetLineStore(LineStore_T *storePtr)
+{
+    storePtr->used = 0;
+    storePtr->n = 0;
+    storePtr->start[1] = 0;
+}
+
+/*
+ * Make a line store that is a view of lines in a buffer, split at
+ * newlines, without copying them. A final newline does not start a
+ * new line, as when reading a file.
+ * A carriage return before a newline is not part of the line, like with
+ * the default -translation when reading a file. If there is any, the
+ * lines are copied instead.
+ * The buffer must be kept while the store is used, and the store cannot
+ * be appended to. Release it with FreeLineStore.
+ */
+void
+LineStoreView(LineStore_T *storePtr, const char *data, int length)
+{
+    const char *p, *nl, *end = data + length;
+    Line_T n = 0;
+
+    if (memchr(data, '\r', length) != NULL) {
+        InitLineStore(storePtr);
+        for (p = data; p < end; p = nl + 1) {
+            nl = memchr(p, '\n', end - p);
+            if (nl == NULL) {
+                LineStoreAppend(storePtr, p, end - p);
+                break;
+            }
+            LineStoreAppend(storePtr, p,
+                    nl - p - (nl > p && nl[-1] == '\r' ? 1 : 0));
+        }
+        return;
+    }
+
+    for (p = data; p < end; p++) {
+        p = memchr(p, '\n', end - p);
+        if (p == NULL) break;
+        n++;
+    }
+    if (length > 0 && data[length - 1] != '\n') {
+        n++;
+    }
+
+    /* The separating newline takes the place of the terminator */
+    storePtr->data = (char *) data;
+    storePtr->used = length;
+    storePtr->alloced = 0;
+    storePtr->allocedLines = n + 2;
+    storePtr->start = (unsigned long *)
+            ckalloc(storePtr->allocedLines * sizeof(unsigned long));
+    storePtr->start[0] = 0;
+    storePtr->start[1] = 0;
+    storePtr->n = 0;
+    for (p = data; p < end; p++) {
+        p = memchr(p, '\n', end - p);
+        if (p == NULL) break;
+        storePtr->n++;
+        storePtr->start[storePtr->n + 1] = p + 1 - data;
+    }
+    if (storePtr->n < n) {
+        /* The last line has no newline */
+        storePtr->n++;
+        storePtr->start[storePtr->n + 1] = length + 1;
+    }
+}
+
+/*
+ * Add a line at the end of a line store.
+ */
+void
+LineStoreAppend(LineStore_T *storePtr, const char *line, int length)
+{
+    /* Make room for the line, its terminator and the next start. */
+    if (storePtr->used + length + 1 > storePtr->alloced) {
+        while (storePtr->used + length + 1 > storePtr->alloced) {
+            storePtr->alloced = storePtr->alloced * 3 / 2;
+        }
+        storePtr->data = ckrealloc(storePtr->data, storePtr->alloced);
+    }
+    if (storePtr->n + 2 >= storePtr->allocedLines) {
+        storePtr->allocedLines = storePtr->allocedLines * 3 / 2;
+        storePtr->start = (unsigned long *)
+                ckrealloc((char *) storePtr->start,
+                          storePtr->allocedLines * sizeof(unsigned long));
+    }
+    memcpy(storePtr->data + storePtr->used, line, length);
+    storePtr->used += length;
+    storePtr->data[storePtr->used++] = 0;
+    storePtr->n++;
+    storePtr->start[storePtr->n + 1] = storePtr->used;
+}
+
+/*
+ * Read lines from a channel into a line store.
+ * Lines before "first" are only counted, and stored as empty lines.
+ * Reading stops after line "last", unless it is zero.
+ * Returns the number of lines in the store.
+ */
+Line_T
+LineStoreReadChannel(LineStore_T *storePtr, Tcl_Channel ch,
+                     Line_T first, Line_T last)
+{
+    Tcl_DString ds;
+
+    Tcl_DStringInit(&ds);
+    while (last == 0 || storePtr->n < last) {
+        Tcl_DStringSetLength(&ds, 0);
+        if (Tcl_Gets(ch, &ds) < 0) {
+            break;
+        }
+        if (storePtr->n + 1 < first) {
+            /* Ignore the first lines if there is a range set. */
+            LineStoreAppend(storePtr, "", 0);
+        } else {
+            LineStoreAppend(storePtr, Tcl_DStringValue(&ds),
+                            Tcl_DStringLength(&ds));
+        }
+    }
+    Tcl_DStringFree(&ds);
+    return storePtr->n;
+}
+
+/*
+ * Append the lines of a line store to a list.
+ * The objects belong to the calling thread.
+ */
+void
+LineStoreToList(const LineStore_T *storePtr, Tcl_Obj *listPtr)
+{
+    Line_T i;
+
+    for (i = 1; i <= storePtr->n; i++) {
+        Tcl_ListObjAppendElement(NULL, listPtr, Tcl_NewStringObj(
+                LineStoreLine(storePtr, i), LineStoreLength(storePtr, i)));
+    }
+}
+
+/*
+ * Get a ckalloc:ed copy of a string.
+ */
+char *
+CopyString(const char *str)
+{
+    char *copy;
+    if (str == NULL) return NULL;
+    copy = ckalloc(strlen(str) + 1);
+    strcpy(copy, str);
+    return copy;
+}
+
+/*
+ * Get a file name that can be opened from any thread, as a ckalloc:ed
+ * string. Returns NULL if the file must be read by this thread, e.g. if
+ * it lives in a virtual file system.
+ */
+char *
+LineStorePath(Tcl_Obj *namePtr)
+{
+    Tcl_Obj *normPtr;
+
+    if (Tcl_FSGetNativePath(namePtr) == NULL) {
+        return NULL;
+    }
+    normPtr = Tcl_FSGetNormalizedPath(NULL, namePtr);
+    if (normPtr == NULL) {
+        return NULL;
+    }
+    return CopyString(Tcl_GetString(normPtr));
+}
+
+/*
+ * Open and read a file into a line store, without any interpreter.
+ * Returns a ckalloc:ed error message on failure, or NULL.
+ */
+char *
+LineStoreReadFile(LineStore_T *storePtr, const char *path,
+                  const SharedOptions_T *sharedPtr,
+                  Line_T first, Line_T last)
+{
+    Tcl_Channel ch;
+    char *msg;
+
+    ch = Tcl_OpenFileChannel(NULL, path, "r", 0);
+    if (ch == NULL) {
+        const char *err = Tcl_ErrnoMsg(Tcl_GetErrno());
+        msg = ckalloc(strlen(path) + strlen(err) + 30);
+        sprintf(msg, "couldn't open \"%s\": %s", path, err);
+        return msg;
+    }
+    if (sharedPtr->gzip) {
+        Tcl_Channel top = PushGunzip(NULL, ch);
+        if (top == NULL) {
+            Tcl_Close(NULL, ch);
+            return CopyString("could not set up decompression");
+        }
+        ch = top;
+    }
+    if (sharedPtr->translation != NULL) {
+        if (Tcl_SetChannelOption(NULL, ch, "-translation",
+                                 sharedPtr->translation) != TCL_OK) {
+            Tcl_Close(NULL, ch);
+            msg = ckalloc(strlen(sharedPtr->translation) + 40);
+            sprintf(msg, "bad value for -translation: \"%s\"",
+                    sharedPtr->translation);
+            return msg;
+        }
+    }
+    /* Encoding after translation, see OpenReadChannel. */
+    if (sharedPtr->encoding != NULL) {
+        if (Tcl_SetChannelOption(NULL, ch, "-encoding",
+                                 sharedPtr->encoding) != TCL_OK) {
+            Tcl_Close(NULL, ch);
+            msg = ckalloc(strlen(sharedPtr->encoding) + 40);
+            sprintf(msg, "unknown encoding \"%s\"", sharedPtr->encoding);
+            return msg;
+        }
+    }
+    LineStoreReadChannel(storePtr, ch, first, last);
+    if (!Tcl_Eof(ch) && (last == 0 || storePtr->n < last)) {
+        const char *err = Tcl_ErrnoMsg(Tcl_GetErrno());
+        Tcl_Close(NULL, ch);
+        msg = ckalloc(strlen(path) + strlen(err) + 30);
+        sprintf(msg, "error reading \"%s\": %s", path, err);
+        return msg;
+    }
+    Tcl_Close(NULL, ch);
+    return NULL;
+}
+
+/*
+ * Prepare options to be passed to another thread.
+ */
+void
+InitSharedOptions(SharedOptions_T *sharedPtr,
+                  const DiffOptions_T *optsPtr,
+                  const FileOptions_T *fileOptsPtr)
+{
+    memset(sharedPtr, 0, sizeof(SharedOptions_T));
+    CopyDiffOptions(&sharedPtr->opts, optsPtr);
+    sharedPtr->opts.regsubLeftPtr = NULL;
+    sharedPtr->opts.regsubRightPtr = NULL;
+    if (optsPtr->regsubLeftPtr != NULL) {
+        sharedPtr->regsubLeft = CopyString(Tcl_GetString(optsPtr->regsubLeftPtr));
+    }
+    if (optsPtr->regsubRightPtr != NULL) {
+        sharedPtr->regsubRight =
+                CopyString(Tcl_GetString(optsPtr->regsubRightPtr));
+    }
+    if (fileOptsPtr != NULL && fileOptsPtr->encodingPtr != NULL) {
+        sharedPtr->encoding = CopyString(Tcl_GetString(fileOptsPtr->encodingPtr));
+    }
+    if (fileOptsPtr != NULL && fileOptsPtr->translationPtr != NULL) {
+        sharedPtr->translation =
+                CopyString(Tcl_GetString(fileOptsPtr->translationPtr));
+    }
+    if (fileOptsPtr != NULL) {
+        sharedPtr->gzip = fileOptsPtr->gzip;
+    }
+}
+
+void
+FreeSharedOptions(SharedOptions_T *sharedPtr)
+{
+    if (sharedPtr->opts.alignLength > STATIC_ALIGN) {
+        ckfree((char *) sharedPtr->opts.align);
+    }
+    sharedPtr->opts.alignLength = 0;
+    if (sharedPtr->regsubLeft  != NULL) ckfree(sharedPtr->regsubLeft);
+    if (sharedPtr->regsubRight != NULL) ckfree(sharedPtr->regsubRight);
+    if (sharedPtr->encoding    != NULL) ckfree(sharedPtr->encoding);
+    if (sharedPtr->translation != NULL) ckfree(sharedPtr->translation);
+    sharedPtr->regsubLeft = sharedPtr->regsubRight = NULL;
+    sharedPtr->encoding = sharedPtr->translation = NULL;
+}
+
+/*
+ * Get options for use in the current thread.
+ * Release them with FreeDiffFilesOptions(optsPtr, NULL).
+ */
+void
+SharedOptionsGet(const SharedOptions_T *sharedPtr, DiffOptions_T *optsPtr)
+{
+    CopyDiffOptions(optsPtr, &sharedPtr->opts);
+    if (sharedPtr->regsubLeft != NULL) {
+        optsPtr->regsubLeftPtr = Tcl_NewStringObj(sharedPtr->regsubLeft, -1);
+        Tcl_IncrRefCount(optsPtr->regsubLeftPtr);
+    }
+    if (sharedPtr->regsubRight != NULL) {
+        optsPtr->regsubRightPtr = Tcl_NewStringObj(sharedPtr->regsubRight, -1);
+        Tcl_IncrRefCount(optsPtr->regsubRightPtr);
+    }
+}
+
+/*
+ * Hash a line in a store.
+ * Regsub needs Tcl_Obj, so a caller from another thread must make sure
+ * the regsub objects in the options belong to that thread.
+ */
+void
+HashStoreLine(const LineStore_T *storePtr, Line_T i,
+              const DiffOptions_T *optsPtr, int left,
+              Hash_T *result, Hash_T *real)
+{
+    Tcl_Obj *regsubPtr = left ?
+            optsPtr->regsubLeftPtr : optsPtr->regsubRightPtr;
+
+    if (regsubPtr != NULL) {
+        Hash(Tcl_NewStringObj(LineStoreLine(storePtr, i),
+                              LineStoreLength(storePtr, i)),
+             optsPtr, left, result, real);
+        return;
+    }
+    HashLine(LineStoreLine(storePtr, i), LineStoreLength(storePtr, i),
+             optsPtr, result, real);
+}
+
+/*
+ * Compare lines in two stores. Returns true if they differ.
+ */
+int
+CompareStoreLines(const LineStore_T *store1Ptr, Line_T i,
+                  const LineStore_T *store2Ptr, Line_T j,
+                  const DiffOptions_T *optsPtr)
+{
+    if (optsPtr->regsubLeftPtr != NULL || optsPtr->regsubRightPtr != NULL) {
+        return CompareObjects(
+                Tcl_NewStringObj(LineStoreLine(store1Ptr, i),
+                                 LineStoreLength(store1Ptr, i)),
+                Tcl_NewStringObj(LineStoreLine(store2Ptr, j),
+                                 LineStoreLength(store2Ptr, j)),
+                optsPtr);
+    }
+    return CompareLines(LineStoreLine(store1Ptr, i),
+                        LineStoreLength(store1Ptr, i),
+                        LineStoreLine(store2Ptr, j),
+                        LineStoreLength(store2Ptr, j), optsPtr);
+}
+
+/*
+ * Hash all lines in a line store. The hashes array gets the hash and
+ * real hash of line i at index 2*i and 2*i+1, and must have room
+ * for 2*(n+1) values.
+ */
+void
+LineStoreHash(const LineStore_T *storePtr, const DiffOptions_T *optsPtr,
+              int left, Hash_T *hashes)
+{
+    Line_T i;
+
+    hashes[0] = hashes[1] = 0;
+    for (i = 1; i <= storePtr->n; i++) {
+        HashStoreLine(storePtr, i, optsPtr, left,
+                      &hashes[2 * i], &hashes[2 * i + 1]);
+    }
+}
+
+/*
+ * Diff a window of lines from their hashes, as given by LineStoreHash.
+ * Lines i0+1 to i0+m of side 1 are diffed against lines j0+1 to j0+n
+ * of side 2. Only ignore, noempty and pivot of the options are used.
+ *
+ * Returns a J vector [0,m] as a ckalloc:ed array, with line numbers
+ * local to the window. The matches are not verified.
+ * The interpreter is only used for debug, and may be NULL.
+ */
+Line_T *
+DiffHashWindow(
+    Tcl_Interp *interp,
+    const Hash_T *hashes1,
+    Line_T i0,
+    Line_T m,
+    const Hash_T *hashes2,
+    Line_T j0,
+    Line_T n,
+    const DiffOptions_T *optsPtr)
+{
+    DiffOptions_T opts;
+    V_T *V;
+    E_T *E;
+    P_T *P;
+    Line_T i, j, *J;
+
+    if (m == 0 || n == 0) {
+        J = (Line_T *) ckalloc((m + 1) * sizeof(Line_T));
+        for (i = 0; i <= m; i++) {
+            J[i] = 0;
+        }
+        return J;
+    }
+
+    /* The window has no range or alignment of its own */
+    InitDiffOptions_T(opts);
+    opts.ignore  = optsPtr->ignore;
+    opts.noempty = optsPtr->noempty;
+    opts.pivot   = optsPtr->pivot;
+
+    V = (V_T *) ckalloc((n + 1) * sizeof(V_T));
+    for (j = 1; j <= n; j++) {
+        V[j].serial = j;
+        V[j].hash = hashes2[2 * (j0 + j)];
+        V[j].realhash = hashes2[2 * (j0 + j) + 1];
+    }
+    SortV(V, n, &opts);
+    E = BuildEVector(V, n, &opts);
+
+    P = (P_T *) ckalloc((m + 1) * sizeof(P_T));
+    for (i = 1; i <= m; i++) {
+        P[i].Eindex = 0;
+        P[i].forbidden = 0;
+        P[i].hash = hashes1[2 * (i0 + i)];
+        P[i].realhash = hashes1[2 * (i0 + i) + 1];
+        j = BSearchVVector(V, n, P[i].hash, &opts);
+        if (V[j].hash == P[i].hash) {
+            P[i].Eindex = E[j].first;
+        }
+    }
+    ckfree((char *) V);
+
+    J = LcsCore(interp, m, n, P, E, &opts);
+    ckfree((char *) E);
+    ckfree((char *) P);
+    return J;
+}
+
+/*
+ * Diff the lines in two line stores.
+ * This is the same operation as diffFiles does, but with all lines
+ * already in memory.
+ *
+ * Returns the verified J vector as a ckalloc:ed array.
+ * The interpreter is only used for debug, and may be NULL.
+ */
+Line_T *
+DiffLineStores(
+    Tcl_Interp *interp,
+    LineStore_T *store1Ptr,
+    LineStore_T *store2Ptr,
+    const DiffOptions_T *optsPtr,
+    Line_T *mPtr,
+    Line_T *nPtr)
+{
+    return DiffPrepared(interp, store1Ptr, NULL, store2Ptr, NULL, optsPtr,
+                        mPtr, nPtr);
+}
+
+/*
+ * Diff the lines in two line stores, where either side may have been
+ * prepared. A prepared side uses its own store, and its hashes are
+ * used instead of hashing again.  The prepared data must have been made
+ * with matching options, and without any range.
+ *
+ * Returns the verified J vector as a ckalloc:ed array.
+ * The interpreter is only used for debug, and may be NULL.
+ */
+Line_T *
+DiffPrepared(
+    Tcl_Interp *interp,
+    LineStore_T *store1Ptr,
+    const Prepared_T *prep1Ptr,   /* Prepared left side, or NULL */
+    LineStore_T *store2Ptr,
+    const Prepared_T *prep2Ptr,   /* Prepared right side, or NULL */
+    const DiffOptions_T *optsPtr,
+    Line_T *mPtr,
+    Line_T *nPtr)
+{
+    V_T *V;
+    E_T *E;
+    P_T *P;
+    Hash_T h, realh;
+    Line_T i, j, m, n, *J;
+
+    if (prep1Ptr != NULL) store1Ptr = (LineStore_T *) &prep1Ptr->store;
+    if (prep2Ptr != NULL) store2Ptr = (LineStore_T *) &prep2Ptr->store;
+    m = store1Ptr->n;
+    n = store2Ptr->n;
+    if (optsPtr->rTo1 > 0 && m > optsPtr->rTo1) m = optsPtr->rTo1;
+    if (optsPtr->rTo2 > 0 && n > optsPtr->rTo2) n = optsPtr->rTo2;
+
+    if (prep2Ptr != NULL) {
+        /*
+         * The sorted V vector can be used as is, but the E vector is
+         * changed by the LCS and needs a copy.
+         */
+        V = prep2Ptr->V;
+        E = (E_T *) ckalloc((n + 1) * sizeof(E_T));
+        memcpy(E, prep2Ptr->E, (n + 1) * sizeof(E_T));
+    } else {
+        /*
+         * Calculate hashes for each line in store 2, to fill in
+         * the V vector.
+         */
+
+        V = (V_T *) ckalloc((n + 1) * sizeof(V_T));
+        for (j = 1; j <= n; j++) {
+            V[j].serial = j;
+            if (j < optsPtr->rFrom2) {
+                /* Ignore the first lines if there is a range set. */
+                V[j].hash = V[j].realhash = 0;
+            } else {
+                HashStoreLine(store2Ptr, j, optsPtr, 0,
+                              &V[j].hash, &V[j].realhash);
+            }
+        }
+
+        /*
+         * Sort the V vector on hash/serial to allow fast search.
+         */
+
+        SortV(V, n, optsPtr);
+
+        /* Build E vector from V vector */
+        E = BuildEVector(V, n, optsPtr);
+    }
+
+    /*
+     * Build P vector from store 1
+     */
+
+    P = (P_T *) ckalloc((m + 1) * sizeof(P_T));
+    for (i = 1; i <= m; i++) {
+        P[i].Eindex = 0;
+        P[i].forbidden = 0;
+        if (prep1Ptr != NULL) {
+            h = prep1Ptr->hashes[2 * i];
+            realh = prep1Ptr->hashes[2 * i + 1];
+        } else if (i < optsPtr->rFrom1) {
+            /* Ignore the first lines if there is a range set. */
+            h = realh = 0;
+        } else {
+            HashStoreLine(store1Ptr, i, optsPtr, 1, &h, &realh);
+        }
+        P[i].hash = h;
+        P[i].realhash = realh;
+
+        /* Binary search for hash in V */
+        j = BSearchVVector(V, n, h, optsPtr);
+        if (n > 0 && V[j].hash == h) {
+            /* Find the first in the class */
+            P[i].Eindex = E[j].first;
+        }
+    }
+    if (prep2Ptr == NULL) {
+        ckfree((char *) V);
+    }
+
+    if (m == 0 || n == 0) {
+        /* The trivial case. Nothing can match. */
+        J = (Line_T *) ckalloc((m + 1) * sizeof(Line_T));
+        for (i = 0; i <= m; i++) {
+            J[i] = 0;
+        }
+    } else {
+        J = LcsCore(interp, m, n, P, E, optsPtr);
+    }
+    ckfree((char *) E);
+    ckfree((char *) P);
+
+    /*
+     * Now we have a list of matching lines in J.  Check that matching
+     * lines really are matching.
+     */
+
+    for (i = optsPtr->rFrom1; i <= m; i++) {
+        if (J[i] == 0) continue;
+        if (CompareStoreLines(store1Ptr, i, store2Ptr, J[i], optsPtr) != 0) {
+            /* Unmark since they don't match */
+            J[i] = 0;
+        }
+    }
+
+    *mPtr = m;
+    *nPtr = n;
+    return J;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,203 @@
+/***********************************************************************
+ *
+ * This file implements a simple pool of worker threads, processing
+ * a number of numbered work items.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "diffutil.h"
+
+/*
+ * Process one item and mark it as done.
+ */
+static void
+RunItem(Parallel_T *parPtr, int index, ClientData *workerDataPtr)
+{
+    parPtr->proc(parPtr->clientData, index, workerDataPtr);
+    Tcl_MutexLock(&parPtr->mutex);
+    parPtr->done[index] = 1;
+    Tcl_ConditionNotify(&parPtr->cond);
+    Tcl_MutexUnlock(&parPtr->mutex);
+}
+
+/*
+ * Pick the next item to process. Returns -1 when there is nothing
+ * more to do.
+ */
+static int
+NextItem(Parallel_T *parPtr)
+{
+    int index = -1;
+
+    Tcl_MutexLock(&parPtr->mutex);
+    if (!parPtr->stop && parPtr->next < parPtr->count) {
+        index = parPtr->next++;
+    }
+    Tcl_MutexUnlock(&parPtr->mutex);
+    return index;
+}
+
+#ifdef TCL_THREADS
+static Tcl_ThreadCreateType
+ParallelWorker(ClientData clientData)
+{
+    Parallel_T *parPtr = (Parallel_T *) clientData;
+    ClientData workerData = NULL;
+    int index;
+
+    while ((index = NextItem(parPtr)) >= 0) {
+        RunItem(parPtr, index, &workerData);
+    }
+    if (parPtr->cleanupProc != NULL && workerData != NULL) {
+        parPtr->cleanupProc(parPtr->clientData, workerData);
+    }
+    Tcl_ExitThread(0);
+    TCL_THREAD_CREATE_RETURN;
+}
+#endif
+
+/*
+ * Get a reasonable default for the number of threads.
+ */
+int
+ParallelDefaultThreads(void)
+{
+    int n = 1;
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    n = (int) info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (n < 1) n = 1;
+    return n;
+}
+
+/*
+ * Start processing items 0 to count-1 using at most nThreads threads.
+ * The work proc is called for each item, with a pointer to a
+ * per-worker data slot which it may fill in.  When a worker is done,
+ * the cleanup proc is called with the data in its slot.
+ * Without thread support, or if threads could not be created, items
+ * are processed in the calling thread by ParallelWait.
+ */
+void
+ParallelStart(
+    Parallel_T *parPtr,
+    int nThreads,
+    int count,
+    ParallelProc *proc,
+    ParallelCleanupProc *cleanupProc,
+    ClientData clientData)
+{
+    memset(parPtr, 0, sizeof(Parallel_T));
+    parPtr->proc = proc;
+    parPtr->cleanupProc = cleanupProc;
+    parPtr->clientData = clientData;
+    parPtr->count = count;
+    parPtr->done = ckalloc(count + 1);
+    memset(parPtr->done, 0, count + 1);
+
+    if (nThreads > count) nThreads = count;
+#ifdef TCL_THREADS
+    if (nThreads > 1) {
+        int t;
+        parPtr->threads = (Tcl_ThreadId *)
+                ckalloc(nThreads * sizeof(Tcl_ThreadId));
+        for (t = 0; t < nThreads; t++) {
+            if (Tcl_CreateThread(&parPtr->threads[t], ParallelWorker, parPtr,
+                                 TCL_THREAD_STACK_DEFAULT,
+                                 TCL_THREAD_JOINABLE) != TCL_OK) {
+                break;
+            }
+        }
+        parPtr->nThreads = t;
+    }
+#endif
+}
+
+/*
+ * Wait for an item to be done.
+ * Returns false if the item will never be done, due to an abort.
+ */
+int
+ParallelWait(Parallel_T *parPtr, int index)
+{
+    int done;
+
+    if (parPtr->nThreads == 0) {
+        /* No workers, do the job here */
+        while (!parPtr->done[index]) {
+            int i = NextItem(parPtr);
+            if (i < 0) break;
+            RunItem(parPtr, i, &parPtr->localData);
+        }
+        return parPtr->done[index];
+    }
+    Tcl_MutexLock(&parPtr->mutex);
+    while (!parPtr->done[index] && !(parPtr->stop && index >= parPtr->next)) {
+        Tcl_ConditionWait(&parPtr->cond, &parPtr->mutex, NULL);
+    }
+    done = parPtr->done[index];
+    Tcl_MutexUnlock(&parPtr->mutex);
+    return done;
+}
+
+/*
+ * Stop starting new items. Items in progress are finished.
+ */
+void
+ParallelAbort(Parallel_T *parPtr)
+{
+    Tcl_MutexLock(&parPtr->mutex);
+    parPtr->stop = 1;
+    Tcl_ConditionNotify(&parPtr->cond);
+    Tcl_MutexUnlock(&parPtr->mutex);
+}
+
+/*
+ * Wait for all workers to finish, and release all resources.
+ * Items not yet started are not processed.
+ */
+void
+ParallelFinish(Parallel_T *parPtr)
+{
+    ParallelAbort(parPtr);
+#ifdef TCL_THREADS
+    {
+        int t, state;
+        for (t = 0; t < parPtr->nThreads; t++) {
+            Tcl_JoinThread(parPtr->threads[t], &state);
+        }
+    }
+#endif
+    if (parPtr->threads != NULL) {
+        ckfree((char *) parPtr->threads);
+    }
+    if (parPtr->cleanupProc != NULL && parPtr->localData != NULL) {
+        parPtr->cleanupProc(parPtr->clientData, parPtr->localData);
+    }
+    ckfree(parPtr->done);
+    Tcl_ConditionFinalize(&parPtr->cond);
+    Tcl_MutexFinalize(&parPtr->mutex);
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,419 @@
+/***********************************************************************
+ *
+ * This file implements prepare, which reads and hashes a file or list
+ * once, giving a handle that diffFiles or diffLists can use many times.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "diffutil.h"
+
+TCL_DECLARE_MUTEX(preparedMutex)
+static int preparedCounter = 0;
+
+static int PreparedObjCmd(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]);
+
+/*
+ * Describe the options that affect the hashes of one side, in a
+ * canonical form. Returns a new object.
+ */
+Tcl_Obj *
+PreparedOptions(
+    const DiffOptions_T *optsPtr,
+    const FileOptions_T *fileOptsPtr,   /* NULL for lists */
+    int left)
+{
+    Tcl_Obj *resPtr = Tcl_NewListObj(0, NULL);
+    Tcl_Obj *regsubPtr = left ? optsPtr->regsubLeftPtr :
+            optsPtr->regsubRightPtr;
+
+    if (optsPtr->ignore & IGNORE_SPACE_CHANGE) {
+        Tcl_ListObjAppendElement(NULL, resPtr, Tcl_NewStringObj("-b", -1));
+    }
+    if (optsPtr->ignore & IGNORE_ALL_SPACE) {
+        Tcl_ListObjAppendElement(NULL, resPtr, Tcl_NewStringObj("-w", -1));
+    }
+    if (optsPtr->ignore & IGNORE_CASE) {
+        Tcl_ListObjAppendElement(NULL, resPtr, Tcl_NewStringObj("-i", -1));
+    }
+    if (optsPtr->ignore & IGNORE_NUMBERS) {
+        Tcl_ListObjAppendElement(NULL, resPtr,
+                                 Tcl_NewStringObj("-nodigit", -1));
+    }
+    if (regsubPtr != NULL) {
+        Tcl_ListObjAppendElement(NULL, resPtr,
+                                 Tcl_NewStringObj("-regsub", -1));
+        Tcl_ListObjAppendElement(NULL, resPtr, regsubPtr);
+    }
+    if (fileOptsPtr == NULL) {
+        return resPtr;
+    }
+    if (fileOptsPtr->encodingPtr != NULL) {
+        Tcl_ListObjAppendElement(NULL, resPtr,
+                                 Tcl_NewStringObj("-encoding", -1));
+        Tcl_ListObjAppendElement(NULL, resPtr, fileOptsPtr->encodingPtr);
+    }
+    if (fileOptsPtr->translationPtr != NULL) {
+        Tcl_ListObjAppendElement(NULL, resPtr,
+                                 Tcl_NewStringObj("-translation", -1));
+        Tcl_ListObjAppendElement(NULL, resPtr, fileOptsPtr->translationPtr);
+    }
+    if (fileOptsPtr->gzip) {
+        Tcl_ListObjAppendElement(NULL, resPtr, Tcl_NewStringObj("-gz", -1));
+    }
+    return resPtr;
+}
+
+static void
+DeletePrepared(ClientData clientData)
+{
+    Prepared_T *prepPtr = (Prepared_T *) clientData;
+
+    FreeLineStore(&prepPtr->store);
+    ckfree((char *) prepPtr->hashes);
+    ckfree((char *) prepPtr->V);
+    ckfree((char *) prepPtr->E);
+    Tcl_DecrRefCount(prepPtr->optionsPtr);
+    ckfree((char *) prepPtr);
+}
+
+/*
+ * Get the prepared data if the object is the name of a handle of the
+ * right kind, otherwise NULL.
+ * Only plain strings and command names are looked up. Anything else,
+ * like a list, is not a handle, and is left without a string rep.
+ */
+Prepared_T *
+GetPrepared(Tcl_Interp *interp, Tcl_Obj *objPtr, int isList)
+{
+    Tcl_CmdInfo info;
+    Prepared_T *prepPtr;
+
+    if (objPtr->typePtr != NULL &&
+            objPtr->typePtr != Tcl_GetObjType("cmdName") &&
+            objPtr->typePtr != Tcl_GetObjType("string")) {
+        return NULL;
+    }
+    if (!Tcl_GetCommandInfo(interp, Tcl_GetString(objPtr), &info) ||
+            info.objProc != PreparedObjCmd) {
+        return NULL;
+    }
+    prepPtr = (Prepared_T *) info.objClientData;
+    if (prepPtr->isList != isList) {
+        return NULL;
+    }
+    return prepPtr;
+}
+
+/*
+ * Check that a prepared side was made with the options now in use.
+ */
+static int
+CheckPrepared(Tcl_Interp *interp, Prepared_T *prepPtr,
+              const DiffOptions_T *optsPtr,
+              const FileOptions_T *fileOptsPtr, int left)
+{
+    Tcl_Obj *optionsPtr;
+    int result = TCL_OK;
+
+    optionsPtr = PreparedOptions(optsPtr, fileOptsPtr, left);
+    Tcl_IncrRefCount(optionsPtr);
+    if (strcmp(Tcl_GetString(optionsPtr),
+               Tcl_GetString(prepPtr->optionsPtr)) != 0) {
+        Tcl_Obj *namePtr = Tcl_NewObj();
+        Tcl_GetCommandFullName(interp, prepPtr->token, namePtr);
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf(
+                "\"%s\" was prepared with options \"%s\", not \"%s\"",
+                Tcl_GetString(namePtr),
+                Tcl_GetString(prepPtr->optionsPtr),
+                Tcl_GetString(optionsPtr)));
+        Tcl_DecrRefCount(namePtr);
+        result = TCL_ERROR;
+    }
+    Tcl_DecrRefCount(optionsPtr);
+    return result;
+}
+
+/*
+ * Fill a line store from a file or a list.
+ */
+static int
+FillStore(Tcl_Interp *interp, Tcl_Obj *objPtr,
+          FileOptions_T *fileOptsPtr, LineStore_T *storePtr)
+{
+    Tcl_Channel ch;
+    Tcl_Obj **elemPtrs;
+    int i, length, elemLength;
+    const char *elem;
+
+    if (fileOptsPtr == NULL) {
+        if (Tcl_ListObjGetElements(interp, objPtr, &length, &elemPtrs)
+                != TCL_OK) {
+            return TCL_ERROR;
+        }
+        for (i = 0; i < length; i++) {
+            elem = Tcl_GetStringFromObj(elemPtrs[i], &elemLength);
+            LineStoreAppend(storePtr, elem, elemLength);
+        }
+        return TCL_OK;
+    }
+    ch = OpenReadChannel(interp, objPtr, fileOptsPtr);
+    if (ch == NULL) {
+        return TCL_ERROR;
+    }
+    LineStoreReadChannel(storePtr, ch, 1, 0);
+    CloseReadChannel(interp, ch);
+    return TCL_OK;
+}
+
+/*
+ * Diff where at least one side is prepared. The other side is read
+ * into memory and hashed as usual.  fileOptsPtr is NULL for lists.
+ */
+int
+PreparedDiff(
+    Tcl_Interp *interp,
+    Tcl_Obj *obj1Ptr,
+    Tcl_Obj *obj2Ptr,
+    Prepared_T *prep1Ptr,
+    Prepared_T *prep2Ptr,
+    DiffOptions_T *optsPtr,
+    FileOptions_T *fileOptsPtr,
+    Tcl_Obj **resPtr)
+{
+    LineStore_T store1, store2;
+    Line_T m, n, *J;
+    int result = TCL_OK;
+
+    InitLineStore(&store1);
+    InitLineStore(&store2);
+
+    if (optsPtr->rFrom1 != 1 || optsPtr->rTo1 != 0 ||
+            optsPtr->rFrom2 != 1 || optsPtr->rTo2 != 0) {
+        Tcl_SetResult(interp, "-range cannot be used with prepared data",
+                      TCL_STATIC);
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (prep1Ptr != NULL) {
+        if (CheckPrepared(interp, prep1Ptr, optsPtr, fileOptsPtr, 1)
+                != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    } else if (FillStore(interp, obj1Ptr, fileOptsPtr, &store1) != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    if (prep2Ptr != NULL) {
+        if (CheckPrepared(interp, prep2Ptr, optsPtr, fileOptsPtr, 0)
+                != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    } else if (FillStore(interp, obj2Ptr, fileOptsPtr, &store2) != TCL_OK) {
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+
+    J = DiffPrepared(interp, &store1, prep1Ptr, &store2, prep2Ptr, optsPtr,
+                     &m, &n);
+    *resPtr = BuildResultFromJ(interp, optsPtr, m, n, J);
+    ckfree((char *) J);
+
+    if (fileOptsPtr != NULL && fileOptsPtr->lines1Ptr != NULL) {
+        LineStoreToList(prep1Ptr != NULL ? &prep1Ptr->store : &store1,
+                        fileOptsPtr->lines1Ptr);
+        LineStoreToList(prep2Ptr != NULL ? &prep2Ptr->store : &store2,
+                        fileOptsPtr->lines2Ptr);
+    }
+
+    cleanup:
+    FreeLineStore(&store1);
+    FreeLineStore(&store2);
+    return result;
+}
+
+/*
+ * The handle command: handle destroy|options|size
+ */
+static int
+PreparedObjCmd(
+    ClientData clientData,
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    Prepared_T *prepPtr = (Prepared_T *) clientData;
+    int index;
+
+    static CONST char *subCommands[] = {
+        "destroy", "options", "size", (char *) NULL
+    };
+    enum subCommands {
+        SUB_DESTROY, SUB_OPTIONS, SUB_SIZE
+    };
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "subcommand");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], subCommands, "subcommand", 0,
+                            &index) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    switch (index) {
+      case SUB_DESTROY:
+          Tcl_DeleteCommandFromToken(interp, prepPtr->token);
+          break;
+      case SUB_OPTIONS:
+          Tcl_SetObjResult(interp, prepPtr->optionsPtr);
+          break;
+      case SUB_SIZE:
+          Tcl_SetObjResult(interp, Tcl_NewLongObj((long) prepPtr->store.n));
+          break;
+    }
+    return TCL_OK;
+}
+
+/*
+ * DiffUtil::prepare ?-list? ?opts? file|list
+ */
+int
+PrepareObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int result = TCL_OK, isList = 0, first = 1, t, index;
+    DiffOptions_T opts;
+    FileOptions_T fileOpts;
+    Prepared_T *prepPtr = NULL;
+    const char *left, *right;
+    Line_T j, n;
+    char name[64];
+
+    static CONST char *listOptions[] = {
+	"-b", "-w", "-i", "-nocase", "-nodigit", (char *) NULL
+    };
+    enum listOptions {
+	OPT_B, OPT_W, OPT_I, OPT_NOCASE, OPT_NODIGIT
+    };
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-list? ?opts? file|list");
+	return TCL_ERROR;
+    }
+
+    InitDiffOptions_T(opts);
+    InitFileOptions_T(fileOpts);
+
+    if (objc > 2 && strcmp(Tcl_GetString(objv[1]), "-list") == 0) {
+        isList = 1;
+        first = 2;
+    }
+    if (isList) {
+        /* The options of diffLists that affect hashing */
+        for (t = first; t < objc - 1; t++) {
+            if (Tcl_GetIndexFromObj(interp, objv[t], listOptions, "option",
+                                    0, &index) != TCL_OK) {
+                result = TCL_ERROR;
+                goto cleanup;
+            }
+            switch (index) {
+              case OPT_NOCASE:
+              case OPT_I:
+                  opts.ignore |= IGNORE_CASE;
+                  break;
+              case OPT_B:
+                  opts.ignore |= IGNORE_SPACE_CHANGE;
+                  break;
+              case OPT_W:
+                  opts.ignore |= IGNORE_ALL_SPACE;
+                  break;
+              case OPT_NODIGIT:
+                  opts.ignore |= IGNORE_NUMBERS;
+                  break;
+            }
+        }
+    } else {
+        if (ParseDiffFilesOptions(interp, objc, objv, first, objc - 1,
+                        "?-list? ?opts? file|list", &opts, &fileOpts, NULL,
+                        NULL, NULL, NULL) != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+        if (opts.rFrom1 != 1 || opts.rTo1 != 0 ||
+                opts.rFrom2 != 1 || opts.rTo2 != 0) {
+            Tcl_SetResult(interp, "-range cannot be used with prepare",
+                          TCL_STATIC);
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+        /* The data may be used on either side */
+        left  = opts.regsubLeftPtr  ? Tcl_GetString(opts.regsubLeftPtr)  : "";
+        right = opts.regsubRightPtr ? Tcl_GetString(opts.regsubRightPtr) : "";
+        if (strcmp(left, right) != 0) {
+            Tcl_SetResult(interp, "-regsubleft and -regsubright cannot be"
+                          " used with prepare", TCL_STATIC);
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+    }
+
+    prepPtr = (Prepared_T *) ckalloc(sizeof(Prepared_T));
+    memset(prepPtr, 0, sizeof(Prepared_T));
+    prepPtr->isList = isList;
+    InitLineStore(&prepPtr->store);
+    if (FillStore(interp, objv[objc - 1], isList ? NULL : &fileOpts,
+                  &prepPtr->store) != TCL_OK) {
+        FreeLineStore(&prepPtr->store);
+        ckfree((char *) prepPtr);
+        result = TCL_ERROR;
+        goto cleanup;
+    }
+    prepPtr->optionsPtr = PreparedOptions(&opts, isList ? NULL : &fileOpts,
+                                          1);
+    Tcl_IncrRefCount(prepPtr->optionsPtr);
+
+    /* Hash, sort and build equivalence classes */
+    n = prepPtr->store.n;
+    prepPtr->hashes = (Hash_T *) ckalloc(2 * (n + 1) * sizeof(Hash_T));
+    LineStoreHash(&prepPtr->store, &opts, 1, prepPtr->hashes);
+    prepPtr->V = (V_T *) ckalloc((n + 1) * sizeof(V_T));
+    for (j = 1; j <= n; j++) {
+        prepPtr->V[j].serial = j;
+        prepPtr->V[j].hash = prepPtr->hashes[2 * j];
+        prepPtr->V[j].realhash = prepPtr->hashes[2 * j + 1];
+    }
+    SortV(prepPtr->V, n, &opts);
+    prepPtr->E = BuildEVector(prepPtr->V, n, &opts);
+
+    Tcl_MutexLock(&preparedMutex);
+    preparedCounter++;
+    sprintf(name, "::DiffUtil::prepared%d", preparedCounter);
+    Tcl_MutexUnlock(&preparedMutex);
+    prepPtr->token = Tcl_CreateObjCommand(interp, name, PreparedObjCmd,
+                                          (ClientData) prepPtr,
+                                          DeletePrepared);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+
+    cleanup:
+    FreeDiffFilesOptions(&opts, &fileOpts);
+    return result;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,629 @@
+/***********************************************************************
+ *
+ * This file implements diff sessions, which keep two files in memory
+ * to diff them again and again with different options.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "diffutil.h"
+
+/*
+ * A session is diffed in windows, split by the range and alignment.
+ * Each window is diffed on its own, and kept until the next diff, where
+ * an identical window can be reused.
+ */
+typedef struct {
+    Line_T i0, m;             /* Lines i0+1 to i0+m of file 1 */
+    Line_T j0, n;             /* Lines j0+1 to j0+n of file 2 */
+    Line_T *J;                /* Verified J vector [0,m], window local */
+} Window_T;
+
+typedef struct {
+    Tcl_Command token;        /* The session's command */
+    LineStore_T store1;       /* All lines of the files */
+    LineStore_T store2;
+    Hash_T *hashes1;          /* Hashes, as given by LineStoreHash */
+    Hash_T *hashes2;
+    Tcl_Obj *key1Ptr;         /* Options the hashes were made with, */
+    Tcl_Obj *key2Ptr;         /* or NULL if not hashed yet */
+    int noempty, pivot;       /* Options the windows were made with */
+    int haveOpts;             /* Options of the last diff, used when */
+    DiffOptions_T lastOpts;   /* hashing edited lines */
+    int nWindows;
+    Window_T *windows;
+    long hashed;              /* Statistics */
+    long diffed;
+    long reused;
+} Session_T;
+
+TCL_DECLARE_MUTEX(sessionMutex)
+static int sessionCounter = 0;
+
+static void
+FreeWindows(Window_T *windows, int nWindows)
+{
+    int t;
+
+    for (t = 0; t < nWindows; t++) {
+        ckfree((char *) windows[t].J);
+    }
+    if (windows != NULL) {
+        ckfree((char *) windows);
+    }
+}
+
+static void
+DeleteSession(ClientData clientData)
+{
+    Session_T *sessPtr = (Session_T *) clientData;
+
+    FreeLineStore(&sessPtr->store1);
+    FreeLineStore(&sessPtr->store2);
+    if (sessPtr->hashes1 != NULL) ckfree((char *) sessPtr->hashes1);
+    if (sessPtr->hashes2 != NULL) ckfree((char *) sessPtr->hashes2);
+    if (sessPtr->key1Ptr != NULL) Tcl_DecrRefCount(sessPtr->key1Ptr);
+    if (sessPtr->key2Ptr != NULL) Tcl_DecrRefCount(sessPtr->key2Ptr);
+    FreeWindows(sessPtr->windows, sessPtr->nWindows);
+    if (sessPtr->haveOpts) {
+        FreeDiffFilesOptions(&sessPtr->lastOpts, NULL);
+    }
+    ckfree((char *) sessPtr);
+}
+
+/*
+ * Make sure the hashes of one side are made with the current options.
+ * Returns true if they had to be made again.
+ */
+static int
+SessionHash(const LineStore_T *storePtr, Hash_T **hashesPtr,
+            Tcl_Obj **keyPtrPtr, const DiffOptions_T *optsPtr, int left)
+{
+    Tcl_Obj *keyPtr = PreparedOptions(optsPtr, NULL, left);
+
+    Tcl_IncrRefCount(keyPtr);
+    if (*keyPtrPtr != NULL &&
+            strcmp(Tcl_GetString(keyPtr), Tcl_GetString(*keyPtrPtr)) == 0) {
+        Tcl_DecrRefCount(keyPtr);
+        return 0;
+    }
+    if (*keyPtrPtr != NULL) {
+        Tcl_DecrRefCount(*keyPtrPtr);
+    }
+    *keyPtrPtr = keyPtr;
+    if (*hashesPtr == NULL) {
+        *hashesPtr = (Hash_T *)
+                ckalloc(2 * (storePtr->n + 1) * sizeof(Hash_T));
+    }
+    LineStoreHash(storePtr, optsPtr, left, *hashesPtr);
+    return 1;
+}
+
+/*
+ * Diff one window and verify its matches.
+ */
+static void
+DiffWindow(Tcl_Interp *interp, Session_T *sessPtr,
+           const DiffOptions_T *optsPtr, Window_T *winPtr)
+{
+    Line_T i, *J;
+
+    J = DiffHashWindow(interp, sessPtr->hashes1, winPtr->i0, winPtr->m,
+                       sessPtr->hashes2, winPtr->j0, winPtr->n, optsPtr);
+    sessPtr->diffed++;
+
+    /* Check that matching lines really are matching */
+    for (i = 1; i <= winPtr->m; i++) {
+        if (J[i] == 0) continue;
+        if (CompareStoreLines(&sessPtr->store1, winPtr->i0 + i,
+                              &sessPtr->store2, winPtr->j0 + J[i],
+                              optsPtr) != 0) {
+            J[i] = 0;
+        }
+    }
+    winPtr->J = J;
+}
+
+/*
+ * Diff one window, reusing the previous diff's window if identical.
+ */
+static void
+SessionWindow(Tcl_Interp *interp, Session_T *sessPtr,
+              const DiffOptions_T *optsPtr, Window_T *winPtr)
+{
+    int t;
+
+    for (t = 0; t < sessPtr->nWindows; t++) {
+        Window_T *oldPtr = &sessPtr->windows[t];
+        if (oldPtr->J != NULL && oldPtr->i0 == winPtr->i0 &&
+                oldPtr->m == winPtr->m && oldPtr->j0 == winPtr->j0 &&
+                oldPtr->n == winPtr->n) {
+            /* Take it over */
+            winPtr->J = oldPtr->J;
+            oldPtr->J = NULL;
+            sessPtr->reused++;
+            return;
+        }
+    }
+    DiffWindow(interp, sessPtr, optsPtr, winPtr);
+}
+
+/*
+ * Diff the session with the given options.
+ */
+static Tcl_Obj *
+SessionDiff(Tcl_Interp *interp, Session_T *sessPtr,
+            const DiffOptions_T *optsPtr)
+{
+    Line_T m, n, i, a, b, curI, curJ, *J;
+    Window_T *windows;
+    Tcl_Obj *resPtr;
+    DiffOptions_T rangeOpts;
+    int nWindows, t, done;
+
+    /* Only the side whose hash options changed is hashed again */
+    if (SessionHash(&sessPtr->store1, &sessPtr->hashes1, &sessPtr->key1Ptr,
+                    optsPtr, 1)) {
+        sessPtr->hashed++;
+        FreeWindows(sessPtr->windows, sessPtr->nWindows);
+        sessPtr->windows = NULL;
+        sessPtr->nWindows = 0;
+    }
+    if (SessionHash(&sessPtr->store2, &sessPtr->hashes2, &sessPtr->key2Ptr,
+                    optsPtr, 0)) {
+        sessPtr->hashed++;
+        FreeWindows(sessPtr->windows, sessPtr->nWindows);
+        sessPtr->windows = NULL;
+        sessPtr->nWindows = 0;
+    }
+    if (sessPtr->noempty != optsPtr->noempty ||
+            sessPtr->pivot != optsPtr->pivot) {
+        FreeWindows(sessPtr->windows, sessPtr->nWindows);
+        sessPtr->windows = NULL;
+        sessPtr->nWindows = 0;
+        sessPtr->noempty = optsPtr->noempty;
+        sessPtr->pivot = optsPtr->pivot;
+    }
+
+    m = sessPtr->store1.n;
+    n = sessPtr->store2.n;
+    if (optsPtr->rTo1 > 0 && m > optsPtr->rTo1) m = optsPtr->rTo1;
+    if (optsPtr->rTo2 > 0 && n > optsPtr->rTo2) n = optsPtr->rTo2;
+
+    /*
+     * A range that starts past the end of a file, or after its own last
+     * line, is empty and starts just after the last line. The options
+     * are kept as given, since an edit may bring the lines back.
+     */
+    rangeOpts = *optsPtr;
+    if (rangeOpts.rFrom1 > m + 1) rangeOpts.rFrom1 = m + 1;
+    if (rangeOpts.rFrom2 > n + 1) rangeOpts.rFrom2 = n + 1;
+
+    J = (Line_T *) ckalloc((m + 1) * sizeof(Line_T));
+    for (i = 0; i <= m; i++) {
+        J[i] = 0;
+    }
+
+    /*
+     * No line can match across an aligned pair, so the range is split
+     * into windows between the aligned pairs.
+     */
+    windows = (Window_T *)
+            ckalloc((optsPtr->alignLength / 2 + 1) * sizeof(Window_T));
+    nWindows = 0;
+    curI = rangeOpts.rFrom1 - 1;
+    curJ = rangeOpts.rFrom2 - 1;
+    done = 0;
+    for (t = 0; t <= optsPtr->alignLength && !done; t += 2) {
+        if (t < optsPtr->alignLength) {
+            a = optsPtr->align[t];
+            b = optsPtr->align[t + 1];
+            if (a <= curI || b <= curJ) continue;
+        } else {
+            a = m + 1;
+            b = n + 1;
+        }
+        if (a > m + 1) a = m + 1;
+        if (b > n + 1) b = n + 1;
+        if (a > m || b > n) {
+            /* Nothing can match after this pair */
+            done = 1;
+        }
+        windows[nWindows].i0 = curI;
+        windows[nWindows].m  = a - 1 - curI;
+        windows[nWindows].j0 = curJ;
+        windows[nWindows].n  = b - 1 - curJ;
+        SessionWindow(interp, sessPtr, optsPtr, &windows[nWindows]);
+        for (i = 1; i <= windows[nWindows].m; i++) {
+            if (windows[nWindows].J[i] != 0) {
+                J[curI + i] = curJ + windows[nWindows].J[i];
+            }
+        }
+        nWindows++;
+
+        /* The aligned pair itself matches if the lines are equal */
+        if (a <= m && b <= n &&
+                sessPtr->hashes1[2 * a] == sessPtr->hashes2[2 * b] &&
+                CompareStoreLines(&sessPtr->store1, a, &sessPtr->store2, b,
+                                  optsPtr) == 0) {
+            J[a] = b;
+        }
+        curI = a;
+        curJ = b;
+    }
+
+    FreeWindows(sessPtr->windows, sessPtr->nWindows);
+    sessPtr->windows = windows;
+    sessPtr->nWindows = nWindows;
+
+    /* Keep the options, for edits and their diff */
+    if (optsPtr != &sessPtr->lastOpts) {
+        if (sessPtr->haveOpts) {
+            FreeDiffFilesOptions(&sessPtr->lastOpts, NULL);
+        }
+        CopyDiffOptions(&sessPtr->lastOpts, optsPtr);
+        if (optsPtr->regsubLeftPtr != NULL) {
+            Tcl_IncrRefCount(optsPtr->regsubLeftPtr);
+        }
+        if (optsPtr->regsubRightPtr != NULL) {
+            Tcl_IncrRefCount(optsPtr->regsubRightPtr);
+        }
+        sessPtr->haveOpts = 1;
+    }
+
+    resPtr = BuildResultFromJ(interp, &rangeOpts, m, n, J);
+    ckfree((char *) J);
+    return resPtr;
+}
+
+/*
+ * Replace lines first to last of one side with new lines.
+ *
+ * Only the new lines are hashed. If the last diff was one window over
+ * both files, i.e. without range or alignment, its J vector is patched:
+ * the nearest matched lines before and after the edit are kept as
+ * anchors and only the window between them is diffed again.
+ * Otherwise the next diff starts over, but still with the hashes kept.
+ */
+static void
+SessionEdit(Tcl_Interp *interp, Session_T *sessPtr, int side,
+            Line_T first, Line_T last, int count, Tcl_Obj *CONST lines[])
+{
+    LineStore_T *storePtr, newStore;
+    Hash_T **hashesPtr, *hashes;
+    Line_T i, i0, i1, j0, j1, m, n, newM, newN, removed, *J, *newJ;
+    Window_T win;
+    const char *str;
+    int t, length, whole;
+
+    storePtr  = side == 1 ? &sessPtr->store1  : &sessPtr->store2;
+    hashesPtr = side == 1 ? &sessPtr->hashes1 : &sessPtr->hashes2;
+    m = sessPtr->store1.n;
+    n = sessPtr->store2.n;
+    removed = last + 1 - first;
+    whole = sessPtr->nWindows == 1 &&
+            sessPtr->windows[0].i0 == 0 && sessPtr->windows[0].m == m &&
+            sessPtr->windows[0].j0 == 0 && sessPtr->windows[0].n == n;
+
+    /* Splice the new lines into the store */
+    InitLineStore(&newStore);
+    for (i = 1; i < first; i++) {
+        LineStoreAppend(&newStore, LineStoreLine(storePtr, i),
+                        LineStoreLength(storePtr, i));
+    }
+    for (t = 0; t < count; t++) {
+        str = Tcl_GetStringFromObj(lines[t], &length);
+        LineStoreAppend(&newStore, str, length);
+    }
+    for (i = last + 1; i <= storePtr->n; i++) {
+        LineStoreAppend(&newStore, LineStoreLine(storePtr, i),
+                        LineStoreLength(storePtr, i));
+    }
+    FreeLineStore(storePtr);
+    *storePtr = newStore;
+
+    if (*hashesPtr != NULL) {
+        hashes = (Hash_T *)
+                ckalloc(2 * (storePtr->n + 1) * sizeof(Hash_T));
+        memcpy(hashes, *hashesPtr, 2 * first * sizeof(Hash_T));
+        for (i = first; i < first + count; i++) {
+            HashStoreLine(storePtr, i, &sessPtr->lastOpts, side == 1,
+                          &hashes[2 * i], &hashes[2 * i + 1]);
+        }
+        memcpy(&hashes[2 * (first + count)], &(*hashesPtr)[2 * (last + 1)],
+               2 * (side == 1 ? m - last : n - last) * sizeof(Hash_T));
+        ckfree((char *) *hashesPtr);
+        *hashesPtr = hashes;
+    }
+
+    if (!whole || *hashesPtr == NULL) {
+        FreeWindows(sessPtr->windows, sessPtr->nWindows);
+        sessPtr->windows = NULL;
+        sessPtr->nWindows = 0;
+        return;
+    }
+
+    /* Find the anchors, the closest matches outside the edit */
+    J = sessPtr->windows[0].J;
+    if (side == 1) {
+        for (i0 = first - 1; i0 > 0 && J[i0] == 0; i0--);
+        for (i1 = last + 1; i1 <= m && J[i1] == 0; i1++);
+    } else {
+        i0 = 0;
+        for (i1 = 1; i1 <= m; i1++) {
+            if (J[i1] == 0) continue;
+            if (J[i1] > last) break;
+            if (J[i1] < first) i0 = i1;
+        }
+    }
+    j0 = J[i0];
+    j1 = i1 <= m ? J[i1] : n + 1;
+    newM = sessPtr->store1.n;
+    newN = sessPtr->store2.n;
+
+    win.i0 = i0;
+    win.j0 = j0;
+    if (side == 1) {
+        win.m = i1 + count - removed - 1 - i0;
+        win.n = j1 - 1 - j0;
+    } else {
+        win.m = i1 - 1 - i0;
+        win.n = j1 + count - removed - 1 - j0;
+    }
+    DiffWindow(interp, sessPtr, &sessPtr->lastOpts, &win);
+
+    /* Patch the J vector */
+    newJ = (Line_T *) ckalloc((newM + 1) * sizeof(Line_T));
+    for (i = 0; i <= i0; i++) {
+        newJ[i] = J[i];
+    }
+    for (i = 1; i <= win.m; i++) {
+        newJ[i0 + i] = win.J[i] == 0 ? 0 : j0 + win.J[i];
+    }
+    ckfree((char *) win.J);
+    for (i = i1; i <= m; i++) {
+        if (side == 1) {
+            newJ[i + count - removed] = J[i];
+        } else {
+            newJ[i] = J[i] == 0 ? 0 : J[i] + count - removed;
+        }
+    }
+    ckfree((char *) J);
+    sessPtr->windows[0].J = newJ;
+    sessPtr->windows[0].m = newM;
+    sessPtr->windows[0].n = newN;
+}
+
+/*
+ * The session command: session destroy|diff|edit|lines|size|stats ?arg ...?
+ */
+static int
+SessionHandleObjCmd(
+    ClientData clientData,
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    Session_T *sessPtr = (Session_T *) clientData;
+    int index, result = TCL_OK, side, first, last, count;
+    DiffOptions_T opts;
+    Tcl_Obj **lines;
+    Line_T size;
+    FileOptions_T fileOpts;
+    Tcl_Obj *resPtr, *linesPtr;
+
+    static CONST char *subCommands[] = {
+        "destroy", "diff", "edit", "lines", "size", "stats", (char *) NULL
+    };
+    enum subCommands {
+        SUB_DESTROY, SUB_DIFF, SUB_EDIT, SUB_LINES, SUB_SIZE, SUB_STATS
+    };
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "subcommand ?arg ...?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], subCommands, "subcommand", 0,
+                            &index) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (index != SUB_DIFF && index != SUB_EDIT && objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, NULL);
+        return TCL_ERROR;
+    }
+    switch (index) {
+      case SUB_DESTROY:
+          Tcl_DeleteCommandFromToken(interp, sessPtr->token);
+          break;
+      case SUB_DIFF:
+          InitDiffOptions_T(opts);
+          InitFileOptions_T(fileOpts);
+          if (ParseDiffFilesOptions(interp, objc, objv, 2, objc,
+                          "diff ?opts?", &opts, &fileOpts, NULL, NULL,
+                          NULL, NULL) != TCL_OK) {
+              result = TCL_ERROR;
+          } else if (fileOpts.encodingPtr != NULL ||
+                  fileOpts.translationPtr != NULL || fileOpts.gzip) {
+              Tcl_SetResult(interp, "-encoding, -translation and -gz can"
+                            " only be given when creating a session",
+                            TCL_STATIC);
+              result = TCL_ERROR;
+          } else {
+              Tcl_SetObjResult(interp, SessionDiff(interp, sessPtr, &opts));
+          }
+          FreeDiffFilesOptions(&opts, &fileOpts);
+          break;
+      case SUB_EDIT:
+          if (objc != 6) {
+              Tcl_WrongNumArgs(interp, 2, objv, "side first last lines");
+              return TCL_ERROR;
+          }
+          if (Tcl_GetIntFromObj(interp, objv[2], &side) != TCL_OK ||
+                  Tcl_GetIntFromObj(interp, objv[3], &first) != TCL_OK ||
+                  Tcl_GetIntFromObj(interp, objv[4], &last) != TCL_OK ||
+                  Tcl_ListObjGetElements(interp, objv[5], &count, &lines)
+                  != TCL_OK) {
+              return TCL_ERROR;
+          }
+          if (side != 1 && side != 2) {
+              Tcl_SetResult(interp, "side must be 1 or 2", TCL_STATIC);
+              return TCL_ERROR;
+          }
+          size = side == 1 ? sessPtr->store1.n : sessPtr->store2.n;
+          if (first < 1 || (Line_T) first > size + 1 || last < first - 1 ||
+                  (Line_T) last > size) {
+              Tcl_SetResult(interp, "bad line range", TCL_STATIC);
+              return TCL_ERROR;
+          }
+          SessionEdit(interp, sessPtr, side, (Line_T) first, (Line_T) last,
+                      count, lines);
+          if (sessPtr->haveOpts) {
+              Tcl_SetObjResult(interp, SessionDiff(interp, sessPtr,
+                                                   &sessPtr->lastOpts));
+          } else {
+              InitDiffOptions_T(opts);
+              Tcl_SetObjResult(interp, SessionDiff(interp, sessPtr, &opts));
+          }
+          break;
+      case SUB_LINES:
+          resPtr = Tcl_NewListObj(0, NULL);
+          linesPtr = Tcl_NewListObj(0, NULL);
+          LineStoreToList(&sessPtr->store1, linesPtr);
+          Tcl_ListObjAppendElement(NULL, resPtr, linesPtr);
+          linesPtr = Tcl_NewListObj(0, NULL);
+          LineStoreToList(&sessPtr->store2, linesPtr);
+          Tcl_ListObjAppendElement(NULL, resPtr, linesPtr);
+          Tcl_SetObjResult(interp, resPtr);
+          break;
+      case SUB_SIZE:
+          resPtr = Tcl_NewListObj(0, NULL);
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                                   Tcl_NewLongObj((long) sessPtr->store1.n));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                                   Tcl_NewLongObj((long) sessPtr->store2.n));
+          Tcl_SetObjResult(interp, resPtr);
+          break;
+      case SUB_STATS:
+          resPtr = Tcl_NewListObj(0, NULL);
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                                   Tcl_NewStringObj("hashed", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                                   Tcl_NewLongObj(sessPtr->hashed));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                                   Tcl_NewStringObj("diffed", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                                   Tcl_NewLongObj(sessPtr->diffed));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                                   Tcl_NewStringObj("reused", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                                   Tcl_NewLongObj(sessPtr->reused));
+          Tcl_SetObjResult(interp, resPtr);
+          break;
+    }
+    return result;
+}
+
+/*
+ * DiffUtil::session ?opts? file1 file2
+ */
+int
+SessionObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int result = TCL_OK, t, index, side;
+    FileOptions_T fileOpts;
+    Session_T *sessPtr = NULL;
+    Tcl_Channel ch;
+    char name[64];
+
+    static CONST char *options[] = {
+	"-encoding", "-gz", "-translation", (char *) NULL
+    };
+    enum options {
+	OPT_ENCODING, OPT_GZ, OPT_TRANSLATION
+    };
+
+    if (objc < 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
+	return TCL_ERROR;
+    }
+
+    InitFileOptions_T(fileOpts);
+    for (t = 1; t < objc - 2; t++) {
+	if (Tcl_GetIndexFromObj(interp, objv[t], options, "option", 0,
+		&index) != TCL_OK) {
+            result = TCL_ERROR;
+            goto cleanup;
+	}
+	switch (index) {
+	  case OPT_GZ:
+              fileOpts.gzip = 1;
+              break;
+	  case OPT_ENCODING:
+	  case OPT_TRANSLATION:
+	      t++;
+	      if (t >= objc - 2) {
+		  Tcl_WrongNumArgs(interp, 1, objv, "?opts? file1 file2");
+                  result = TCL_ERROR;
+                  goto cleanup;
+	      }
+              Tcl_IncrRefCount(objv[t]);
+              if (index == OPT_ENCODING) {
+                  fileOpts.encodingPtr = objv[t];
+              } else {
+                  fileOpts.translationPtr = objv[t];
+              }
+	      break;
+        }
+    }
+
+    sessPtr = (Session_T *) ckalloc(sizeof(Session_T));
+    memset(sessPtr, 0, sizeof(Session_T));
+    InitLineStore(&sessPtr->store1);
+    InitLineStore(&sessPtr->store2);
+    for (side = 0; side < 2; side++) {
+        ch = OpenReadChannel(interp, objv[objc - 2 + side], &fileOpts);
+        if (ch == NULL) {
+            DeleteSession((ClientData) sessPtr);
+            result = TCL_ERROR;
+            goto cleanup;
+        }
+        LineStoreReadChannel(side == 0 ? &sessPtr->store1 : &sessPtr->store2,
+                             ch, 1, 0);
+        CloseReadChannel(interp, ch);
+    }
+
+    Tcl_MutexLock(&sessionMutex);
+    sessionCounter++;
+    sprintf(name, "::DiffUtil::session%d", sessionCounter);
+    Tcl_MutexUnlock(&sessionMutex);
+    sessPtr->token = Tcl_CreateObjCommand(interp, name, SessionHandleObjCmd,
+                                          (ClientData) sessPtr,
+                                          DeleteSession);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+
+    cleanup:
+    if (fileOpts.encodingPtr != NULL) {
+        Tcl_DecrRefCount(fileOpts.encodingPtr);
+    }
+    if (fileOpts.translationPtr != NULL) {
+        Tcl_DecrRefCount(fileOpts.translationPtr);
+    }
+    return result;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,317 @@
+/***********************************************************************
+ *
+ * This file implements a per-interpreter cache of diffStrings and
+ * diffStrings2 results, for callers like a viewer that compares the
+ * same line pairs again on each redraw.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "diffutil.h"
+
+#define STRING_CACHE_ASSOC "DiffUtilStringCache"
+#define STRING_CACHE_SIZE 1000
+
+typedef struct StringCacheEntry_T {
+    Tcl_HashEntry *hPtr;
+    Tcl_Obj *resPtr;
+    struct StringCacheEntry_T *prev, *next;
+} StringCacheEntry_T;
+
+typedef struct {
+    int enabled;
+    int size;                   /* Max number of entries */
+    Tcl_WideInt hits, misses;
+    Tcl_HashTable table;        /* Key is the command and its arguments */
+    StringCacheEntry_T *first;  /* Most recently used */
+    StringCacheEntry_T *last;   /* Least recently used */
+} StringCache_T;
+
+static void
+Unlink(StringCache_T *cachePtr, StringCacheEntry_T *entryPtr)
+{
+    if (entryPtr->prev != NULL) {
+        entryPtr->prev->next = entryPtr->next;
+    } else {
+        cachePtr->first = entryPtr->next;
+    }
+    if (entryPtr->next != NULL) {
+        entryPtr->next->prev = entryPtr->prev;
+    } else {
+        cachePtr->last = entryPtr->prev;
+    }
+}
+
+static void
+LinkFirst(StringCache_T *cachePtr, StringCacheEntry_T *entryPtr)
+{
+    entryPtr->prev = NULL;
+    entryPtr->next = cachePtr->first;
+    if (cachePtr->first != NULL) {
+        cachePtr->first->prev = entryPtr;
+    } else {
+        cachePtr->last = entryPtr;
+    }
+    cachePtr->first = entryPtr;
+}
+
+static void
+DeleteEntry(StringCache_T *cachePtr, StringCacheEntry_T *entryPtr)
+{
+    Unlink(cachePtr, entryPtr);
+    Tcl_DeleteHashEntry(entryPtr->hPtr);
+    Tcl_DecrRefCount(entryPtr->resPtr);
+    ckfree((char *) entryPtr);
+}
+
+/*
+ * Remove the least recently used entries until there are at most
+ * "size" left.
+ */
+static void
+TrimStringCache(StringCache_T *cachePtr, int size)
+{
+    while (cachePtr->table.numEntries > size) {
+        DeleteEntry(cachePtr, cachePtr->last);
+    }
+}
+
+static void
+ClearStringCache(StringCache_T *cachePtr)
+{
+    TrimStringCache(cachePtr, 0);
+    cachePtr->hits = cachePtr->misses = 0;
+}
+
+static void
+DeleteStringCache(ClientData clientData, Tcl_Interp *interp)
+{
+    StringCache_T *cachePtr = (StringCache_T *) clientData;
+
+    ClearStringCache(cachePtr);
+    Tcl_DeleteHashTable(&cachePtr->table);
+    ckfree((char *) cachePtr);
+}
+
+static StringCache_T *
+GetStringCache(Tcl_Interp *interp)
+{
+    StringCache_T *cachePtr;
+
+    cachePtr = (StringCache_T *) Tcl_GetAssocData(interp, STRING_CACHE_ASSOC,
+                                                  NULL);
+    if (cachePtr == NULL) {
+        cachePtr = (StringCache_T *) ckalloc(sizeof(StringCache_T));
+        cachePtr->enabled = 0;
+        cachePtr->size = STRING_CACHE_SIZE;
+        cachePtr->hits = cachePtr->misses = 0;
+        cachePtr->first = cachePtr->last = NULL;
+        Tcl_InitHashTable(&cachePtr->table, TCL_STRING_KEYS);
+        Tcl_SetAssocData(interp, STRING_CACHE_ASSOC, DeleteStringCache,
+                         (ClientData) cachePtr);
+    }
+    return cachePtr;
+}
+
+/*
+ * Look up a call in the cache. The key is made from the command name
+ * and all its arguments, each prefixed by its length, so it tells
+ * exactly which strings and options were given. It is filled in to be
+ * used for a following StringCacheStore, and must be released with
+ * Tcl_DStringFree. Returns the cached result, or NULL on a miss.
+ */
+Tcl_Obj *
+StringCacheLookup(
+    Tcl_Interp *interp,
+    const char *cmd,
+    int objc,
+    Tcl_Obj *CONST objv[],
+    Tcl_DString *keyPtr)
+{
+    StringCache_T *cachePtr;
+    StringCacheEntry_T *entryPtr;
+    Tcl_HashEntry *hPtr;
+    char *str, buf[TCL_INTEGER_SPACE + 1];
+    int t, length;
+
+    Tcl_DStringInit(keyPtr);
+    cachePtr = (StringCache_T *) Tcl_GetAssocData(interp, STRING_CACHE_ASSOC,
+                                                  NULL);
+    if (cachePtr == NULL || !cachePtr->enabled) {
+        return NULL;
+    }
+
+    Tcl_DStringAppend(keyPtr, cmd, -1);
+    for (t = 0; t < objc; t++) {
+        str = Tcl_GetStringFromObj(objv[t], &length);
+        sprintf(buf, " %d:", length);
+        Tcl_DStringAppend(keyPtr, buf, -1);
+        Tcl_DStringAppend(keyPtr, str, length);
+    }
+
+    hPtr = Tcl_FindHashEntry(&cachePtr->table, Tcl_DStringValue(keyPtr));
+    if (hPtr != NULL) {
+        entryPtr = (StringCacheEntry_T *) Tcl_GetHashValue(hPtr);
+        Unlink(cachePtr, entryPtr);
+        LinkFirst(cachePtr, entryPtr);
+        cachePtr->hits++;
+        return entryPtr->resPtr;
+    }
+    cachePtr->misses++;
+    return NULL;
+}
+
+/*
+ * Store the result of a call that was looked up and missed.
+ * If the cache is full, the least recently used entry is dropped.
+ */
+void
+StringCacheStore(
+    Tcl_Interp *interp,
+    Tcl_DString *keyPtr,
+    Tcl_Obj *resPtr)
+{
+    StringCache_T *cachePtr;
+    StringCacheEntry_T *entryPtr;
+    Tcl_HashEntry *hPtr;
+    int isNew;
+
+    if (Tcl_DStringLength(keyPtr) == 0) {
+        return;
+    }
+    cachePtr = GetStringCache(interp);
+    if (!cachePtr->enabled || cachePtr->size <= 0) {
+        return;
+    }
+    hPtr = Tcl_CreateHashEntry(&cachePtr->table, Tcl_DStringValue(keyPtr),
+                               &isNew);
+    if (!isNew) {
+        return;
+    }
+    entryPtr = (StringCacheEntry_T *) ckalloc(sizeof(StringCacheEntry_T));
+    entryPtr->hPtr = hPtr;
+    entryPtr->resPtr = resPtr;
+    Tcl_IncrRefCount(resPtr);
+    Tcl_SetHashValue(hPtr, (ClientData) entryPtr);
+    LinkFirst(cachePtr, entryPtr);
+    TrimStringCache(cachePtr, cachePtr->size);
+}
+
+/*
+ * DiffUtil::stringCache subcommand ?args?
+ */
+int
+StringCacheObjCmd(
+    ClientData dummy,    	/* Not used. */
+    Tcl_Interp *interp,		/* Current interpreter. */
+    int objc,			/* Number of arguments. */
+    Tcl_Obj *CONST objv[])	/* Argument objects. */
+{
+    int index, enabled, size;
+    StringCache_T *cachePtr;
+    Tcl_Obj *resPtr;
+
+    static CONST char *subCommands[] = {
+        "clear", "enable", "size", "stats", (char *) NULL
+    };
+    enum subCommands {
+        SUB_CLEAR, SUB_ENABLE, SUB_SIZE, SUB_STATS
+    };
+
+    if (objc < 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "subcommand ?arg?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], subCommands, "subcommand", 0,
+                            &index) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    cachePtr = GetStringCache(interp);
+
+    switch (index) {
+      case SUB_CLEAR:
+          if (objc != 2) {
+              Tcl_WrongNumArgs(interp, 2, objv, NULL);
+              return TCL_ERROR;
+          }
+          ClearStringCache(cachePtr);
+          break;
+      case SUB_ENABLE:
+          if (objc > 3) {
+              Tcl_WrongNumArgs(interp, 2, objv, "?boolean?");
+              return TCL_ERROR;
+          }
+          if (objc == 3) {
+              if (Tcl_GetBooleanFromObj(interp, objv[2], &enabled)
+                      != TCL_OK) {
+                  return TCL_ERROR;
+              }
+              cachePtr->enabled = enabled;
+              if (!enabled) {
+                  ClearStringCache(cachePtr);
+              }
+          }
+          Tcl_SetObjResult(interp, Tcl_NewBooleanObj(cachePtr->enabled));
+          break;
+      case SUB_SIZE:
+          if (objc > 3) {
+              Tcl_WrongNumArgs(interp, 2, objv, "?size?");
+              return TCL_ERROR;
+          }
+          if (objc == 3) {
+              if (Tcl_GetIntFromObj(interp, objv[2], &size) != TCL_OK) {
+                  return TCL_ERROR;
+              }
+              if (size < 0) {
+                  Tcl_SetResult(interp, "bad size", TCL_STATIC);
+                  return TCL_ERROR;
+              }
+              cachePtr->size = size;
+              TrimStringCache(cachePtr, size);
+          }
+          Tcl_SetObjResult(interp, Tcl_NewIntObj(cachePtr->size));
+          break;
+      case SUB_STATS:
+          if (objc != 2) {
+              Tcl_WrongNumArgs(interp, 2, objv, NULL);
+              return TCL_ERROR;
+          }
+          resPtr = Tcl_NewListObj(0, NULL);
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("enabled", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewBooleanObj(cachePtr->enabled));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("size", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewIntObj(cachePtr->size));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("entries", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewIntObj(cachePtr->table.numEntries));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("hits", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewWideIntObj(cachePtr->hits));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewStringObj("misses", -1));
+          Tcl_ListObjAppendElement(NULL, resPtr,
+                  Tcl_NewWideIntObj(cachePtr->misses));
+          Tcl_SetObjResult(interp, resPtr);
+          break;
+    }
+    return TCL_OK;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,494 @@
+/***********************************************************************
+ *
+ * This file implements the unordered diff, where lines are matched
+ * regardless of where they are, like for sets of lines. The two sides
+ * are matched by a hash join, which only needs a linear pass over each.
+ * Hashing and joining does not involve any Tcl_Obj, and for large
+ * inputs they are split over a pool of threads.
+ *
+ * Copyright (c) 2026, Peter Spjuth
+ *
+ ***********************************************************************/
+
+#include <tcl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "diffutil.h"
+
+/* Number of lines hashed by each work item */
+#define HASH_CHUNK_LINES 65536
+
+/*
+ * Lines per partition of a join, and the most partitions. A small
+ * partition keeps its hash table in the cache, which makes the join
+ * quicker even without threads.
+ */
+#define JOIN_PART_LINES 4096
+#define JOIN_MAX_PARTS  4096
+
+/*
+ * A class of equal lines, while joining a partition.
+ * The side 2 lines of a class are queued in order, and each side 1
+ * line takes the first in the queue. Thus the first copy on side 1
+ * matches the first on side 2, and so on.
+ */
+typedef struct {
+    Hash_T hash;
+    const char *string;       /* The first line seen in the class */
+    int length;
+    Line_T next;              /* Next class in the same bucket, or 0 */
+    Line_T head2, tail2;      /* Queue of unmatched side 2 lines */
+    Line_T left2;             /* Number of lines in the queue */
+    Line_T first1;            /* First unmatched side 1 line, or 0 */
+    Line_T left1;             /* Number of unmatched side 1 lines */
+} Class_T;
+
+/* The classes of a partition, in a chained hash table */
+typedef struct {
+    Class_T *classes;         /* Index 0 is not used */
+    Line_T nClasses;
+    Line_T *buckets;          /* First class in each bucket, or 0 */
+    Hash_T mask;
+} ClassTable_T;
+
+/*
+ * A join, shared by the work items. Lines are split in partitions by
+ * their hash, which makes the partitions independent of each other.
+ */
+typedef struct {
+    Unordered_T *side1Ptr, *side2Ptr;
+    const DiffOptions_T *optsPtr;
+    int nParts;
+    Line_T *order1, *order2;  /* Lines grouped by partition, or NULL
+                               * when there is only one */
+    Line_T *start1, *start2;  /* Where each partition starts in them */
+    Line_T *next2;            /* Links in the queues of side 2 lines */
+} Join_T;
+
+/* Hashing of one side, shared by the work items */
+typedef struct {
+    Unordered_T *sidePtr;
+    const DiffOptions_T *optsPtr;
+} HashJob_T;
+
+/*
+ * The low bits of a line hash depend on few of the characters, so the
+ * high bits are mixed in before it selects a partition or a bucket.
+ */
+static Hash_T
+MixHash(Hash_T hash)
+{
+    hash ^= (hash >> 16) >> 16;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bUL;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/*
+ * Allocate a side with room for n lines.
+ * The caller fills in the strings, and the hashes e.g. by UnorderedHash.
+ */
+void
+InitUnordered(Unordered_T *sidePtr, Line_T n)
+{
+    sidePtr->n = n;
+    sidePtr->strings = (const char **) ckalloc((n + 1) * sizeof(char *));
+    sidePtr->lengths = (int *) ckalloc((n + 1) * sizeof(int));
+    sidePtr->hashes = (Hash_T *) ckalloc((n + 1) * sizeof(Hash_T));
+    sidePtr->match = (Line_T *) ckalloc((n + 1) * sizeof(Line_T));
+    sidePtr->count = (Line_T *) ckalloc((n + 1) * sizeof(Line_T));
+    memset(sidePtr->match, 0, (n + 1) * sizeof(Line_T));
+    memset(sidePtr->count, 0, (n + 1) * sizeof(Line_T));
+    sidePtr->objs = NULL;
+}
+
+/*
+ * Release a side. The match array is kept if the caller has taken it
+ * and set it to NULL.
+ */
+void
+FreeUnordered(Unordered_T *sidePtr)
+{
+    Line_T i;
+
+    ckfree((char *) sidePtr->strings);
+    ckfree((char *) sidePtr->lengths);
+    ckfree((char *) sidePtr->hashes);
+    if (sidePtr->match != NULL) {
+        ckfree((char *) sidePtr->match);
+    }
+    ckfree((char *) sidePtr->count);
+    if (sidePtr->objs != NULL) {
+        for (i = 1; i <= sidePtr->n; i++) {
+            if (sidePtr->objs[i] != NULL) {
+                Tcl_DecrRefCount(sidePtr->objs[i]);
+            }
+        }
+        ckfree((char *) sidePtr->objs);
+    }
+}
+
+/*
+ * Hash the lines of one work item.
+ */
+static void
+HashChunk(ClientData clientData, int index, ClientData *workerDataPtr)
+{
+    HashJob_T *jobPtr = (HashJob_T *) clientData;
+    Unordered_T *sidePtr = jobPtr->sidePtr;
+    Line_T i, first, last;
+    Hash_T real;
+
+    first = (Line_T) index * HASH_CHUNK_LINES + 1;
+    last = first + HASH_CHUNK_LINES - 1;
+    if (last > sidePtr->n) last = sidePtr->n;
+    for (i = first; i <= last; i++) {
+        HashLine(sidePtr->strings[i], sidePtr->lengths[i], jobPtr->optsPtr,
+                 &sidePtr->hashes[i], &real);
+    }
+}
+
+/*
+ * Hash all lines of a side, using up to nThreads threads.
+ */
+void
+UnorderedHash(
+    Unordered_T *sidePtr,
+    const DiffOptions_T *optsPtr,
+    int nThreads)
+{
+    Parallel_T par;
+    HashJob_T job;
+    int t, count;
+
+    job.sidePtr = sidePtr;
+    job.optsPtr = optsPtr;
+    count = (int) ((sidePtr->n + HASH_CHUNK_LINES - 1) / HASH_CHUNK_LINES);
+    if (nThreads <= 1 || count <= 1) {
+        for (t = 0; t < count; t++) {
+            HashChunk((ClientData) &job, t, NULL);
+        }
+        return;
+    }
+    ParallelStart(&par, nThreads, count, HashChunk, NULL, (ClientData) &job);
+    for (t = 0; t < count; t++) {
+        ParallelWait(&par, t);
+    }
+    ParallelFinish(&par);
+}
+
+/*
+ * Fill in a side from the lines in a line store, and hash them.
+ * The store must be kept while the side is used.
+ * Regsub needs Tcl_Obj, so with regsub this must be called by the
+ * thread owning the options.
+ */
+void
+UnorderedFromStore(
+    Unordered_T *sidePtr,
+    const LineStore_T *storePtr,
+    const DiffOptions_T *optsPtr,
+    int left,
+    int nThreads)
+{
+    Line_T i;
+    Tcl_Obj *objPtr, *regsubPtr = left ?
+            optsPtr->regsubLeftPtr : optsPtr->regsubRightPtr;
+
+    InitUnordered(sidePtr, storePtr->n);
+    if (regsubPtr != NULL) {
+        sidePtr->objs = (Tcl_Obj **)
+                ckalloc((storePtr->n + 1) * sizeof(Tcl_Obj *));
+        sidePtr->objs[0] = NULL;
+    }
+    for (i = 1; i <= storePtr->n; i++) {
+        if (regsubPtr != NULL) {
+            objPtr = ApplyRegsub(Tcl_NewStringObj(LineStoreLine(storePtr, i),
+                                        LineStoreLength(storePtr, i)),
+                                 optsPtr, left);
+            sidePtr->objs[i] = objPtr;
+            sidePtr->strings[i] = Tcl_GetStringFromObj(objPtr,
+                                                       &sidePtr->lengths[i]);
+        } else {
+            sidePtr->strings[i] = LineStoreLine(storePtr, i);
+            sidePtr->lengths[i] = LineStoreLength(storePtr, i);
+        }
+    }
+    UnorderedHash(sidePtr, optsPtr, nThreads);
+}
+
+/*
+ * Find the class of a line, or add a new one.
+ */
+static Class_T *
+LookupClass(
+    ClassTable_T *tablePtr,
+    const Join_T *joinPtr,
+    Hash_T hash,
+    const char *string,
+    int length)
+{
+    Line_T c, *bucketPtr;
+    Class_T *classPtr;
+
+    /* The remainder of the mixed hash selected the partition */
+    bucketPtr = &tablePtr->buckets[
+            (MixHash(hash) / joinPtr->nParts) & tablePtr->mask];
+    for (c = *bucketPtr; c != 0; c = classPtr->next) {
+        classPtr = &tablePtr->classes[c];
+        if (classPtr->hash != hash) continue;
+        if (joinPtr->optsPtr->ignore == 0) {
+            /* Equal strings are equal bytes, which is quicker to see */
+            if (length == classPtr->length &&
+                    memcmp(string, classPtr->string, length) == 0) {
+                return classPtr;
+            }
+        } else if (CompareLines(string, length, classPtr->string,
+                                classPtr->length, joinPtr->optsPtr) == 0) {
+            return classPtr;
+        }
+    }
+    c = ++tablePtr->nClasses;
+    classPtr = &tablePtr->classes[c];
+    memset(classPtr, 0, sizeof(Class_T));
+    classPtr->hash = hash;
+    classPtr->string = string;
+    classPtr->length = length;
+    classPtr->next = *bucketPtr;
+    *bucketPtr = c;
+    return classPtr;
+}
+
+/* Line k of a partition, see Join_T */
+#define PartLine(order, k) ((order) == NULL ? (k) + 1 : (order)[k])
+
+/*
+ * Join the lines of one partition.
+ */
+static void
+JoinPart(ClientData clientData, int index, ClientData *workerDataPtr)
+{
+    Join_T *joinPtr = (Join_T *) clientData;
+    Unordered_T *side1Ptr = joinPtr->side1Ptr;
+    Unordered_T *side2Ptr = joinPtr->side2Ptr;
+    ClassTable_T table;
+    Class_T *classPtr;
+    Line_T i, j, k, c, first1, last1, first2, last2, size;
+
+    if (joinPtr->order1 == NULL) {
+        first1 = first2 = 0;
+        last1 = side1Ptr->n;
+        last2 = side2Ptr->n;
+    } else {
+        first1 = joinPtr->start1[index];
+        last1 = joinPtr->start1[index + 1];
+        first2 = joinPtr->start2[index];
+        last2 = joinPtr->start2[index + 1];
+    }
+
+    size = 16;
+    while (size < (last1 - first1) + (last2 - first2)) size *= 2;
+    table.buckets = (Line_T *) ckalloc(size * sizeof(Line_T));
+    memset(table.buckets, 0, size * sizeof(Line_T));
+    table.mask = size - 1;
+    table.classes = (Class_T *) ckalloc(
+            ((last1 - first1) + (last2 - first2) + 1) * sizeof(Class_T));
+    table.nClasses = 0;
+
+    /* Queue up the side 2 lines of each class */
+    for (k = first2; k < last2; k++) {
+        j = PartLine(joinPtr->order2, k);
+        classPtr = LookupClass(&table, joinPtr, side2Ptr->hashes[j],
+                               side2Ptr->strings[j], side2Ptr->lengths[j]);
+        joinPtr->next2[j] = 0;
+        if (classPtr->tail2 == 0) {
+            classPtr->head2 = j;
+        } else {
+            joinPtr->next2[classPtr->tail2] = j;
+        }
+        classPtr->tail2 = j;
+        classPtr->left2++;
+    }
+
+    /* Match each side 1 line with the first one left in its class */
+    for (k = first1; k < last1; k++) {
+        i = PartLine(joinPtr->order1, k);
+        classPtr = LookupClass(&table, joinPtr, side1Ptr->hashes[i],
+                               side1Ptr->strings[i], side1Ptr->lengths[i]);
+        if (classPtr->head2 != 0) {
+            j = classPtr->head2;
+            classPtr->head2 = joinPtr->next2[j];
+            classPtr->left2--;
+            side1Ptr->match[i] = j;
+            side2Ptr->match[j] = i;
+        } else {
+            if (classPtr->first1 == 0) {
+                classPtr->first1 = i;
+            }
+            classPtr->left1++;
+        }
+    }
+
+    /* Note the number of unmatched copies at the first of them */
+    for (c = 1; c <= table.nClasses; c++) {
+        classPtr = &table.classes[c];
+        if (classPtr->left1 > 0) {
+            side1Ptr->count[classPtr->first1] = classPtr->left1;
+        }
+        if (classPtr->left2 > 0) {
+            side2Ptr->count[classPtr->head2] = classPtr->left2;
+        }
+    }
+    ckfree((char *) table.buckets);
+    ckfree((char *) table.classes);
+}
+
+/*
+ * Group the lines of a side by partition, keeping them in order
+ * within each partition.
+ */
+static void
+PartitionSide(
+    const Unordered_T *sidePtr,
+    int nParts,
+    Line_T **orderPtr,
+    Line_T **startPtr)
+{
+    Line_T i, *order, *start, *fill;
+    int p;
+
+    start = (Line_T *) ckalloc((nParts + 1) * sizeof(Line_T));
+    fill = (Line_T *) ckalloc(nParts * sizeof(Line_T));
+    memset(start, 0, (nParts + 1) * sizeof(Line_T));
+    for (i = 1; i <= sidePtr->n; i++) {
+        start[MixHash(sidePtr->hashes[i]) % nParts + 1]++;
+    }
+    for (p = 0; p < nParts; p++) {
+        start[p + 1] += start[p];
+        fill[p] = start[p];
+    }
+    order = (Line_T *) ckalloc((sidePtr->n + 1) * sizeof(Line_T));
+    for (i = 1; i <= sidePtr->n; i++) {
+        order[fill[MixHash(sidePtr->hashes[i]) % nParts]++] = i;
+    }
+    ckfree((char *) fill);
+    *orderPtr = order;
+    *startPtr = start;
+}
+
+/*
+ * Match the lines of two hashed sides, regardless of their order.
+ * This fills in the match and count arrays of both sides.
+ * Large inputs are split in partitions, joined by up to nThreads
+ * threads.
+ */
+void
+UnorderedJoin(
+    Unordered_T *side1Ptr,
+    Unordered_T *side2Ptr,
+    const DiffOptions_T *optsPtr,
+    int nThreads)
+{
+    Join_T join;
+    Parallel_T par;
+    Line_T total;
+    int p;
+
+    total = side1Ptr->n + side2Ptr->n;
+    join.side1Ptr = side1Ptr;
+    join.side2Ptr = side2Ptr;
+    join.optsPtr = optsPtr;
+    join.nParts = (int) (total / JOIN_PART_LINES);
+    if (join.nParts > JOIN_MAX_PARTS) join.nParts = JOIN_MAX_PARTS;
+    if (join.nParts < 1) join.nParts = 1;
+    join.order1 = join.order2 = join.start1 = join.start2 = NULL;
+    join.next2 = (Line_T *) ckalloc((side2Ptr->n + 1) * sizeof(Line_T));
+
+    if (join.nParts == 1) {
+        JoinPart((ClientData) &join, 0, NULL);
+    } else {
+        PartitionSide(side1Ptr, join.nParts, &join.order1, &join.start1);
+        PartitionSide(side2Ptr, join.nParts, &join.order2, &join.start2);
+        ParallelStart(&par, nThreads, join.nParts, JoinPart, NULL,
+                      (ClientData) &join);
+        for (p = 0; p < join.nParts; p++) {
+            ParallelWait(&par, p);
+        }
+        ParallelFinish(&par);
+        ckfree((char *) join.order1);
+        ckfree((char *) join.order2);
+        ckfree((char *) join.start1);
+        ckfree((char *) join.start2);
+    }
+    ckfree((char *) join.next2);
+}
+
+/*
+ * Append a {Line Count} pair for each unmatched line of a side, at the
+ * first of its copies.
+ */
+static void
+AppendUnmatched(
+    const Unordered_T *sidePtr,
+    const DiffOptions_T *optsPtr,
+    Tcl_Obj *listPtr)
+{
+    Tcl_Obj *pairPtr;
+    Line_T i;
+
+    for (i = 1; i <= sidePtr->n; i++) {
+        if (sidePtr->count[i] == 0) continue;
+        pairPtr = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(NULL, pairPtr,
+                Tcl_NewLongObj((long) (i + optsPtr->firstIndex - 1)));
+        Tcl_ListObjAppendElement(NULL, pairPtr,
+                Tcl_NewLongObj((long) sidePtr->count[i]));
+        Tcl_ListObjAppendElement(NULL, listPtr, pairPtr);
+    }
+}
+
+/*
+ * Build the result of a join.
+ * The diff style gives two lists, of the lines only in side 1 and only
+ * in side 2. The match style gives two lists of matched lines, in the
+ * order of side 1.
+ */
+Tcl_Obj *
+UnorderedResult(
+    const Unordered_T *side1Ptr,
+    const Unordered_T *side2Ptr,
+    const DiffOptions_T *optsPtr)
+{
+    Tcl_Obj *resPtr, *leftPtr, *rightPtr;
+    Line_T i;
+
+    leftPtr = Tcl_NewListObj(0, NULL);
+    rightPtr = Tcl_NewListObj(0, NULL);
+    if (optsPtr->resultStyle == Result_Match) {
+        for (i = 1; i <= side1Ptr->n; i++) {
+            if (side1Ptr->match[i] == 0) continue;
+            Tcl_ListObjAppendElement(NULL, leftPtr,
+                    Tcl_NewLongObj((long) (i + optsPtr->firstIndex - 1)));
+            Tcl_ListObjAppendElement(NULL, rightPtr,
+                    Tcl_NewLongObj((long) (side1Ptr->match[i] +
+                                           optsPtr->firstIndex - 1)));
+        }
+    } else {
+        AppendUnmatched(side1Ptr, optsPtr, leftPtr);
+        AppendUnmatched(side2Ptr, optsPtr, rightPtr);
+    }
+    resPtr = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(NULL, resPtr, leftPtr);
+    Tcl_ListObjAppendElement(NULL, resPtr, rightPtr);
+    return resPtr;
+}
+
+/*
+ * Local Variables:
+ * mode: c
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */